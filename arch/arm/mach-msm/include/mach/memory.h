@@ -75,6 +75,22 @@ unsigned long allocate_contiguous_ebi_nomap(unsigned long, unsigned long);
 void clean_and_invalidate_caches(unsigned long, unsigned long, unsigned long);
 void clean_caches(unsigned long, unsigned long, unsigned long);
 void invalidate_caches(unsigned long, unsigned long, unsigned long);
+
+#define MSM_CACHE_OP_CLEAN	0x1
+#define MSM_CACHE_OP_INV	0x2
+#define MSM_CACHE_OP_FLUSH	(MSM_CACHE_OP_CLEAN | MSM_CACHE_OP_INV)
+/* restrict a batch to the L1 (by vstart) or the outer cache (by pstart),
+ * neither means both */
+#define MSM_CACHE_INNER		0x10
+#define MSM_CACHE_OUTER		0x20
+
+struct msm_cache_range {
+	unsigned long vstart;
+	unsigned long pstart;
+	unsigned long length;
+};
+u64 msm_cache_maint_ranges(unsigned int op,
+	const struct msm_cache_range *ranges, unsigned int nr);
 int platform_physical_remove_pages(u64, u64);
 int platform_physical_active_pages(u64, u64);
 int platform_physical_low_power_pages(u64, u64);
@@ -193,6 +193,14 @@ void smd_enable_read_intr(smd_channel_t *ch);
  */
 void smd_disable_read_intr(smd_channel_t *ch);
 
+/* Holds back the interrupt to the other end for writes made until
+ * smd_write_batch_end(), which sends a single interrupt if anything was
+ * written.  Lets a writer with several packets queued hand them over in
+ * one go.  The caller must serialize its writes to the channel.
+ */
+void smd_write_batch_start(smd_channel_t *ch);
+void smd_write_batch_end(smd_channel_t *ch);
+
 /* Starts a packet transaction.  The size of the packet may exceed the total
  * size of the smd ring buffer.
  *
@@ -322,6 +330,14 @@ static inline void smd_disable_read_intr(smd_channel_t *ch)
 {
 }
 
+static inline void smd_write_batch_start(smd_channel_t *ch)
+{
+}
+
+static inline void smd_write_batch_end(smd_channel_t *ch)
+{
+}
+
 static inline int smd_write_start(smd_channel_t *ch, int len)
 {
 	return -ENODEV;
@@ -251,6 +251,7 @@ static struct android_pmem_platform_data android_pmem_pdata = {
 	.allocator_type = PMEM_ALLOCATORTYPE_BITMAP,
 	.cached = 1,
 	.memory_type = MEMTYPE_EBI1,
+	.cleancache = 1,
 };
 
 static struct android_pmem_platform_data android_pmem_adsp_pdata = {
@@ -258,6 +259,7 @@ static struct android_pmem_platform_data android_pmem_adsp_pdata = {
 	.allocator_type = PMEM_ALLOCATORTYPE_BITMAP,
 	.cached = 1,
 	.memory_type = MEMTYPE_EBI1,
+	.cleancache = 1,
 };
 
 
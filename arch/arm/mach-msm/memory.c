@@ -24,6 +24,7 @@
 #include <asm/io.h>
 #include <asm/mach/map.h>
 #include <asm/cacheflush.h>
+#include <asm/sizes.h>
 #include <asm/setup.h>
 #include <asm/mach-types.h>
 #include <mach/msm_memtypes.h>
@@ -38,6 +39,10 @@
 #include <mach/socinfo.h>
 #include <../../mm/mm.h>
 #include <linux/fmem.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
+#include <linux/spinlock.h>
 
 void *strongly_ordered_page;
 char strongly_ordered_mem[PAGE_SIZE*2-4];
@@ -146,6 +151,184 @@ void invalidate_caches(unsigned long vstart,
 	flush_axi_bus_buffer();
 }
 
+/* Past this many bytes in one batch it is cheaper to clean and invalidate
+ * the whole L1 than to walk the ranges line by line.
+ */
+static unsigned int msm_cache_full_threshold = SZ_64K;
+
+static DEFINE_SPINLOCK(msm_cache_stat_lock);
+static struct {
+	unsigned long calls;
+	unsigned long ranges;
+	unsigned long full;
+	u64 bytes;
+	u64 total_ns;
+	u64 max_ns;
+} msm_cache_stat;
+
+static void msm_cache_range_inner(unsigned int op, unsigned long vstart,
+	unsigned long length)
+{
+	unsigned long vaddr;
+
+	switch (op & MSM_CACHE_OP_FLUSH) {
+	case MSM_CACHE_OP_FLUSH:
+		for (vaddr = vstart; vaddr < vstart + length;
+				vaddr += CACHE_LINE_SIZE)
+			asm ("mcr p15, 0, %0, c7, c14, 1" : : "r" (vaddr));
+		break;
+	case MSM_CACHE_OP_CLEAN:
+		for (vaddr = vstart; vaddr < vstart + length;
+				vaddr += CACHE_LINE_SIZE)
+			asm ("mcr p15, 0, %0, c7, c10, 1" : : "r" (vaddr));
+		break;
+	case MSM_CACHE_OP_INV:
+		for (vaddr = vstart; vaddr < vstart + length;
+				vaddr += CACHE_LINE_SIZE)
+			asm ("mcr p15, 0, %0, c7, c6, 1" : : "r" (vaddr));
+		break;
+	}
+}
+
+#ifdef CONFIG_OUTER_CACHE
+static void msm_cache_range_outer(unsigned int op, unsigned long pstart,
+	unsigned long length)
+{
+	switch (op & MSM_CACHE_OP_FLUSH) {
+	case MSM_CACHE_OP_FLUSH:
+		outer_flush_range(pstart, pstart + length);
+		break;
+	case MSM_CACHE_OP_CLEAN:
+		outer_clean_range(pstart, pstart + length);
+		break;
+	case MSM_CACHE_OP_INV:
+		outer_inv_range(pstart, pstart + length);
+		break;
+	}
+}
+#endif
+
+/*
+ * Batched form of the routines above: one barrier, one I-cache invalidate
+ * and one AXI drain for the whole list instead of one per range. When a
+ * clean or flush covers more than msm_cache_full_threshold bytes the whole
+ * L1 is cleaned and invalidated instead. A plain invalidate always goes by
+ * range: writing back dirty lines would overwrite what a device just put
+ * in the buffers. Outer cache maintenance is always done by range.
+ *
+ * Returns the time spent, in nanoseconds.
+ */
+u64 msm_cache_maint_ranges(unsigned int op,
+	const struct msm_cache_range *ranges, unsigned int nr)
+{
+	unsigned long total = 0, flags;
+	ktime_t start = ktime_get();
+	unsigned int i;
+	int full = 0;
+	u64 ns;
+
+	if (!(op & (MSM_CACHE_INNER | MSM_CACHE_OUTER)))
+		op |= MSM_CACHE_INNER | MSM_CACHE_OUTER;
+
+	for (i = 0; i < nr; i++)
+		total += ranges[i].length;
+
+	if (op & MSM_CACHE_INNER) {
+		if ((op & MSM_CACHE_OP_CLEAN) &&
+		    total >= msm_cache_full_threshold) {
+			flush_cache_all();
+			full = 1;
+		} else {
+			for (i = 0; i < nr; i++)
+				msm_cache_range_inner(op, ranges[i].vstart,
+					ranges[i].length);
+		}
+	}
+#ifdef CONFIG_OUTER_CACHE
+	if (op & MSM_CACHE_OUTER)
+		for (i = 0; i < nr; i++)
+			msm_cache_range_outer(op, ranges[i].pstart,
+				ranges[i].length);
+#endif
+	asm ("mcr p15, 0, %0, c7, c10, 4" : : "r" (0));
+	asm ("mcr p15, 0, %0, c7, c5, 0" : : "r" (0));
+
+	flush_axi_bus_buffer();
+
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	spin_lock_irqsave(&msm_cache_stat_lock, flags);
+	msm_cache_stat.calls++;
+	msm_cache_stat.ranges += nr;
+	msm_cache_stat.full += full;
+	msm_cache_stat.bytes += total;
+	msm_cache_stat.total_ns += ns;
+	if (ns > msm_cache_stat.max_ns)
+		msm_cache_stat.max_ns = ns;
+	spin_unlock_irqrestore(&msm_cache_stat_lock, flags);
+
+	return ns;
+}
+EXPORT_SYMBOL(msm_cache_maint_ranges);
+
+#ifdef CONFIG_DEBUG_FS
+static int msm_cache_stat_show(struct seq_file *m, void *unused)
+{
+	unsigned long flags;
+	typeof(msm_cache_stat) stat;
+
+	spin_lock_irqsave(&msm_cache_stat_lock, flags);
+	stat = msm_cache_stat;
+	spin_unlock_irqrestore(&msm_cache_stat_lock, flags);
+
+	seq_printf(m, "calls %lu\nranges %lu\nfull %lu\nbytes %llu\n"
+		"total_us %llu\nmax_us %llu\n",
+		stat.calls, stat.ranges, stat.full, stat.bytes,
+		div_u64(stat.total_ns, NSEC_PER_USEC),
+		div_u64(stat.max_ns, NSEC_PER_USEC));
+	return 0;
+}
+
+static int msm_cache_stat_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, msm_cache_stat_show, NULL);
+}
+
+static ssize_t msm_cache_stat_write(struct file *file,
+	const char __user *buf, size_t count, loff_t *ppos)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&msm_cache_stat_lock, flags);
+	memset(&msm_cache_stat, 0, sizeof(msm_cache_stat));
+	spin_unlock_irqrestore(&msm_cache_stat_lock, flags);
+	return count;
+}
+
+static const struct file_operations msm_cache_stat_fops = {
+	.open = msm_cache_stat_open,
+	.read = seq_read,
+	.write = msm_cache_stat_write,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int __init msm_cache_debugfs_init(void)
+{
+	struct dentry *dir;
+
+	dir = debugfs_create_dir("msm_cache", NULL);
+	if (IS_ERR_OR_NULL(dir))
+		return 0;
+	debugfs_create_file("stats", S_IRUGO | S_IWUSR, dir, NULL,
+		&msm_cache_stat_fops);
+	debugfs_create_u32("full_threshold", S_IRUGO | S_IWUSR, dir,
+		&msm_cache_full_threshold);
+	return 0;
+}
+late_initcall(msm_cache_debugfs_init);
+#endif
+
 void *alloc_bootmem_aligned(unsigned long size, unsigned long alignment)
 {
 	void *unused_addr = NULL;
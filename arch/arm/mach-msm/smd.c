@@ -630,6 +630,12 @@ struct smd_channel {
 	int pending_pkt_sz;
 
 	char is_pkt_ch;
+
+	/* set between smd_write_batch_start() and smd_write_batch_end() */
+	char tx_batch;
+	char tx_batch_pending;
+
+	struct smd_ch_counters stats;
 };
 
 struct edge_to_pid {
@@ -918,6 +924,12 @@ static int ch_is_open(struct smd_channel *ch)
 		&& (ch->send->state == SMD_SS_OPENED);
 }
 
+static inline void ch_notify_other_cpu(struct smd_channel *ch)
+{
+	ch->stats.intr_out++;
+	ch->notify_other_cpu();
+}
+
 /* provide a pointer and length to readable data in the fifo */
 static unsigned ch_read_buffer(struct smd_channel *ch, void **ptr)
 {
@@ -943,6 +955,7 @@ static void ch_read_done(struct smd_channel *ch, unsigned count)
 	ch->recv->tail = (ch->recv->tail + count) & ch->fifo_mask;
 	wmb();
 	ch->send->fTAIL = 1;
+	ch->stats.rx_bytes += count;
 }
 
 /* basic read interface to ch_read_{buffer,done} used
@@ -1008,6 +1021,8 @@ static void update_packet_state(struct smd_channel *ch)
 		BUG_ON(r != SMD_HEADER_SIZE);
 
 		ch->current_packet = hdr[0];
+		if (ch->current_packet)
+			ch->stats.rx_pkts++;
 	}
 }
 
@@ -1037,6 +1052,7 @@ static void ch_write_done(struct smd_channel *ch, unsigned count)
 	ch->send->head = (ch->send->head + count) & ch->fifo_mask;
 	wmb();
 	ch->send->fHEAD = 1;
+	ch->stats.tx_bytes += count;
 }
 
 static void ch_set_state(struct smd_channel *ch, unsigned n)
@@ -1052,7 +1068,7 @@ static void ch_set_state(struct smd_channel *ch, unsigned n)
 	}
 	ch->send->state = n;
 	ch->send->fSTATE = 1;
-	ch->notify_other_cpu();
+	ch_notify_other_cpu(ch);
 }
 
 static void do_smd_probe(void)
@@ -1162,6 +1178,7 @@ static void handle_smd_irq(struct list_head *list, void (*notify)(void))
 			state_change = 1;
 		}
 		if (ch_flags & 0x3) {
+			ch->stats.intr_in++;
 			ch->update_state(ch);
 			SMx_POWER_INFO("SMD ch%d '%s' Data event r%d/w%d\n",
 					ch->n, ch->name,
@@ -1333,8 +1350,15 @@ static int smd_stream_write(smd_channel_t *ch, const void *_data, int len,
 			break;
 	}
 
-	if (orig_len - len)
-		ch->notify_other_cpu();
+	if (len)
+		ch->stats.tx_full++;
+
+	if (orig_len - len) {
+		if (ch->tx_batch)
+			ch->tx_batch_pending = 1;
+		else
+			ch_notify_other_cpu(ch);
+	}
 
 	return orig_len - len;
 }
@@ -1351,8 +1375,10 @@ static int smd_packet_write(smd_channel_t *ch, const void *_data, int len,
 	else if (len == 0)
 		return 0;
 
-	if (smd_stream_write_avail(ch) < (len + SMD_HEADER_SIZE))
+	if (smd_stream_write_avail(ch) < (len + SMD_HEADER_SIZE)) {
+		ch->stats.tx_full++;
 		return -ENOMEM;
+	}
 
 	hdr[0] = len;
 	hdr[1] = hdr[2] = hdr[3] = hdr[4] = 0;
@@ -1386,7 +1412,7 @@ static int smd_stream_read(smd_channel_t *ch, void *data, int len, int user_buf)
 	r = ch_read(ch, data, len, user_buf);
 	if (r > 0)
 		if (!read_intr_blocked(ch))
-			ch->notify_other_cpu();
+			ch_notify_other_cpu(ch);
 
 	return r;
 }
@@ -1405,7 +1431,7 @@ static int smd_packet_read(smd_channel_t *ch, void *data, int len, int user_buf)
 	r = ch_read(ch, data, len, user_buf);
 	if (r > 0)
 		if (!read_intr_blocked(ch))
-			ch->notify_other_cpu();
+			ch_notify_other_cpu(ch);
 
 	spin_lock_irqsave(&smd_lock, flags);
 	ch->current_packet -= r;
@@ -1429,7 +1455,7 @@ static int smd_packet_read_from_cb(smd_channel_t *ch, void *data, int len,
 	r = ch_read(ch, data, len, user_buf);
 	if (r > 0)
 		if (!read_intr_blocked(ch))
-			ch->notify_other_cpu();
+			ch_notify_other_cpu(ch);
 
 	ch->current_packet -= r;
 	update_packet_state(ch);
@@ -1574,6 +1600,7 @@ static inline void notify_loopback_smd(void)
 
 	spin_lock_irqsave(&smd_lock, flags);
 	list_for_each_entry(ch, &smd_ch_list_loopback, ch_list) {
+		ch->stats.intr_in++;
 		ch->notify(ch->priv, SMD_EVENT_DATA);
 	}
 	spin_unlock_irqrestore(&smd_lock, flags);
@@ -1822,6 +1849,7 @@ int smd_write_start(smd_channel_t *ch, int len)
 
 	if (smd_stream_write_avail(ch) < (SMD_HEADER_SIZE)) {
 		ch->pending_pkt_sz = 0;
+		ch->stats.tx_full++;
 		SMD_DBG("%s: no space to write packet header\n", __func__);
 		return -EAGAIN;
 	}
@@ -1882,6 +1910,7 @@ int smd_write_end(smd_channel_t *ch)
 		pr_err("%s: current packet not completely written\n", __func__);
 		return -E2BIG;
 	}
+	ch->stats.tx_writes++;
 
 	return 0;
 }
@@ -1889,56 +1918,92 @@ EXPORT_SYMBOL(smd_write_end);
 
 int smd_read(smd_channel_t *ch, void *data, int len)
 {
+	int r;
+
 	if (!ch) {
 		pr_err("%s: Invalid channel specified\n", __func__);
 		return -ENODEV;
 	}
 
-	return ch->read(ch, data, len, 0);
+	r = ch->read(ch, data, len, 0);
+	if (r > 0)
+		ch->stats.rx_reads++;
+
+	return r;
 }
 EXPORT_SYMBOL(smd_read);
 
 int smd_read_user_buffer(smd_channel_t *ch, void *data, int len)
 {
+	int r;
+
 	if (!ch) {
 		pr_err("%s: Invalid channel specified\n", __func__);
 		return -ENODEV;
 	}
 
-	return ch->read(ch, data, len, 1);
+	r = ch->read(ch, data, len, 1);
+	if (r > 0)
+		ch->stats.rx_reads++;
+
+	return r;
 }
 EXPORT_SYMBOL(smd_read_user_buffer);
 
 int smd_read_from_cb(smd_channel_t *ch, void *data, int len)
 {
+	int r;
+
 	if (!ch) {
 		pr_err("%s: Invalid channel specified\n", __func__);
 		return -ENODEV;
 	}
 
-	return ch->read_from_cb(ch, data, len, 0);
+	r = ch->read_from_cb(ch, data, len, 0);
+	if (r > 0)
+		ch->stats.rx_reads++;
+
+	return r;
 }
 EXPORT_SYMBOL(smd_read_from_cb);
 
 int smd_write(smd_channel_t *ch, const void *data, int len)
 {
+	int r;
+
 	if (!ch) {
 		pr_err("%s: Invalid channel specified\n", __func__);
 		return -ENODEV;
 	}
 
-	return ch->pending_pkt_sz ? -EBUSY : ch->write(ch, data, len, 0);
+	if (ch->pending_pkt_sz)
+		return -EBUSY;
+
+	r = ch->write(ch, data, len, 0);
+	if (r > 0)
+		ch->stats.tx_writes++;
+
+	return r;
 }
 EXPORT_SYMBOL(smd_write);
 
 int smd_write_user_buffer(smd_channel_t *ch, const void *data, int len)
 {
+	int r;
+
 	if (!ch) {
 		pr_err("%s: Invalid channel specified\n", __func__);
 		return -ENODEV;
 	}
 
-	return ch->pending_pkt_sz ? -EBUSY : ch->write(ch, data, len, 1);
+	if (ch->pending_pkt_sz)
+		return -EBUSY;
+
+	r = ch->write(ch, data, len, 1);
+	if (r > 0)
+		ch->stats.tx_writes++;
+
+	return r;
 }
 EXPORT_SYMBOL(smd_write_user_buffer);
 
@@ -1978,6 +2043,26 @@ void smd_disable_read_intr(smd_channel_t *ch)
 }
 EXPORT_SYMBOL(smd_disable_read_intr);
 
+void smd_write_batch_start(smd_channel_t *ch)
+{
+	if (ch)
+		ch->tx_batch = 1;
+}
+EXPORT_SYMBOL(smd_write_batch_start);
+
+void smd_write_batch_end(smd_channel_t *ch)
+{
+	if (!ch)
+		return;
+
+	ch->tx_batch = 0;
+	if (ch->tx_batch_pending) {
+		ch->tx_batch_pending = 0;
+		ch_notify_other_cpu(ch);
+	}
+}
+EXPORT_SYMBOL(smd_write_batch_end);
+
 int smd_wait_until_readable(smd_channel_t *ch, int bytes)
 {
 	return -1;
@@ -1988,6 +2073,59 @@ int smd_wait_until_writable(smd_channel_t *ch, int bytes)
 	return -1;
 }
 
+static void smd_fill_ch_stats(struct smd_channel *ch,
+			      struct smd_ch_stats *stats)
+{
+	memcpy(stats->name, ch->name, SMD_MAX_CH_NAME_LEN);
+	stats->n = ch->n;
+	stats->type = ch->type;
+	stats->is_pkt_ch = ch->is_pkt_ch;
+	stats->c = ch->stats;
+}
+
+int smd_get_ch_stats(smd_channel_t *ch, struct smd_ch_stats *stats)
+{
+	unsigned long flags;
+
+	if (!ch || !stats)
+		return -EINVAL;
+
+	spin_lock_irqsave(&smd_lock, flags);
+	smd_fill_ch_stats(ch, stats);
+	spin_unlock_irqrestore(&smd_lock, flags);
+
+	return 0;
+}
+EXPORT_SYMBOL(smd_get_ch_stats);
+
+/* snapshot the counters of every open channel, returns the number filled */
+int smd_get_all_ch_stats(struct smd_ch_stats *stats, int max)
+{
+	struct list_head *lists[] = {
+		&smd_ch_list_modem,
+		&smd_ch_list_dsp,
+		&smd_ch_list_dsps,
+		&smd_ch_list_wcnss,
+		&smd_ch_list_loopback,
+	};
+	struct smd_channel *ch;
+	unsigned long flags;
+	int i, n = 0;
+
+	spin_lock_irqsave(&smd_lock, flags);
+	for (i = 0; i < ARRAY_SIZE(lists); i++) {
+		list_for_each_entry(ch, lists[i], ch_list) {
+			if (n >= max)
+				goto out;
+			smd_fill_ch_stats(ch, &stats[n++]);
+		}
+	}
+out:
+	spin_unlock_irqrestore(&smd_lock, flags);
+
+	return n;
+}
+
 int smd_cur_packet_size(smd_channel_t *ch)
 {
 	if (!ch) {
@@ -2038,7 +2176,7 @@ smd_tiocmset_from_cb(smd_channel_t *ch, unsigned int set, unsigned int clear)
 
 	ch->send->fSTATE = 1;
 	barrier();
-	ch->notify_other_cpu();
+	ch_notify_other_cpu(ch);
 
 	return 0;
 }
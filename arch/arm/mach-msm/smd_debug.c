@@ -530,6 +530,35 @@ static int debug_read_ch(char *buf, int max)
 }
 #endif
 
+static struct smd_ch_stats ch_stats[SMD_CHANNELS + 1];
+
+static int debug_read_ch_stats(char *buf, int max)
+{
+	struct smd_ch_stats *st;
+	int n, cnt, i = 0;
+
+	cnt = smd_get_all_ch_stats(ch_stats, ARRAY_SIZE(ch_stats));
+
+	i += scnprintf(buf + i, max - i,
+		       "ch  name             t p %10s %10s %8s %8s %8s"
+		       " %6s %8s %8s\n",
+		       "tx_bytes", "rx_bytes", "writes", "reads", "pkts",
+		       "full", "intr_in", "intr_out");
+
+	for (n = 0; n < cnt; n++) {
+		st = &ch_stats[n];
+		i += scnprintf(buf + i, max - i,
+			       "%03d %-16s %d %d %10llu %10llu %8u %8u %8u"
+			       " %6u %8u %8u\n",
+			       st->n, st->name, SMD_CHANNEL_TYPE(st->type),
+			       st->is_pkt_ch, st->c.tx_bytes, st->c.rx_bytes,
+			       st->c.tx_writes, st->c.rx_reads, st->c.rx_pkts,
+			       st->c.tx_full, st->c.intr_in, st->c.intr_out);
+	}
+
+	return i;
+}
+
 static int debug_read_smem_version(char *buf, int max)
 {
 	struct smem_shared *shared = (void *) MSM_SHARED_RAM_BASE;
@@ -686,6 +715,7 @@ static int __init smd_debugfs_init(void)
 		return PTR_ERR(dent);
 
 	debug_create("ch", 0444, dent, debug_read_ch);
+	debug_create("ch_stats", 0444, dent, debug_read_ch_stats);
 	debug_create("diag", 0444, dent, debug_read_diag_msg);
 	debug_create("mem", 0444, dent, debug_read_mem);
 	debug_create("version", 0444, dent, debug_read_smd_version);
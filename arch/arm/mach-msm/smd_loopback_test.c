@@ -0,0 +1,392 @@
+/* arch/arm/mach-msm/smd_loopback_test.c
+ *
+ * Copyright (c) 2012, Code Aurora Forum. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 and
+ * only version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ */
+
+/*
+ * SMD loopback benchmark
+ *
+ * Pushes traffic through an SMD loopback channel and reports throughput,
+ * per-packet round trip latency percentiles and the interrupt counts
+ * recorded by the SMD core.  Two edges are supported:
+ *
+ *   local - the "local_loopback" channel on SMD_LOOPBACK_TYPE.  Both
+ *           ends live in apps memory so this measures the software
+ *           path only and needs no remote processor.
+ *   modem - the "LOOPBACK" channel on SMD_APPS_MODEM, which the modem
+ *           echoes back once SMSM_SMD_LOOPBACK is set.
+ *
+ * and two modes:
+ *
+ *   packet - ping-pong, one packet in flight at a time.
+ *   stream - pipelined, the fifo is kept as full as possible.
+ *
+ * Usage:
+ *   echo "<local|modem> <stream|packet> <size> <count>" > \
+ *		/sys/kernel/debug/smd_loopback_test
+ *   cat /sys/kernel/debug/smd_loopback_test
+ */
+
+#include <linux/types.h>
+#include <linux/uaccess.h>
+#include <linux/debugfs.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/sort.h>
+#include <linux/ktime.h>
+#include <linux/wait.h>
+#include <linux/mutex.h>
+#include <mach/msm_smd.h>
+
+#include "smd_private.h"
+
+#define LB_MAX_PKT_SIZE		4096
+#define LB_MAX_SAMPLES		8192
+#define LB_TIMEOUT_MS		2000
+#define LB_RESULT_SIZE		1024
+
+enum {
+	LB_MODE_PACKET,
+	LB_MODE_STREAM,
+};
+
+struct lb_test {
+	smd_channel_t *ch;
+	wait_queue_head_t wait;
+	int modem;
+	int mode;
+	int size;
+	int count;
+
+	void *tx_buf;
+	void *rx_buf;
+	s64 *tx_stamp;		/* ns, one per packet */
+	u32 *lat;		/* us, one per completed packet */
+	int nlat;
+};
+
+static struct dentry *dent;
+static DEFINE_MUTEX(lb_lock);
+static char lb_result[LB_RESULT_SIZE];
+static int lb_result_len;
+
+static void lb_notify(void *priv, unsigned event)
+{
+	struct lb_test *t = priv;
+
+	/* the loopback edge calls us with smd_lock held, only wake here */
+	if (event == SMD_EVENT_DATA || event == SMD_EVENT_OPEN)
+		wake_up(&t->wait);
+}
+
+static s64 lb_now(void)
+{
+	return ktime_to_ns(ktime_get());
+}
+
+static int lb_cmp_u32(const void *a, const void *b)
+{
+	u32 x = *(const u32 *)a;
+	u32 y = *(const u32 *)b;
+
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static void lb_record(struct lb_test *t, int pkt)
+{
+	if (t->nlat < LB_MAX_SAMPLES && pkt < LB_MAX_SAMPLES)
+		t->lat[t->nlat++] = (u32)div_s64(lb_now() - t->tx_stamp[pkt],
+						 NSEC_PER_USEC);
+}
+
+/* drain whatever is readable, returns bytes read or -errno */
+static int lb_drain(struct lb_test *t, int want)
+{
+	int avail, r, total = 0;
+
+	while (total < want) {
+		avail = smd_read_avail(t->ch);
+		if (avail <= 0)
+			break;
+		if (avail > want - total)
+			avail = want - total;
+		if (avail > LB_MAX_PKT_SIZE)
+			avail = LB_MAX_PKT_SIZE;
+		r = smd_read(t->ch, t->rx_buf, avail);
+		if (r < 0)
+			return r;
+		if (r == 0)
+			break;
+		total += r;
+	}
+	return total;
+}
+
+static int lb_run_packet(struct lb_test *t)
+{
+	int pkt, got, r;
+
+	for (pkt = 0; pkt < t->count; pkt++) {
+		if (!wait_event_timeout(t->wait,
+				smd_write_avail(t->ch) >= t->size,
+				msecs_to_jiffies(LB_TIMEOUT_MS)))
+			return -ETIMEDOUT;
+
+		if (pkt < LB_MAX_SAMPLES)
+			t->tx_stamp[pkt] = lb_now();
+		r = smd_write(t->ch, t->tx_buf, t->size);
+		if (r != t->size)
+			return r < 0 ? r : -EIO;
+
+		got = 0;
+		while (got < t->size) {
+			if (!wait_event_timeout(t->wait,
+					smd_read_avail(t->ch) > 0,
+					msecs_to_jiffies(LB_TIMEOUT_MS)))
+				return -ETIMEDOUT;
+			r = lb_drain(t, t->size - got);
+			if (r < 0)
+				return r;
+			got += r;
+		}
+		lb_record(t, pkt);
+	}
+	return 0;
+}
+
+static int lb_run_stream(struct lb_test *t)
+{
+	long long total = (long long)t->size * t->count;
+	long long tx = 0, rx = 0;
+	int sent = 0, done = 0;
+	int r, avail;
+
+	while (rx < total) {
+		/* keep the fifo full, but only ever write whole packets */
+		while (sent < t->count) {
+			avail = smd_write_avail(t->ch);
+			if (avail < t->size)
+				break;
+			if (sent < LB_MAX_SAMPLES)
+				t->tx_stamp[sent] = lb_now();
+			r = smd_write(t->ch, t->tx_buf, t->size);
+			if (r < 0)
+				return r;
+			if (r != t->size)
+				return -EIO;
+			tx += r;
+			sent++;
+		}
+
+		r = lb_drain(t, (int)min_t(long long, tx - rx, INT_MAX));
+		if (r < 0)
+			return r;
+		rx += r;
+		while (done < sent && rx >= (long long)(done + 1) * t->size)
+			lb_record(t, done++);
+
+		if (r == 0 && !wait_event_timeout(t->wait,
+				smd_read_avail(t->ch) > 0 ||
+				(sent < t->count &&
+				 smd_write_avail(t->ch) >= t->size),
+				msecs_to_jiffies(LB_TIMEOUT_MS)))
+			return -ETIMEDOUT;
+	}
+	return 0;
+}
+
+static int lb_open(struct lb_test *t)
+{
+	int r;
+
+	if (t->modem) {
+		smsm_change_state(SMSM_APPS_STATE, 0, SMSM_SMD_LOOPBACK);
+		r = smd_named_open_on_edge("LOOPBACK", SMD_APPS_MODEM,
+					   &t->ch, t, lb_notify);
+	} else {
+		r = smd_named_open_on_edge("local_loopback", SMD_LOOPBACK_TYPE,
+					   &t->ch, t, lb_notify);
+	}
+	if (r)
+		return r;
+
+	/* the modem edge needs the remote end to come up */
+	if (!wait_event_timeout(t->wait, smd_write_avail(t->ch) > 0,
+				msecs_to_jiffies(LB_TIMEOUT_MS))) {
+		smd_close(t->ch);
+		return -ETIMEDOUT;
+	}
+	return 0;
+}
+
+static int lb_report(struct lb_test *t, int err, s64 elapsed_ns,
+		     struct smd_ch_stats *before, struct smd_ch_stats *after)
+{
+	int i = 0;
+	u64 bytes = (u64)t->size * t->count;
+	s64 elapsed_us = div_s64(elapsed_ns, NSEC_PER_USEC);
+	u64 kbps = 0;
+	u32 p50 = 0, p90 = 0, p99 = 0, pmax = 0;
+
+	if (elapsed_us > 0)
+		kbps = div64_u64(bytes * 8 * USEC_PER_MSEC, elapsed_us);
+
+	if (t->nlat) {
+		sort(t->lat, t->nlat, sizeof(u32), lb_cmp_u32, NULL);
+		p50 = t->lat[t->nlat * 50 / 100];
+		p90 = t->lat[t->nlat * 90 / 100];
+		p99 = t->lat[t->nlat * 99 / 100];
+		pmax = t->lat[t->nlat - 1];
+	}
+
+	i += scnprintf(lb_result + i, LB_RESULT_SIZE - i,
+		       "edge=%s mode=%s size=%d count=%d result=%d\n",
+		       t->modem ? "modem" : "local",
+		       t->mode == LB_MODE_STREAM ? "stream" : "packet",
+		       t->size, t->count, err);
+	i += scnprintf(lb_result + i, LB_RESULT_SIZE - i,
+		       "elapsed_us=%lld throughput_kbps=%llu\n",
+		       elapsed_us, kbps);
+	i += scnprintf(lb_result + i, LB_RESULT_SIZE - i,
+		       "latency_us samples=%d p50=%u p90=%u p99=%u max=%u\n",
+		       t->nlat, p50, p90, p99, pmax);
+	i += scnprintf(lb_result + i, LB_RESULT_SIZE - i,
+		       "intr_in=%u intr_out=%u tx_full=%u\n",
+		       after->c.intr_in - before->c.intr_in,
+		       after->c.intr_out - before->c.intr_out,
+		       after->c.tx_full - before->c.tx_full);
+	return i;
+}
+
+static int lb_run(struct lb_test *t)
+{
+	struct smd_ch_stats before, after;
+	s64 start, elapsed;
+	int r, n;
+
+	t->tx_buf = kmalloc(LB_MAX_PKT_SIZE, GFP_KERNEL);
+	t->rx_buf = kmalloc(LB_MAX_PKT_SIZE, GFP_KERNEL);
+	n = min(t->count, LB_MAX_SAMPLES);
+	t->tx_stamp = vmalloc(n * sizeof(*t->tx_stamp));
+	t->lat = vmalloc(n * sizeof(*t->lat));
+	if (!t->tx_buf || !t->rx_buf || !t->tx_stamp || !t->lat) {
+		r = -ENOMEM;
+		goto out_free;
+	}
+	memset(t->tx_buf, 0xa5, LB_MAX_PKT_SIZE);
+	init_waitqueue_head(&t->wait);
+
+	r = lb_open(t);
+	if (r)
+		goto out_free;
+
+	/* discard anything left over from a previous run */
+	while (lb_drain(t, LB_MAX_PKT_SIZE) > 0)
+		;
+
+	smd_get_ch_stats(t->ch, &before);
+	start = lb_now();
+	if (t->mode == LB_MODE_STREAM)
+		r = lb_run_stream(t);
+	else
+		r = lb_run_packet(t);
+	elapsed = lb_now() - start;
+	smd_get_ch_stats(t->ch, &after);
+
+	smd_close(t->ch);
+	lb_result_len = lb_report(t, r, elapsed, &before, &after);
+
+out_free:
+	vfree(t->lat);
+	vfree(t->tx_stamp);
+	kfree(t->rx_buf);
+	kfree(t->tx_buf);
+	return r;
+}
+
+static ssize_t debug_read(struct file *fp, char __user *buf,
+			  size_t count, loff_t *pos)
+{
+	return simple_read_from_buffer(buf, count, pos, lb_result,
+				       lb_result_len);
+}
+
+static ssize_t debug_write(struct file *fp, const char __user *buf,
+			   size_t count, loff_t *pos)
+{
+	struct lb_test t;
+	char cmd[64], edge[8], mode[8];
+	int len, r;
+
+	if (count < 1)
+		return 0;
+
+	len = count > 63 ? 63 : count;
+	if (copy_from_user(cmd, buf, len))
+		return -EFAULT;
+	cmd[len] = 0;
+
+	memset(&t, 0, sizeof(t));
+	if (sscanf(cmd, "%7s %7s %d %d", edge, mode, &t.size, &t.count) != 4)
+		return -EINVAL;
+
+	if (!strcmp(edge, "modem"))
+		t.modem = 1;
+	else if (strcmp(edge, "local"))
+		return -EINVAL;
+
+	if (!strcmp(mode, "stream"))
+		t.mode = LB_MODE_STREAM;
+	else if (!strcmp(mode, "packet"))
+		t.mode = LB_MODE_PACKET;
+	else
+		return -EINVAL;
+
+	/* a packet must fit the fifo alongside its header */
+	if (t.size < 1 || t.size > LB_MAX_PKT_SIZE || t.count < 1)
+		return -EINVAL;
+
+	mutex_lock(&lb_lock);
+	r = lb_run(&t);
+	mutex_unlock(&lb_lock);
+
+	if (r)
+		pr_err("smd loopback test failed %d\n", r);
+
+	return r ? r : count;
+}
+
+static const struct file_operations debug_ops = {
+	.owner = THIS_MODULE,
+	.read = debug_read,
+	.write = debug_write,
+};
+
+static void __exit smd_loopback_test_exit(void)
+{
+	debugfs_remove(dent);
+}
+
+static int __init smd_loopback_test_init(void)
+{
+	dent = debugfs_create_file("smd_loopback_test", 0644, 0, NULL,
+				   &debug_ops);
+	return 0;
+}
+
+module_init(smd_loopback_test_init);
+module_exit(smd_loopback_test_exit);
+
+MODULE_DESCRIPTION("SMD loopback benchmark");
+MODULE_LICENSE("GPL v2");
@@ -213,6 +213,32 @@ enum {
 
 extern spinlock_t smem_lock;
 
+/* Per-channel traffic counters.  Byte counts are fifo bytes and so
+ * include the packet headers on packet channels.
+ */
+struct smd_ch_counters {
+	uint64_t tx_bytes;
+	uint64_t rx_bytes;
+	unsigned tx_writes;	/* successful smd_write*() calls */
+	unsigned rx_reads;	/* successful smd_read*() calls */
+	unsigned rx_pkts;	/* packet headers consumed */
+	unsigned tx_full;	/* writes refused or cut short by a full fifo */
+	unsigned intr_in;	/* data events delivered to the client */
+	unsigned intr_out;	/* interrupts raised towards the remote end */
+};
+
+struct smd_ch_stats {
+	char name[20];
+	unsigned n;
+	unsigned type;
+	int is_pkt_ch;
+	struct smd_ch_counters c;
+};
+
+struct smd_channel;
+int smd_get_ch_stats(struct smd_channel *ch, struct smd_ch_stats *stats);
+int smd_get_all_ch_stats(struct smd_ch_stats *stats, int max);
+
 
 void smd_diag(void);
 
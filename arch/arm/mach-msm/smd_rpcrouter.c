@@ -18,7 +18,6 @@
 /* TODO: handle cases where smd_write() will tempfail due to full fifo */
 /* TODO: thread priority? schedule a work to bump it? */
 /* TODO: maybe make server_list_lock a mutex */
-/* TODO: pool fragments to avoid kmalloc/kfree churn */
 
 #include <linux/slab.h>
 #include <linux/module.h>
@@ -35,6 +34,7 @@
 #include <linux/sched.h>
 #include <linux/poll.h>
 #include <linux/wakelock.h>
+#include <linux/hash.h>
 #include <asm/uaccess.h>
 #include <asm/byteorder.h>
 #include <linux/platform_device.h>
@@ -140,6 +140,11 @@ static LIST_HEAD(remote_endpoints);
 
 static LIST_HEAD(server_list);
 
+/* hashed views of the lists above, protected by the same locks */
+static struct hlist_head local_endpoints_hash[1 << RPCROUTER_EPT_HASH_BITS];
+static struct hlist_head remote_endpoints_hash[1 << RPCROUTER_EPT_HASH_BITS];
+static struct hlist_head server_hash[1 << RPCROUTER_SERVER_HASH_BITS];
+
 static wait_queue_head_t newserver_wait;
 static wait_queue_head_t subsystem_restart_wait;
 
@@ -158,6 +163,7 @@ static atomic_t pm_mid = ATOMIC_INIT(1);
 static void do_read_data(struct work_struct *work);
 static void do_create_pdevs(struct work_struct *work);
 static void do_create_rpcrouter_pdev(struct work_struct *work);
+static void rr_pkt_free(struct rr_packet *pkt);
 
 static DECLARE_WORK(work_create_pdevs, do_create_pdevs);
 static DECLARE_WORK(work_create_rpcrouter_pdev, do_create_rpcrouter_pdev);
@@ -179,6 +185,22 @@ struct rr_context {
 
 struct rr_context the_rr_context;
 
+/* recycled receive buffers, refilled as fragments and packets are freed */
+struct rr_rx_pool {
+	spinlock_t lock;
+	struct rr_fragment *frags;
+	struct list_head pkts;
+	int nr_frags;
+	int nr_pkts;
+	unsigned hits;
+	unsigned misses;
+};
+
+static struct rr_rx_pool rx_pool = {
+	.lock = __SPIN_LOCK_UNLOCKED(rx_pool.lock),
+	.pkts = LIST_HEAD_INIT(rx_pool.pkts),
+};
+
 struct rpc_board_dev_info {
 	struct list_head list;
 
@@ -213,6 +235,28 @@ static DEFINE_MUTEX(xprt_info_list_lock);
 DECLARE_COMPLETION(rpc_remote_router_up);
 static atomic_t pending_close_count = ATOMIC_INIT(0);
 
+static inline struct hlist_head *server_bucket(uint32_t prog)
+{
+	return &server_hash[hash_32(prog, RPCROUTER_SERVER_HASH_BITS)];
+}
+
+static inline struct hlist_head *local_ept_bucket(uint32_t cid)
+{
+	return &local_endpoints_hash[hash_32(cid, RPCROUTER_EPT_HASH_BITS)];
+}
+
+static inline struct hlist_head *remote_ept_bucket(uint32_t pid, uint32_t cid)
+{
+	return &remote_endpoints_hash[hash_32(cid ^ (pid << 24),
+					      RPCROUTER_EPT_HASH_BITS)];
+}
+
+static inline struct hlist_head *reply_bucket(struct msm_rpc_endpoint *ept,
+					      uint32_t xid)
+{
+	return &ept->reply_hash[hash_32(xid, RPCROUTER_REPLY_HASH_BITS)];
+}
+
 /*
  * Search for transport (xprt) that matches the provided PID.
  *
@@ -282,7 +326,6 @@ static void modem_reset_cleanup(struct rpcrouter_xprt_info *xprt_info)
 	struct msm_rpc_endpoint *ept;
 	struct rr_remote_endpoint *r_ept;
 	struct rr_packet *pkt, *tmp_pkt;
-	struct rr_fragment *frag, *next;
 	struct msm_rpc_reply *reply, *reply_tmp;
 	unsigned long flags;
 
@@ -305,6 +348,7 @@ static void modem_reset_cleanup(struct rpcrouter_xprt_info *xprt_info)
 		list_for_each_entry_safe(reply, reply_tmp,
 					 &ept->reply_pend_q, list) {
 			list_del(&reply->list);
+			hlist_del(&reply->hnode);
 			kfree(reply);
 		}
 		list_for_each_entry_safe(reply, reply_tmp,
@@ -329,13 +373,8 @@ static void modem_reset_cleanup(struct rpcrouter_xprt_info *xprt_info)
 		list_for_each_entry_safe(pkt, tmp_pkt,
 					 &ept->incomplete, list) {
 			list_del(&pkt->list);
-			frag = pkt->first;
-			while (frag != NULL) {
-				next = frag->next;
-				kfree(frag);
-				frag = next;
-			}
-			kfree(pkt);
+			rr_free_frags(pkt->first);
+			rr_pkt_free(pkt);
 		}
 		spin_unlock(&ept->incomplete_lock);
 
@@ -344,13 +383,8 @@ static void modem_reset_cleanup(struct rpcrouter_xprt_info *xprt_info)
 		list_for_each_entry_safe(pkt, tmp_pkt, &ept->read_q,
 					 list) {
 			list_del(&pkt->list);
-			frag = pkt->first;
-			while (frag != NULL) {
-				next = frag->next;
-				kfree(frag);
-				frag = next;
-			}
-			kfree(pkt);
+			rr_free_frags(pkt->first);
+			rr_pkt_free(pkt);
 		}
 		spin_unlock(&ept->read_q_lock);
 
@@ -460,6 +494,7 @@ static struct rr_server *rpcrouter_create_server(uint32_t pid,
 
 	spin_lock_irqsave(&server_list_lock, flags);
 	list_add_tail(&server->list, &server_list);
+	hlist_add_head(&server->hnode, server_bucket(prog));
 	spin_unlock_irqrestore(&server_list_lock, flags);
 
 	rc = msm_rpcrouter_create_server_cdev(server);
@@ -470,6 +505,7 @@ static struct rr_server *rpcrouter_create_server(uint32_t pid,
 out_fail:
 	spin_lock_irqsave(&server_list_lock, flags);
 	list_del(&server->list);
+	hlist_del(&server->hnode);
 	spin_unlock_irqrestore(&server_list_lock, flags);
 	kfree(server);
 	return ERR_PTR(rc);
@@ -481,6 +517,7 @@ static void rpcrouter_destroy_server(struct rr_server *server)
 
 	spin_lock_irqsave(&server_list_lock, flags);
 	list_del(&server->list);
+	hlist_del(&server->hnode);
 	spin_unlock_irqrestore(&server_list_lock, flags);
 	device_destroy(msm_rpcrouter_class, server->device_number);
 	kfree(server);
@@ -535,10 +572,11 @@ static void rpcrouter_register_board_dev(struct rr_server *server)
 static struct rr_server *rpcrouter_lookup_server(uint32_t prog, uint32_t ver)
 {
 	struct rr_server *server;
+	struct hlist_node *n;
 	unsigned long flags;
 
 	spin_lock_irqsave(&server_list_lock, flags);
-	list_for_each_entry(server, &server_list, list) {
+	hlist_for_each_entry(server, n, server_bucket(prog), hnode) {
 		if (server->prog == prog
 		 && server->vers == ver) {
 			spin_unlock_irqrestore(&server_list_lock, flags);
@@ -614,6 +652,7 @@ struct msm_rpc_endpoint *msm_rpcrouter_create_local_endpoint(dev_t dev)
 
 	spin_lock_irqsave(&local_endpoints_lock, flags);
 	list_add_tail(&ept->list, &local_endpoints);
+	hlist_add_head(&ept->hnode, local_ept_bucket(ept->cid));
 	spin_unlock_irqrestore(&local_endpoints_lock, flags);
 	return ept;
 }
@@ -631,6 +670,7 @@ int msm_rpcrouter_destroy_local_endpoint(struct msm_rpc_endpoint *ept)
 	** destroying it.*/
 	spin_lock_irqsave(&local_endpoints_lock, flags);
 	list_del(&ept->list);
+	hlist_del(&ept->hnode);
 	spin_unlock_irqrestore(&local_endpoints_lock, flags);
 	if (ept->dst_pid != 0xffffffff) {
 		msg.cmd = RPCROUTER_CTRL_CMD_REMOVE_CLIENT;
@@ -653,6 +693,7 @@ int msm_rpcrouter_destroy_local_endpoint(struct msm_rpc_endpoint *ept)
 	spin_lock_irqsave(&ept->reply_q_lock, flags);
 	list_for_each_entry_safe(reply, reply_tmp, &ept->reply_pend_q, list) {
 		list_del(&reply->list);
+		hlist_del(&reply->hnode);
 		kfree(reply);
 	}
 	list_for_each_entry_safe(reply, reply_tmp, &ept->reply_avail_q, list) {
@@ -684,16 +725,19 @@ static int rpcrouter_create_remote_endpoint(uint32_t pid, uint32_t cid)
 
 	spin_lock_irqsave(&remote_endpoints_lock, flags);
 	list_add_tail(&new_c->list, &remote_endpoints);
+	hlist_add_head(&new_c->hnode, remote_ept_bucket(pid, cid));
 	new_c->quota_restart_state = RESTART_NORMAL;
 	spin_unlock_irqrestore(&remote_endpoints_lock, flags);
 	return 0;
 }
 
+/* caller must hold local_endpoints_lock */
 static struct msm_rpc_endpoint *rpcrouter_lookup_local_endpoint(uint32_t cid)
 {
 	struct msm_rpc_endpoint *ept;
+	struct hlist_node *n;
 
-	list_for_each_entry(ept, &local_endpoints, list) {
+	hlist_for_each_entry(ept, n, local_ept_bucket(cid), hnode) {
 		if (ept->cid == cid)
 			return ept;
 	}
@@ -704,10 +748,11 @@ static struct rr_remote_endpoint *rpcrouter_lookup_remote_endpoint(uint32_t pid,
 								   uint32_t cid)
 {
 	struct rr_remote_endpoint *ept;
+	struct hlist_node *n;
 	unsigned long flags;
 
 	spin_lock_irqsave(&remote_endpoints_lock, flags);
-	list_for_each_entry(ept, &remote_endpoints, list) {
+	hlist_for_each_entry(ept, n, remote_ept_bucket(pid, cid), hnode) {
 		if ((ept->pid == pid) && (ept->cid == cid)) {
 			spin_unlock_irqrestore(&remote_endpoints_lock, flags);
 			return ept;
@@ -894,6 +939,7 @@ static int process_control_msg(struct rpcrouter_xprt_info *xprt_info,
 		if (r_ept) {
 			spin_lock_irqsave(&remote_endpoints_lock, flags);
 			list_del(&r_ept->list);
+			hlist_del(&r_ept->hnode);
 			spin_unlock_irqrestore(&remote_endpoints_lock, flags);
 			kfree(r_ept);
 		}
@@ -959,6 +1005,98 @@ static void *rr_malloc(unsigned sz)
 	return ptr;
 }
 
+static struct rr_fragment *rr_frag_alloc(void)
+{
+	struct rr_fragment *frag;
+	unsigned long flags;
+
+	spin_lock_irqsave(&rx_pool.lock, flags);
+	frag = rx_pool.frags;
+	if (frag) {
+		rx_pool.frags = frag->next;
+		rx_pool.nr_frags--;
+		rx_pool.hits++;
+	} else {
+		rx_pool.misses++;
+	}
+	spin_unlock_irqrestore(&rx_pool.lock, flags);
+
+	if (!frag)
+		frag = rr_malloc(sizeof(*frag));
+	frag->next = NULL;
+	return frag;
+}
+
+/* free a fragment chain, returning buffers to the pool while it has room */
+void rr_free_frags(struct rr_fragment *frag)
+{
+	struct rr_fragment *next;
+	unsigned long flags;
+
+	while (frag != NULL) {
+		next = frag->next;
+		spin_lock_irqsave(&rx_pool.lock, flags);
+		if (rx_pool.nr_frags < RPCROUTER_RX_POOL_SIZE) {
+			frag->next = rx_pool.frags;
+			rx_pool.frags = frag;
+			rx_pool.nr_frags++;
+			frag = NULL;
+		}
+		spin_unlock_irqrestore(&rx_pool.lock, flags);
+		kfree(frag);
+		frag = next;
+	}
+}
+
+static struct rr_packet *rr_pkt_alloc(void)
+{
+	struct rr_packet *pkt = NULL;
+	unsigned long flags;
+
+	spin_lock_irqsave(&rx_pool.lock, flags);
+	if (!list_empty(&rx_pool.pkts)) {
+		pkt = list_first_entry(&rx_pool.pkts, struct rr_packet, list);
+		list_del(&pkt->list);
+		rx_pool.nr_pkts--;
+	}
+	spin_unlock_irqrestore(&rx_pool.lock, flags);
+
+	if (!pkt)
+		pkt = rr_malloc(sizeof(*pkt));
+	return pkt;
+}
+
+static void rr_pkt_free(struct rr_packet *pkt)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&rx_pool.lock, flags);
+	if (rx_pool.nr_pkts < RPCROUTER_RX_POOL_SIZE) {
+		list_add(&pkt->list, &rx_pool.pkts);
+		rx_pool.nr_pkts++;
+		pkt = NULL;
+	}
+	spin_unlock_irqrestore(&rx_pool.lock, flags);
+	kfree(pkt);
+}
+
+static void rr_rx_pool_init(void)
+{
+	int i;
+
+	for (i = 0; i < RPCROUTER_RX_POOL_SIZE; i++) {
+		struct rr_fragment *frag = kmalloc(sizeof(*frag), GFP_KERNEL);
+		struct rr_packet *pkt = kmalloc(sizeof(*pkt), GFP_KERNEL);
+
+		if (frag) {
+			frag->next = NULL;
+			rr_free_frags(frag);
+		}
+		if (pkt)
+			rr_pkt_free(pkt);
+	}
+}
+
 static int rr_read(struct rpcrouter_xprt_info *xprt_info,
 		   void *data, uint32_t len)
 {
@@ -1074,11 +1212,10 @@ static void do_read_data(struct work_struct *work)
 
 	hdr.size -= sizeof(pm);
 
-	frag = rr_malloc(sizeof(*frag));
-	frag->next = NULL;
+	frag = rr_frag_alloc();
 	frag->length = hdr.size;
 	if (rr_read(xprt_info, frag->data, hdr.size)) {
-		kfree(frag);
+		rr_free_frags(frag);
 		goto fail_io;
 	}
 
@@ -1122,7 +1259,7 @@ static void do_read_data(struct work_struct *work)
 	if (!ept) {
 		spin_unlock_irqrestore(&local_endpoints_lock, flags);
 		DIAG("no local ept for cid %08x\n", hdr.dst_cid);
-		kfree(frag);
+		rr_free_frags(frag);
 		goto done;
 	}
 
@@ -1152,7 +1289,7 @@ static void do_read_data(struct work_struct *work)
 	 * the incomplete list if this fragment is not a last fragment,
 	 * otherwise put it on the read queue.
 	 */
-	pkt = rr_malloc(sizeof(struct rr_packet));
+	pkt = rr_pkt_alloc();
 	pkt->first = frag;
 	pkt->last = frag;
 	memcpy(&pkt->hdr, &hdr, sizeof(hdr));
@@ -1164,8 +1301,8 @@ static void do_read_data(struct work_struct *work)
 	if (!ept) {
 		spin_unlock_irqrestore(&local_endpoints_lock, flags);
 		DIAG("no local ept for cid %08x\n", hdr.dst_cid);
-		kfree(frag);
-		kfree(pkt);
+		rr_free_frags(frag);
+		rr_pkt_free(pkt);
 		goto done;
 	}
 	if (!PACMARK_LAST(pm)) {
@@ -1180,6 +1317,9 @@ packet_complete:
 	spin_lock(&ept->read_q_lock);
 	D("%s: take read lock on ept %p\n", __func__, ept);
 	wake_lock(&ept->read_q_wake_lock);
+	pkt->queued = ktime_get();
+	ept->stats.rx_pkts++;
+	ept->stats.rx_bytes += pkt->length;
 	list_add_tail(&pkt->list, &ept->read_q);
 	wake_up(&ept->wait_q);
 	spin_unlock(&ept->read_q_lock);
@@ -1446,10 +1586,12 @@ static struct msm_rpc_reply *get_pend_reply(struct msm_rpc_endpoint *ept,
 {
 	unsigned long flags;
 	struct msm_rpc_reply *reply;
+	struct hlist_node *n;
 	spin_lock_irqsave(&ept->reply_q_lock, flags);
-	list_for_each_entry(reply, &ept->reply_pend_q, list) {
+	hlist_for_each_entry(reply, n, reply_bucket(ept, xid), hnode) {
 		if (reply->xid == xid) {
 			list_del(&reply->list);
+			hlist_del(&reply->hnode);
 			spin_unlock_irqrestore(&ept->reply_q_lock, flags);
 			return reply;
 		}
@@ -1463,12 +1605,13 @@ void get_requesting_client(struct msm_rpc_endpoint *ept, uint32_t xid,
 {
 	unsigned long flags;
 	struct msm_rpc_reply *reply;
+	struct hlist_node *n;
 
 	if (!clnt_info)
 		return;
 
 	spin_lock_irqsave(&ept->reply_q_lock, flags);
-	list_for_each_entry(reply, &ept->reply_pend_q, list) {
+	hlist_for_each_entry(reply, n, reply_bucket(ept, xid), hnode) {
 		if (reply->xid == xid) {
 			clnt_info->pid = reply->pid;
 			clnt_info->cid = reply->cid;
@@ -1529,6 +1672,7 @@ static void set_pend_reply(struct msm_rpc_endpoint *ept,
 		D("%s: take reply lock on ept %p\n", __func__, ept);
 		wake_lock(&ept->reply_q_wake_lock);
 		list_add_tail(&reply->list, &ept->reply_pend_q);
+		hlist_add_head(&reply->hnode, reply_bucket(ept, reply->xid));
 		spin_unlock_irqrestore(&ept->reply_q_lock, flags);
 }
 
@@ -1643,6 +1787,11 @@ int msm_rpc_write(struct msm_rpc_endpoint *ept, void *buffer, int count)
 	}
 
  write_release_lock:
+	if (count > 0) {
+		ept->stats.tx_pkts++;
+		ept->stats.tx_bytes += count;
+	}
+
 	/* if reply, release wakelock after writing to the transport */
 	if (rq->type != 0) {
 		/* Upon failure, add reply tag to the pending list.
@@ -1670,7 +1819,7 @@ EXPORT_SYMBOL(msm_rpc_write);
 int msm_rpc_read(struct msm_rpc_endpoint *ept, void **buffer,
 		 unsigned user_len, long timeout)
 {
-	struct rr_fragment *frag, *next;
+	struct rr_fragment *frag, *head;
 	char *buf;
 	int rc;
 
@@ -1692,13 +1841,11 @@ int msm_rpc_read(struct msm_rpc_endpoint *ept, void **buffer,
 	buf = rr_malloc(rc);
 	*buffer = buf;
 
-	while (frag != NULL) {
+	for (head = frag; frag != NULL; frag = frag->next) {
 		memcpy(buf, frag->data, frag->length);
-		next = frag->next;
 		buf += frag->length;
-		kfree(frag);
-		frag = next;
 	}
+	rr_free_frags(head);
 
 	return rc;
 }
@@ -1804,6 +1951,7 @@ int __msm_rpc_read(struct msm_rpc_endpoint *ept,
 	struct rpc_request_hdr *rq;
 	struct msm_rpc_reply *reply;
 	unsigned long flags;
+	uint32_t delay_us;
 	int rc;
 
 	rc = wait_for_restart_and_notify(ept);
@@ -1870,6 +2018,10 @@ int __msm_rpc_read(struct msm_rpc_endpoint *ept,
 		return -ETOOSMALL;
 	}
 	list_del(&pkt->list);
+	delay_us = ktime_to_us(ktime_sub(ktime_get(), pkt->queued));
+	ept->stats.rx_delay_total_us += delay_us;
+	if (delay_us > ept->stats.rx_delay_max_us)
+		ept->stats.rx_delay_max_us = delay_us;
 	spin_unlock_irqrestore(&ept->read_q_lock, flags);
 
 	rc = pkt->length;
@@ -1880,6 +2032,8 @@ int __msm_rpc_read(struct msm_rpc_endpoint *ept,
 		/* RPC CALL */
 		reply = get_avail_reply(ept);
 		if (!reply) {
+			rr_free_frags(pkt->first);
+			rr_pkt_free(pkt);
 			rc = -ENOMEM;
 			goto read_release_lock;
 		}
@@ -1891,7 +2045,7 @@ int __msm_rpc_read(struct msm_rpc_endpoint *ept,
 		set_pend_reply(ept, reply);
 	}
 
-	kfree(pkt);
+	rr_pkt_free(pkt);
 
 	IO("READ on ept %p (%d bytes)\n", ept, rc);
 
@@ -2231,6 +2385,14 @@ static int dump_msm_rpc_endpoint(char *buf, int max)
 			       ept->reply_cnt);
 		i += scnprintf(buf + i, max - i, "restart_state: %i\n",
 			       ept->restart_state);
+		i += scnprintf(buf + i, max - i,
+			       "rx: %u pkts %llu bytes, tx: %u pkts %llu bytes\n",
+			       ept->stats.rx_pkts, ept->stats.rx_bytes,
+			       ept->stats.tx_pkts, ept->stats.tx_bytes);
+		i += scnprintf(buf + i, max - i,
+			       "read_q delay: total %llu us, max %u us\n",
+			       ept->stats.rx_delay_total_us,
+			       ept->stats.rx_delay_max_us);
 
 		i += scnprintf(buf + i, max - i, "outstanding xids:\n");
 		spin_lock(&ept->reply_q_lock);
@@ -2255,6 +2417,23 @@ static int dump_msm_rpc_endpoint(char *buf, int max)
 	return i;
 }
 
+static int dump_rx_pool(char *buf, int max)
+{
+	int i = 0;
+	unsigned long flags;
+
+	spin_lock_irqsave(&rx_pool.lock, flags);
+	i += scnprintf(buf + i, max - i, "free frags: %d\n",
+		       rx_pool.nr_frags);
+	i += scnprintf(buf + i, max - i, "free pkts: %d\n", rx_pool.nr_pkts);
+	i += scnprintf(buf + i, max - i, "frag hits: %u\n", rx_pool.hits);
+	i += scnprintf(buf + i, max - i, "frag misses: %u\n",
+		       rx_pool.misses);
+	spin_unlock_irqrestore(&rx_pool.lock, flags);
+
+	return i;
+}
+
 #define DEBUG_BUFMAX 4096
 static char debug_buffer[DEBUG_BUFMAX];
 
@@ -2298,6 +2477,8 @@ static void debugfs_init(void)
 		     dump_remote_endpoints);
 	debug_create("dump_servers", 0444, dent,
 		     dump_servers);
+	debug_create("dump_rx_pool", 0444, dent,
+		     dump_rx_pool);
 
 }
 
@@ -2505,6 +2686,7 @@ static int __init rpcrouter_init(void)
 	msm_rpc_connect_timeout_ms = 0;
 	smd_rpcrouter_debug_mask |= SMEM_LOG;
 	debugfs_init();
+	rr_rx_pool_init();
 
 
 	/* Initialize what we need to start processing */
@@ -20,6 +20,7 @@
 
 #include <linux/types.h>
 #include <linux/list.h>
+#include <linux/ktime.h>
 #include <linux/cdev.h>
 #include <linux/platform_device.h>
 #include <linux/msm_rpcrouter.h>
@@ -103,6 +104,16 @@ struct rr_header {
 
 #define RPCROUTER_MAX_REMOTE_SERVERS		100
 
+/* lookup tables: servers by prog, local endpoints by cid,
+ * remote endpoints by (pid, cid), pending replies by xid
+ */
+#define RPCROUTER_SERVER_HASH_BITS		5
+#define RPCROUTER_EPT_HASH_BITS			5
+#define RPCROUTER_REPLY_HASH_BITS		3
+
+/* fragments and packets kept for reuse by the receive path */
+#define RPCROUTER_RX_POOL_SIZE			16
+
 struct rr_fragment {
 	unsigned char data[RPCROUTER_MSGSIZE_MAX];
 	uint32_t length;
@@ -116,6 +127,7 @@ struct rr_packet {
 	struct rr_header hdr;
 	uint32_t mid;
 	uint32_t length;
+	ktime_t queued;
 };
 
 #define PACMARK_LAST(n) ((n) & 0x80000000)
@@ -133,6 +145,7 @@ static inline uint32_t PACMARK(uint32_t len, uint32_t mid, uint32_t first,
 
 struct rr_server {
 	struct list_head list;
+	struct hlist_node hnode;
 
 	uint32_t pid;
 	uint32_t cid;
@@ -156,10 +169,12 @@ struct rr_remote_endpoint {
 	wait_queue_head_t quota_wait;
 
 	struct list_head list;
+	struct hlist_node hnode;
 };
 
 struct msm_rpc_reply {
 	struct list_head list;
+	struct hlist_node hnode;
 	uint32_t pid;
 	uint32_t cid;
 	uint32_t prog; /* be32 */
@@ -167,8 +182,20 @@ struct msm_rpc_reply {
 	uint32_t xid; /* be32 */
 };
 
+struct rr_ept_stats {
+	uint32_t rx_pkts;
+	uint64_t rx_bytes;
+	uint32_t tx_pkts;
+	uint64_t tx_bytes;
+
+	/* time complete packets spent on read_q */
+	uint64_t rx_delay_total_us;
+	uint32_t rx_delay_max_us;
+};
+
 struct msm_rpc_endpoint {
 	struct list_head list;
+	struct hlist_node hnode;
 
 	/* incomplete packets waiting for assembly */
 	struct list_head incomplete;
@@ -209,10 +236,13 @@ struct msm_rpc_endpoint {
 	/* reply queue for inbound messages */
 	struct list_head reply_pend_q;
 	struct list_head reply_avail_q;
+	struct hlist_head reply_hash[1 << RPCROUTER_REPLY_HASH_BITS];
 	spinlock_t reply_q_lock;
 	uint32_t reply_cnt;
 	struct wake_lock reply_q_wake_lock;
 
+	struct rr_ept_stats stats;
+
 	/* device node if this endpoint is accessed via userspace */
 	dev_t dev;
 };
@@ -239,6 +269,7 @@ void msm_rpcrouter_xprt_notify(struct rpcrouter_xprt *xprt, unsigned event);
 int __msm_rpc_read(struct msm_rpc_endpoint *ept,
 		   struct rr_fragment **frag,
 		   unsigned len, long timeout);
+void rr_free_frags(struct rr_fragment *frag);
 
 int msm_rpcrouter_close(void);
 struct msm_rpc_endpoint *msm_rpcrouter_create_local_endpoint(dev_t dev);
@@ -156,28 +156,27 @@ static ssize_t rpcrouter_read(struct file *filp, char __user *buf,
 {
 	struct rpcrouter_file_info *file_info = filp->private_data;
 	struct msm_rpc_endpoint *ept;
-	struct rr_fragment *frag, *next;
+	struct rr_fragment *frag, *head;
 	int rc;
 
 	ept = (struct msm_rpc_endpoint *) file_info->ept;
 
-	rc = __msm_rpc_read(ept, &frag, count, -1);
+	rc = __msm_rpc_read(ept, &head, count, -1);
 	if (rc < 0)
 		return rc;
 
 	count = rc;
 
-	while (frag != NULL) {		
+	/* copy each fragment straight out, no need to linearize */
+	for (frag = head; frag != NULL; frag = frag->next) {
 		if (copy_to_user(buf, frag->data, frag->length)) {
 			printk(KERN_ERR
 			       "rpcrouter: could not copy all read data to user!\n");
 			rc = -EFAULT;
 		}
 		buf += frag->length;
-		next = frag->next;
-		kfree(frag);
-		frag = next;
 	}
+	rr_free_frags(head);
 
 	return rc;
 }
@@ -87,20 +87,20 @@ static int kgsl_add_event(struct kgsl_device *device, u32 ts,
 	event->func = cb;
 	event->owner = owner;
 
-	/* Add the event in order to the list */
+	/*
+	 * Add the event in order to the list.  New events are almost always
+	 * for the most recently issued timestamp, so search from the tail.
+	 */
 
-	for (n = device->events.next ; n != &device->events; n = n->next) {
+	for (n = device->events.prev; n != &device->events; n = n->prev) {
 		struct kgsl_event *e =
 			list_entry(n, struct kgsl_event, list);
 
-		if (timestamp_cmp(e->timestamp, ts) > 0) {
-			list_add(&event->list, n->prev);
+		if (timestamp_cmp(e->timestamp, ts) <= 0)
 			break;
-		}
 	}
 
-	if (n == &device->events)
-		list_add_tail(&event->list, &device->events);
+	list_add(&event->list, n);
 
 	queue_work(device->work_queue, &device->ts_expired_ws);
 	return 0;
@@ -220,6 +220,21 @@ void kgsl_mem_entry_attach_process(struct kgsl_mem_entry *entry,
 	entry->priv = process;
 }
 
+/* call with entry->priv->mem_lock locked */
+static void kgsl_mem_entry_detach_process(struct kgsl_mem_entry *entry)
+{
+	struct kgsl_process_private *private = entry->priv;
+	int i, j;
+
+	for (i = 0, j = 0; i < KGSL_LOOKUP_CACHE_SIZE; i++)
+		if (private->lookup[i] != entry)
+			private->lookup[j++] = private->lookup[i];
+	while (j < KGSL_LOOKUP_CACHE_SIZE)
+		private->lookup[j++] = NULL;
+
+	rb_erase(&entry->node, &private->mem_rb);
+}
+
 /* Allocate a new context id */
 
 static struct kgsl_context *
@@ -572,6 +587,12 @@ kgsl_get_process_private(struct kgsl_device_private *cur_dev_priv)
 	private->refcnt = 1;
 	private->pid = task_tgid_nr(current);
 	private->mem_rb = RB_ROOT;
+	private->pool = kgsl_page_pool_create();
+	if (private->pool == NULL) {
+		kfree(private);
+		private = NULL;
+		goto out;
+	}
 
 	if (kgsl_mmu_enabled())
 	{
@@ -580,6 +601,7 @@ kgsl_get_process_private(struct kgsl_device_private *cur_dev_priv)
 		pt_name = task_tgid_nr(current);
 		private->pagetable = kgsl_mmu_getpagetable(pt_name);
 		if (private->pagetable == NULL) {
+			kgsl_page_pool_close(private->pool);
 			kfree(private);
 			private = NULL;
 			goto out;
@@ -618,9 +640,10 @@ kgsl_put_process_private(struct kgsl_device *device,
 		entry = rb_entry(node, struct kgsl_mem_entry, node);
 		node = rb_next(&entry->node);
 
-		rb_erase(&entry->node, &private->mem_rb);
+		kgsl_mem_entry_detach_process(entry);
 		kgsl_mem_entry_put(entry);
 	}
+	kgsl_page_pool_close(private->pool);
 	kgsl_mmu_putpagetable(private->pagetable);
 	kfree(private);
 unlock:
@@ -752,18 +775,42 @@ kgsl_sharedmem_find_region(struct kgsl_process_private *private,
 	unsigned int gpuaddr, size_t size)
 {
 	struct rb_node *node = private->mem_rb.rb_node;
+	struct kgsl_mem_entry *entry;
+	int i;
 
 	if (!kgsl_mmu_gpuaddr_in_range(gpuaddr))
 		return NULL;
 
-	while (node != NULL) {
-		struct kgsl_mem_entry *entry;
+	/*
+	 * IB validation and frees tend to hit the same few buffers over and
+	 * over, so try the recently used entries before walking the tree.
+	 */
+	for (i = 0; i < KGSL_LOOKUP_CACHE_SIZE; i++) {
+		entry = private->lookup[i];
+		if (entry == NULL)
+			break;
 
-		entry = rb_entry(node, struct kgsl_mem_entry, node);
+		if (kgsl_gpuaddr_in_memdesc(&entry->memdesc, gpuaddr, size)) {
+			for (; i > 0; i--)
+				private->lookup[i] = private->lookup[i - 1];
+			private->lookup[0] = entry;
+			kgsl_driver.stats.lookup_hits++;
+			return entry;
+		}
+	}
 
+	kgsl_driver.stats.lookup_misses++;
 
-		if (kgsl_gpuaddr_in_memdesc(&entry->memdesc, gpuaddr, size))
+	while (node != NULL) {
+		entry = rb_entry(node, struct kgsl_mem_entry, node);
+
+		if (kgsl_gpuaddr_in_memdesc(&entry->memdesc, gpuaddr, size)) {
+			memmove(&private->lookup[1], &private->lookup[0],
+				(KGSL_LOOKUP_CACHE_SIZE - 1) *
+				sizeof(private->lookup[0]));
+			private->lookup[0] = entry;
 			return entry;
+		}
 
 		if (gpuaddr < entry->memdesc.gpuaddr)
 			node = node->rb_left;
@@ -885,6 +932,54 @@ static long kgsl_ioctl_device_waittimestamp(struct kgsl_device_private
 	return result;
 }
 
+static long kgsl_ioctl_device_waittimestamp_any(struct kgsl_device_private
+						*dev_priv, unsigned int cmd,
+						void *data)
+{
+	struct kgsl_device_waittimestamp_any *param = data;
+	struct kgsl_device *device = dev_priv->device;
+	unsigned int ts[KGSL_WAITTIMESTAMP_ANY_MAX];
+	unsigned int first, cur;
+	int i, result;
+
+	if (param->count == 0 || param->count > KGSL_WAITTIMESTAMP_ANY_MAX)
+		return -EINVAL;
+
+	if (copy_from_user(ts, (void __user *) param->timestamps,
+			   param->count * sizeof(ts[0])))
+		return -EFAULT;
+
+	/*
+	 * Timestamps on a device retire in the order they were issued, so
+	 * the first of the list to expire is always the oldest one.  A
+	 * single wait on it covers the whole batch.
+	 */
+	first = ts[0];
+	for (i = 1; i < param->count; i++)
+		if (timestamp_cmp(ts[i], first) < 0)
+			first = ts[i];
+
+	device->active_cnt++;
+
+	result = device->ftbl->waittimestamp(device, first, param->timeout);
+
+	INIT_COMPLETION(device->suspend_gate);
+	device->active_cnt--;
+	complete(&device->suspend_gate);
+
+	if (result)
+		return result;
+
+	cur = device->ftbl->readtimestamp(device, KGSL_TIMESTAMP_RETIRED);
+
+	param->retired = 0;
+	for (i = 0; i < param->count; i++)
+		if (timestamp_cmp(cur, ts[i]) >= 0)
+			param->retired |= 1U << i;
+
+	return result;
+}
+
 static long kgsl_ioctl_rb_issueibcmds(struct kgsl_device_private *dev_priv,
 				      unsigned int cmd, void *data)
 {
@@ -993,7 +1088,7 @@ static void kgsl_freemem_event_cb(struct kgsl_device *device,
 {
 	struct kgsl_mem_entry *entry = priv;
 	spin_lock(&entry->priv->mem_lock);
-	rb_erase(&entry->node, &entry->priv->mem_rb);
+	kgsl_mem_entry_detach_process(entry);
 	spin_unlock(&entry->priv->mem_lock);
 	kgsl_mem_entry_put(entry);
 }
@@ -1085,7 +1180,7 @@ static long kgsl_ioctl_sharedmem_free(struct kgsl_device_private *dev_priv,
 	spin_lock(&private->mem_lock);
 	entry = kgsl_sharedmem_find(private, param->gpuaddr);
 	if (entry)
-		rb_erase(&entry->node, &private->mem_rb);
+		kgsl_mem_entry_detach_process(entry);
 
 	spin_unlock(&private->mem_lock);
 
@@ -1170,6 +1265,7 @@ kgsl_ioctl_sharedmem_from_vmalloc(struct kgsl_device_private *dev_priv,
 		goto error;
 	}
 
+	entry->memdesc.pool = private->pool;
 	result = kgsl_sharedmem_page_alloc_user(&entry->memdesc,
 					     private->pagetable, len,
 					     param->flags);
@@ -1689,6 +1785,7 @@ kgsl_ioctl_gpumem_alloc(struct kgsl_device_private *dev_priv,
 	if (entry == NULL)
 		return -ENOMEM;
 
+	entry->memdesc.pool = private->pool;
 	result = kgsl_allocate_user(&entry->memdesc, private->pagetable,
 		param->size, param->flags);
 
@@ -1891,6 +1988,8 @@ static const struct {
 			kgsl_ioctl_cff_user_event, 0),
 	KGSL_IOCTL_FUNC(IOCTL_KGSL_TIMESTAMP_EVENT,
 			kgsl_ioctl_timestamp_event, 1),
+	KGSL_IOCTL_FUNC(IOCTL_KGSL_DEVICE_WAITTIMESTAMP_ANY,
+			kgsl_ioctl_device_waittimestamp_any, 1),
 };
 
 static long kgsl_ioctl(struct file *filep, unsigned int cmd, unsigned long arg)
@@ -2106,6 +2205,7 @@ struct kgsl_driver kgsl_driver  = {
 	.process_mutex = __MUTEX_INITIALIZER(kgsl_driver.process_mutex),
 	.ptlock = __SPIN_LOCK_UNLOCKED(kgsl_driver.ptlock),
 	.devlock = __MUTEX_INITIALIZER(kgsl_driver.devlock),
+	.page_pool_max = CONFIG_MSM_KGSL_PAGE_POOL_SIZE,
 };
 EXPORT_SYMBOL(kgsl_driver);
 
@@ -2366,8 +2466,42 @@ kgsl_ptdata_init(void)
 	return 0;
 }
 
+/*
+ * Hand pooled pages back to the system under memory pressure.  The process
+ * list can't be walked while a process is being torn down, so just skip
+ * this round if the lock is contended.
+ */
+static int kgsl_page_pool_shrink_all(struct shrinker *shrinker,
+				     struct shrink_control *sc)
+{
+	struct kgsl_process_private *private;
+	int nr = sc->nr_to_scan;
+
+	if (nr > 0) {
+		if (!mutex_trylock(&kgsl_driver.process_mutex))
+			return -1;
+
+		list_for_each_entry(private, &kgsl_driver.process_list, list) {
+			nr -= kgsl_page_pool_shrink(private->pool, nr);
+			if (nr <= 0)
+				break;
+		}
+
+		mutex_unlock(&kgsl_driver.process_mutex);
+	}
+
+	return atomic_read(&kgsl_driver.stats.pool_pages);
+}
+
+static struct shrinker kgsl_page_pool_shrinker = {
+	.shrink = kgsl_page_pool_shrink_all,
+	.seeks = DEFAULT_SEEKS,
+};
+
 static void kgsl_core_exit(void)
 {
+	unregister_shrinker(&kgsl_page_pool_shrinker);
+
 	kgsl_mmu_ptpool_destroy(kgsl_driver.ptpool);
 	kgsl_driver.ptpool = NULL;
 
@@ -2397,6 +2531,9 @@ static void kgsl_core_exit(void)
 static int __init kgsl_core_init(void)
 {
 	int result = 0;
+
+	register_shrinker(&kgsl_page_pool_shrinker);
+
 	/* alloc major and minor device numbers */
 	result = alloc_chrdev_region(&kgsl_driver.major, 0, KGSL_DEVICE_MAX,
 				  KGSL_NAME);
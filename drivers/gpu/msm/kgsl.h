@@ -92,6 +92,9 @@ struct kgsl_driver {
 
 	void *ptpool;
 
+	/* Cap, in pages, on each process's recycled page pool */
+	unsigned int page_pool_max;
+
 	struct {
 		unsigned int vmalloc;
 		unsigned int vmalloc_max;
@@ -102,6 +105,12 @@ struct kgsl_driver {
 		unsigned int mapped;
 		unsigned int mapped_max;
 		unsigned int histogram[16];
+		/* updated under each process's own pool lock */
+		atomic_t pool_pages;
+		unsigned int pool_hits;
+		unsigned int pool_misses;
+		unsigned int lookup_hits;
+		unsigned int lookup_misses;
 	} stats;
 };
 
@@ -118,6 +127,22 @@ struct kgsl_memdesc_ops {
 	int (*map_kernel_mem)(struct kgsl_memdesc *);
 };
 
+/*
+ * Per-process cache of pages released by earlier allocations.  Pages on
+ * the list are already zeroed and clean in every cache level, so they can
+ * be handed straight back to the next allocation from the same process.
+ * Every page allocated memdesc holds a reference, since a mapping can
+ * keep one alive after its process is gone.
+ */
+struct kgsl_page_pool {
+	spinlock_t lock;
+	struct list_head list;
+	unsigned int count;
+	/* the process has exited, freed pages go back to the system */
+	int closed;
+	struct kref refcount;
+};
+
 /* shared memory allocation */
 struct kgsl_memdesc {
 	struct kgsl_pagetable *pagetable;
@@ -129,6 +154,7 @@ struct kgsl_memdesc {
 	struct scatterlist *sg;
 	unsigned int sglen;
 	struct kgsl_memdesc_ops *ops;
+	struct kgsl_page_pool *pool;
 };
 
 /* List of different memory entry types */
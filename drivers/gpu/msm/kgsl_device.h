@@ -206,11 +206,17 @@ struct kgsl_context {
 	unsigned int reset_status;
 };
 
+/* Number of recently used mem entries checked before walking mem_rb */
+#define KGSL_LOOKUP_CACHE_SIZE 4
+
 struct kgsl_process_private {
 	unsigned int refcnt;
 	pid_t pid;
 	spinlock_t mem_lock;
 	struct rb_root mem_rb;
+	/* MRU ordered, NULL terminated; protected by mem_lock */
+	struct kgsl_mem_entry *lookup[KGSL_LOOKUP_CACHE_SIZE];
+	struct kgsl_page_pool *pool;
 	struct kgsl_pagetable *pagetable;
 	struct list_head list;
 	struct kobject kobj;
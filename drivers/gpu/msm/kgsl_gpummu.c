@@ -22,6 +22,8 @@
 #include "kgsl_device.h"
 #include "kgsl_sharedmem.h"
 
+static void _kgsl_ptpool_trim(struct kgsl_ptpool *pool);
+
 static ssize_t
 sysfs_show_ptpool_entries(struct kobject *kobj,
 			  struct kobj_attribute *attr,
@@ -63,6 +65,39 @@ sysfs_show_ptpool_ptsize(struct kobject *kobj,
 	return snprintf(buf, PAGE_SIZE, "%d\n", pool->ptsize);
 }
 
+static ssize_t
+sysfs_show_ptpool_max_free(struct kobject *kobj,
+			   struct kobj_attribute *attr,
+			   char *buf)
+{
+	struct kgsl_ptpool *pool = (struct kgsl_ptpool *)
+					kgsl_driver.ptpool;
+	return snprintf(buf, PAGE_SIZE, "%d/%d\n", pool->free_dynamic,
+			pool->max_free_dynamic);
+}
+
+static ssize_t
+sysfs_store_ptpool_max_free(struct kobject *kobj,
+			    struct kobj_attribute *attr,
+			    const char *buf, size_t count)
+{
+	struct kgsl_ptpool *pool = (struct kgsl_ptpool *)
+					kgsl_driver.ptpool;
+	unsigned long val;
+	int ret;
+
+	ret = strict_strtoul(buf, 0, &val);
+	if (ret)
+		return ret;
+
+	mutex_lock(&pool->lock);
+	pool->max_free_dynamic = val;
+	_kgsl_ptpool_trim(pool);
+	mutex_unlock(&pool->lock);
+
+	return count;
+}
+
 static struct kobj_attribute attr_ptpool_entries = {
 	.attr = { .name = "ptpool_entries", .mode = 0444 },
 	.show = sysfs_show_ptpool_entries,
@@ -87,11 +122,18 @@ static struct kobj_attribute attr_ptpool_ptsize = {
 	.store = NULL,
 };
 
+static struct kobj_attribute attr_ptpool_max_free = {
+	.attr = { .name = "ptpool_max_free", .mode = 0644 },
+	.show = sysfs_show_ptpool_max_free,
+	.store = sysfs_store_ptpool_max_free,
+};
+
 static struct attribute *ptpool_attrs[] = {
 	&attr_ptpool_entries.attr,
 	&attr_ptpool_min.attr,
 	&attr_ptpool_chunks.attr,
 	&attr_ptpool_ptsize.attr,
+	&attr_ptpool_max_free.attr,
 	NULL,
 };
 
@@ -145,6 +187,8 @@ _kgsl_ptpool_add_entries(struct kgsl_ptpool *pool, int count, int dynamic)
 
 	if (!dynamic)
 		pool->static_entries += count;
+	else
+		pool->free_dynamic++;
 
 	return 0;
 
@@ -166,6 +210,11 @@ _kgsl_ptpool_get_entry(struct kgsl_ptpool *pool, unsigned int *physaddr)
 		if (bit >= chunk->count)
 			continue;
 
+		if (chunk->dynamic && bitmap_empty(chunk->bitmap, chunk->count)) {
+			BUG_ON(pool->free_dynamic <= 0);
+			pool->free_dynamic--;
+		}
+
 		set_bit(bit, chunk->bitmap);
 		*physaddr = chunk->phys + (bit * pool->ptsize);
 
@@ -244,10 +293,16 @@ done:
 	return addr;
 }
 
-static inline void _kgsl_ptpool_rm_chunk(struct kgsl_ptpool_chunk *chunk)
+static inline void _kgsl_ptpool_rm_chunk(struct kgsl_ptpool *pool,
+					 struct kgsl_ptpool_chunk *chunk)
 {
 	list_del(&chunk->list);
 
+	pool->chunks--;
+	pool->entries -= chunk->count;
+	if (!chunk->dynamic)
+		pool->static_entries -= chunk->count;
+
 	if (chunk->data)
 		dma_free_coherent(NULL, chunk->size, chunk->data,
 			chunk->phys);
@@ -255,15 +310,40 @@ static inline void _kgsl_ptpool_rm_chunk(struct kgsl_ptpool_chunk *chunk)
 	kfree(chunk);
 }
 
+/*
+ * Release empty dynamic chunks until no more than max_free_dynamic are
+ * left.  Keeping a few around saves a coherent allocation (and the
+ * clearing of a full pagetable) every time a GPU process starts.
+ */
+static void _kgsl_ptpool_trim(struct kgsl_ptpool *pool)
+{
+	struct kgsl_ptpool_chunk *chunk, *tmp;
+
+	list_for_each_entry_safe(chunk, tmp, &pool->list, list) {
+		if (pool->free_dynamic <= pool->max_free_dynamic)
+			break;
+
+		if (chunk->dynamic &&
+			bitmap_empty(chunk->bitmap, chunk->count)) {
+			_kgsl_ptpool_rm_chunk(pool, chunk);
+			pool->free_dynamic--;
+		}
+	}
+}
+
 /**
  * kgsl_ptpool_free
  * @pool:  A pointer to a ptpool structure
  * @addr: A pointer to the virtual address to free
+ * @offset: Offset of the first byte the pagetable owner wrote to
+ * @len: Length of the written range
  *
- * Free a pagetable allocated from the pool
+ * Free a pagetable allocated from the pool.  Entries in the pool are kept
+ * zeroed, so only the range that was actually written needs clearing.
  */
 
-static void kgsl_ptpool_free(struct kgsl_ptpool *pool, void *addr)
+static void kgsl_ptpool_free(struct kgsl_ptpool *pool, void *addr,
+			     unsigned int offset, unsigned int len)
 {
 	struct kgsl_ptpool_chunk *chunk, *tmp;
 
@@ -278,11 +358,14 @@ static void kgsl_ptpool_free(struct kgsl_ptpool *pool, void *addr)
 				pool->ptsize;
 
 			clear_bit(bit, chunk->bitmap);
-			memset(addr, 0, pool->ptsize);
+			if (len)
+				memset(addr + offset, 0, len);
 
 			if (chunk->dynamic &&
-				bitmap_empty(chunk->bitmap, chunk->count))
-				_kgsl_ptpool_rm_chunk(chunk);
+				bitmap_empty(chunk->bitmap, chunk->count)) {
+				pool->free_dynamic++;
+				_kgsl_ptpool_trim(pool);
+			}
 
 			break;
 		}
@@ -301,7 +384,7 @@ void kgsl_gpummu_ptpool_destroy(void *ptpool)
 
 	mutex_lock(&pool->lock);
 	list_for_each_entry_safe(chunk, tmp, &pool->list, list)
-		_kgsl_ptpool_rm_chunk(chunk);
+		_kgsl_ptpool_rm_chunk(pool, chunk);
 	mutex_unlock(&pool->lock);
 
 	kfree(pool);
@@ -329,6 +412,7 @@ void *kgsl_gpummu_ptpool_init(int ptsize, int entries)
 	}
 
 	pool->ptsize = ptsize;
+	pool->max_free_dynamic = KGSL_PTPOOL_MAX_FREE_DYNAMIC;
 	mutex_init(&pool->lock);
 	INIT_LIST_HEAD(&pool->list);
 
@@ -362,8 +446,16 @@ void kgsl_gpummu_destroy_pagetable(void *mmu_specific_pt)
 {
 	struct kgsl_gpummu_pt *gpummu_pt = (struct kgsl_gpummu_pt *)
 						mmu_specific_pt;
+	unsigned int offset = 0, len = 0;
+
+	if (gpummu_pt->pte_last > gpummu_pt->pte_first) {
+		offset = gpummu_pt->pte_first * KGSL_PAGETABLE_ENTRY_SIZE;
+		len = (gpummu_pt->pte_last - gpummu_pt->pte_first) *
+			KGSL_PAGETABLE_ENTRY_SIZE;
+	}
+
 	kgsl_ptpool_free((struct kgsl_ptpool *)kgsl_driver.ptpool,
-				gpummu_pt->base.hostptr);
+				gpummu_pt->base.hostptr, offset, len);
 
 	kgsl_driver.stats.coherent -= KGSL_PAGETABLE_SIZE;
 
@@ -439,6 +531,8 @@ static void *kgsl_gpummu_create_pagetable(void)
 
 	gpummu_pt->tlb_flags = 0;
 	gpummu_pt->last_superpte = 0;
+	gpummu_pt->pte_first = UINT_MAX;
+	gpummu_pt->pte_last = 0;
 
 	gpummu_pt->tlbflushfilter.size = (CONFIG_MSM_KGSL_PAGE_TABLE_SIZE /
 				(PAGE_SIZE * GSL_PT_SUPER_PTE * 8)) + 1;
@@ -677,6 +771,9 @@ kgsl_gpummu_map(void *mmu_specific_pt,
 
 	pte = kgsl_pt_entry_get(KGSL_PAGETABLE_BASE, memdesc->gpuaddr);
 
+	if (pte < gpummu_pt->pte_first)
+		gpummu_pt->pte_first = pte;
+
 	/* Flush the TLB if the first PTE isn't at the superpte boundary */
 	if (pte & (GSL_PT_SUPER_PTE - 1))
 		flushtlb = 1;
@@ -693,6 +790,9 @@ kgsl_gpummu_map(void *mmu_specific_pt,
 		}
 	}
 
+	if (pte > gpummu_pt->pte_last)
+		gpummu_pt->pte_last = pte;
+
 	/* Flush the TLB if the last PTE isn't at the superpte boundary */
 	if ((pte + 1) & (GSL_PT_SUPER_PTE - 1))
 		flushtlb = 1;
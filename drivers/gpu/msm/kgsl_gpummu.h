@@ -50,6 +50,9 @@ struct kgsl_gpummu_pt {
 	unsigned int tlb_flags;
 	/* Maintain filter to manage tlb flushing */
 	struct kgsl_tlbflushfilter tlbflushfilter;
+	/* Range of PTEs ever written, cleared when the pagetable is freed */
+	unsigned int pte_first;
+	unsigned int pte_last;
 };
 
 struct kgsl_ptpool_chunk {
@@ -71,8 +74,14 @@ struct kgsl_ptpool {
 	int entries;
 	int static_entries;
 	int chunks;
+	/* Empty dynamic entries kept around for the next process */
+	int free_dynamic;
+	int max_free_dynamic;
 };
 
+/* Default number of empty dynamic pagetables kept in the pool */
+#define KGSL_PTPOOL_MAX_FREE_DYNAMIC 1
+
 void *kgsl_gpummu_ptpool_init(int ptsize,
 			int entries);
 void kgsl_gpummu_ptpool_destroy(void *ptpool);
@@ -11,6 +11,7 @@
  *
  */
 #include <linux/vmalloc.h>
+#include <linux/highmem.h>
 #include <linux/memory_alloc.h>
 #include <asm/cacheflush.h>
 #include <linux/slab.h>
@@ -215,6 +216,16 @@ static int kgsl_drv_memstat_show(struct device *dev,
 		val = kgsl_driver.stats.mapped;
 	else if (!strncmp(attr->attr.name, "mapped_max", 10))
 		val = kgsl_driver.stats.mapped_max;
+	else if (!strncmp(attr->attr.name, "pool_pages", 10))
+		val = atomic_read(&kgsl_driver.stats.pool_pages);
+	else if (!strncmp(attr->attr.name, "pool_hits", 9))
+		val = kgsl_driver.stats.pool_hits;
+	else if (!strncmp(attr->attr.name, "pool_misses", 11))
+		val = kgsl_driver.stats.pool_misses;
+	else if (!strncmp(attr->attr.name, "lookup_hits", 11))
+		val = kgsl_driver.stats.lookup_hits;
+	else if (!strncmp(attr->attr.name, "lookup_misses", 13))
+		val = kgsl_driver.stats.lookup_misses;
 
 	return snprintf(buf, PAGE_SIZE, "%u\n", val);
 }
@@ -243,6 +254,11 @@ DEVICE_ATTR(coherent_max, 0444, kgsl_drv_memstat_show, NULL);
 DEVICE_ATTR(mapped, 0444, kgsl_drv_memstat_show, NULL);
 DEVICE_ATTR(mapped_max, 0444, kgsl_drv_memstat_show, NULL);
 DEVICE_ATTR(histogram, 0444, kgsl_drv_histogram_show, NULL);
+DEVICE_ATTR(pool_pages, 0444, kgsl_drv_memstat_show, NULL);
+DEVICE_ATTR(pool_hits, 0444, kgsl_drv_memstat_show, NULL);
+DEVICE_ATTR(pool_misses, 0444, kgsl_drv_memstat_show, NULL);
+DEVICE_ATTR(lookup_hits, 0444, kgsl_drv_memstat_show, NULL);
+DEVICE_ATTR(lookup_misses, 0444, kgsl_drv_memstat_show, NULL);
 
 static const struct device_attribute *drv_attr_list[] = {
 	&dev_attr_vmalloc,
@@ -254,6 +270,11 @@ static const struct device_attribute *drv_attr_list[] = {
 	&dev_attr_mapped,
 	&dev_attr_mapped_max,
 	&dev_attr_histogram,
+	&dev_attr_pool_pages,
+	&dev_attr_pool_hits,
+	&dev_attr_pool_misses,
+	&dev_attr_lookup_hits,
+	&dev_attr_lookup_misses,
 	NULL
 };
 
@@ -297,12 +318,124 @@ static void outer_cache_range_op_sg(struct scatterlist *sg, int sglen, int op)
 	}
 }
 
+static void outer_cache_page_op(struct page *page, int op)
+{
+	_outer_cache_range_op(op, page_to_phys(page), PAGE_SIZE);
+}
+
 #else
 static void outer_cache_range_op_sg(struct scatterlist *sg, int sglen, int op)
 {
 }
+
+static void outer_cache_page_op(struct page *page, int op)
+{
+}
 #endif
 
+struct kgsl_page_pool *kgsl_page_pool_create(void)
+{
+	struct kgsl_page_pool *pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+
+	if (pool == NULL)
+		return NULL;
+
+	spin_lock_init(&pool->lock);
+	INIT_LIST_HEAD(&pool->list);
+	kref_init(&pool->refcount);
+	return pool;
+}
+
+static struct page *kgsl_page_pool_get(struct kgsl_page_pool *pool)
+{
+	struct page *page = NULL;
+
+	if (pool == NULL)
+		return NULL;
+
+	spin_lock(&pool->lock);
+	if (!list_empty(&pool->list)) {
+		page = list_first_entry(&pool->list, struct page, lru);
+		list_del(&page->lru);
+		pool->count--;
+		atomic_dec(&kgsl_driver.stats.pool_pages);
+	}
+	spin_unlock(&pool->lock);
+
+	return page;
+}
+
+/*
+ * Give a page back to the pool, or to the system if the pool is full or
+ * somebody else still holds a reference to it.  Zeroing and cleaning is
+ * done here so the allocation path can use the page as is.
+ */
+static void kgsl_page_pool_put(struct kgsl_page_pool *pool, struct page *page)
+{
+	if (pool == NULL || page_count(page) != 1 || pool->closed ||
+	    pool->count >= kgsl_driver.page_pool_max)
+		goto free;
+
+	clear_highpage(page);
+	flush_dcache_page(page);
+	outer_cache_page_op(page, KGSL_CACHE_OP_FLUSH);
+
+	spin_lock(&pool->lock);
+	if (!pool->closed && pool->count < kgsl_driver.page_pool_max) {
+		list_add(&page->lru, &pool->list);
+		pool->count++;
+		atomic_inc(&kgsl_driver.stats.pool_pages);
+		page = NULL;
+	}
+	spin_unlock(&pool->lock);
+
+	if (page == NULL)
+		return;
+free:
+	__free_page(page);
+}
+
+/* Release up to nr_pages from the pool, returns the number released */
+int kgsl_page_pool_shrink(struct kgsl_page_pool *pool, int nr_pages)
+{
+	struct page *page;
+	int freed = 0;
+
+	while (freed < nr_pages) {
+		page = kgsl_page_pool_get(pool);
+		if (page == NULL)
+			break;
+		__free_page(page);
+		freed++;
+	}
+
+	return freed;
+}
+
+static void kgsl_page_pool_destroy(struct kref *kref)
+{
+	struct kgsl_page_pool *pool = container_of(kref,
+						   struct kgsl_page_pool,
+						   refcount);
+
+	kgsl_page_pool_shrink(pool, INT_MAX);
+	kfree(pool);
+}
+
+/* Called when the owning process goes away, drops the process reference */
+void kgsl_page_pool_close(struct kgsl_page_pool *pool)
+{
+	if (pool == NULL)
+		return;
+
+	spin_lock(&pool->lock);
+	pool->closed = 1;
+	spin_unlock(&pool->lock);
+
+	kgsl_page_pool_shrink(pool, INT_MAX);
+	kref_put(&pool->refcount, kgsl_page_pool_destroy);
+}
+
 static int kgsl_page_alloc_vmfault(struct kgsl_memdesc *memdesc,
 				struct vm_area_struct *vma,
 				struct vm_fault *vmf)
@@ -340,7 +473,9 @@ static void kgsl_page_alloc_free(struct kgsl_memdesc *memdesc)
 	}
 	if (memdesc->sg)
 		for_each_sg(memdesc->sg, sg, memdesc->sglen, i)
-			__free_page(sg_page(sg));
+			kgsl_page_pool_put(memdesc->pool, sg_page(sg));
+	if (memdesc->pool)
+		kref_put(&memdesc->pool->refcount, kgsl_page_pool_destroy);
 }
 
 static int kgsl_contiguous_vmflags(struct kgsl_memdesc *memdesc)
@@ -469,12 +604,16 @@ _kgsl_sharedmem_page_alloc(struct kgsl_memdesc *memdesc,
 {
 	int order, ret = 0;
 	int sglen = PAGE_ALIGN(size) / PAGE_SIZE;
-	int i;
+	int i, hits = 0;
 
 	memdesc->size = size;
 	memdesc->pagetable = pagetable;
 	memdesc->priv = KGSL_MEMFLAGS_CACHED;
 	memdesc->ops = &kgsl_page_alloc_ops;
+	/* dropped by kgsl_page_alloc_free(), which may run after the
+	 * process has exited */
+	if (memdesc->pool)
+		kref_get(&memdesc->pool->refcount);
 
 	memdesc->sg = kgsl_sg_alloc(sglen);
 
@@ -491,18 +630,28 @@ _kgsl_sharedmem_page_alloc(struct kgsl_memdesc *memdesc,
 	sg_init_table(memdesc->sg, sglen);
 
 	for (i = 0; i < memdesc->sglen; i++) {
-		struct page *page = alloc_page(GFP_KERNEL | __GFP_ZERO |
-						__GFP_HIGHMEM);
-		if (!page) {
-			ret = -ENOMEM;
-			memdesc->sglen = i;
-			goto done;
+		struct page *page = kgsl_page_pool_get(memdesc->pool);
+
+		if (page) {
+			hits++;
+		} else {
+			page = alloc_page(GFP_KERNEL | __GFP_ZERO |
+					  __GFP_HIGHMEM);
+			if (!page) {
+				ret = -ENOMEM;
+				memdesc->sglen = i;
+				goto done;
+			}
+			flush_dcache_page(page);
+			outer_cache_page_op(page, KGSL_CACHE_OP_FLUSH);
 		}
-		flush_dcache_page(page);
 		sg_set_page(&memdesc->sg[i], page, PAGE_SIZE, 0);
 	}
-	outer_cache_range_op_sg(memdesc->sg, memdesc->sglen,
-				KGSL_CACHE_OP_FLUSH);
+
+	if (memdesc->pool) {
+		kgsl_driver.stats.pool_hits += hits;
+		kgsl_driver.stats.pool_misses += memdesc->sglen - hits;
+	}
 
 	ret = kgsl_mmu_map(pagetable, memdesc, protflags);
 
@@ -51,6 +51,12 @@ int kgsl_sharedmem_ebimem(struct kgsl_memdesc *memdesc,
 
 void kgsl_sharedmem_free(struct kgsl_memdesc *memdesc);
 
+struct kgsl_page_pool *kgsl_page_pool_create(void);
+
+int kgsl_page_pool_shrink(struct kgsl_page_pool *pool, int nr_pages);
+
+void kgsl_page_pool_close(struct kgsl_page_pool *pool);
+
 int kgsl_sharedmem_readl(const struct kgsl_memdesc *memdesc,
 			uint32_t *dst,
 			unsigned int offsetbytes);
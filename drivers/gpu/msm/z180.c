@@ -420,8 +420,10 @@ z180_cmdstream_issueibcmds(struct kgsl_device_private *dev_priv,
 	 * Get a kernel mapping to the IB for monkey patching.
 	 * See the end of this function.
 	 */
+	spin_lock(&dev_priv->process_priv->mem_lock);
 	entry = kgsl_sharedmem_find_region(dev_priv->process_priv, cmd,
 		sizedwords);
+	spin_unlock(&dev_priv->process_priv->mem_lock);
 	if (entry == NULL) {
 		KGSL_DRV_ERR(device, "Bad ibdesc: gpuaddr 0x%x size %d\n",
 			     cmd, sizedwords);
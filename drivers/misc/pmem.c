@@ -21,6 +21,11 @@
 #include <linux/fmem.h>
 #include <linux/mm.h>
 #include <linux/list.h>
+#include <linux/rbtree.h>
+#include <linux/math64.h>
+#include <linux/cleancache.h>
+#include <linux/highmem.h>
+#include <linux/jhash.h>
 #include <linux/debugfs.h>
 #include <linux/android_pmem.h>
 #include <linux/mempolicy.h>
@@ -44,6 +49,9 @@
 
 #define PMEM_INITIAL_NUM_BITMAP_ALLOCATIONS (64)
 
+/* upper bound on the sweeps a single compaction request makes */
+#define PMEM_COMPACT_MAX_PASSES (4)
+
 #define PMEM_32BIT_WORD_ORDER (5)
 #define PMEM_BITS_PER_WORD_MASK (BITS_PER_LONG - 1)
 
@@ -70,6 +78,9 @@
  */
 #define PMEM_FLAGS_SUBMAP 0x1 << 3
 #define PMEM_FLAGS_UNSUBMAP 0x1 << 4
+/* the physical address of this allocation has been handed out (to a driver,
+ * to user space or to a connected file), so it may never be relocated */
+#define PMEM_FLAGS_PINNED 0x1 << 5
 
 struct pmem_data {
 	/* in alloc mode: an index into the bitmap
@@ -95,6 +106,8 @@ struct pmem_data {
 	struct list_head region_list;
 	/* a linked list of data so we can access them for debugging */
 	struct list_head list;
+	/* number of vmas currently backed by this file */
+	int map_count;
 #if PMEM_DEBUG
 	int ref;
 #endif
@@ -110,6 +123,16 @@ struct pmem_region_node {
 	struct list_head list;
 };
 
+/* a maximal run of free quanta in a bitmap region, indexed both by size
+ * (for best fit) and by start bit (for coalescing on free) */
+struct pmem_extent {
+	struct rb_node size_node;
+	struct rb_node addr_node;
+	struct list_head list;		/* on the spare pool when unused */
+	int start;
+	int len;
+};
+
 #define PMEM_DEBUG_MSGS 0
 #if PMEM_DEBUG_MSGS
 #define DLOG(fmt,args...) \
@@ -198,7 +221,24 @@ struct pmem_info {
 			struct {
 				short bit;
 				unsigned short quanta;
+				unsigned int align;
 			} *bitm_alloc;
+			/* number of live entries in bitm_alloc */
+			int32_t bitmap_used;
+
+			/* free extents, see struct pmem_extent */
+			struct rb_root free_by_size;
+			struct rb_root free_by_addr;
+			/* spare extents so that freeing never allocates */
+			struct list_head extent_pool;
+			int extent_nodes;
+
+			/* relocate movable allocations when an allocation
+			 * fails for lack of a large enough extent */
+			int compact_on_fail;
+			unsigned long compact_runs;
+			unsigned long compact_moves;
+			unsigned long compact_quanta;
 		} bitmap;
 
 		struct {
@@ -248,16 +288,432 @@ struct pmem_info {
 	 * memory will be reused through fmem
 	 */
 	int reusable;
+	/*
+	 * free pages lent to cleancache, one slot per page of the region
+	 */
+	struct pmem_cc_slot *cc_slots;
+	unsigned long cc_pages;
+	unsigned long cc_lent;
 };
 #define to_pmem_info_id(a) (container_of(a, struct pmem_info, kobj)->id)
 
 static void ioremap_pmem(int id);
+static int pmem_compact_bitmap(int id);
 static void pmem_put_region(int id);
 static int pmem_get_region(int id);
 
 static struct pmem_info pmem[PMEM_MAX_DEVICES];
 static int id_count;
 
+#ifdef CONFIG_ANDROID_PMEM_CLEANCACHE
+/*
+ * Free pages of bitmap regions that ask for it are lent to cleancache as a
+ * victim cache for clean page cache pages. Nothing in there is ever dirty,
+ * so pmem takes a page back by simply dropping its contents the moment an
+ * allocation lands on it, and scrubbing it so the new owner can't read them.
+ *
+ * The page copies run outside pmem_cc_lock; a slot being copied to or from
+ * is marked busy so that nobody hands it out or takes it back meanwhile.
+ */
+#define PMEM_CC_MAX_POOLS	(16)
+#define PMEM_CC_HASH_BITS	(10)
+
+struct pmem_cc_slot {
+	/* on the hash while holding a page */
+	struct hlist_node hash;
+	/* on pmem_cc_free while lent but empty, pmem_cc_lru while in use */
+	struct list_head list;
+	struct cleancache_filekey key;
+	pgoff_t index;
+	signed char pool;		/* -1 when empty */
+	unsigned char id;
+	unsigned char lent;
+	unsigned char busy;		/* copies in flight */
+	unsigned char filling;		/* put in flight, not readable yet */
+	unsigned char scrub;		/* has held page cache data */
+};
+
+static DEFINE_SPINLOCK(pmem_cc_lock);
+static struct hlist_head pmem_cc_hash[1 << PMEM_CC_HASH_BITS];
+static LIST_HEAD(pmem_cc_free);
+static LIST_HEAD(pmem_cc_lru);
+static unsigned long pmem_cc_pools;
+static int pmem_cc_registered;
+
+static struct {
+	unsigned long used;
+	unsigned long puts;
+	unsigned long gets;
+	unsigned long hits;
+	unsigned long evictions;
+	unsigned long reclaims;
+} pmem_cc_stat;
+
+static inline void *pmem_cc_vaddr(struct pmem_cc_slot *slot)
+{
+	return (void *)pmem[slot->id].vbase +
+		(slot - pmem[slot->id].cc_slots) * PAGE_SIZE;
+}
+
+static inline unsigned long pmem_cc_paddr(struct pmem_cc_slot *slot)
+{
+	return pmem[slot->id].base +
+		(slot - pmem[slot->id].cc_slots) * PAGE_SIZE;
+}
+
+static inline struct hlist_head *pmem_cc_bucket(int pool,
+		struct cleancache_filekey *key)
+{
+	return &pmem_cc_hash[jhash2(key->u.key, CLEANCACHE_KEY_MAX, pool) &
+		((1 << PMEM_CC_HASH_BITS) - 1)];
+}
+
+static inline int pmem_cc_match(struct pmem_cc_slot *slot, int pool,
+		struct cleancache_filekey *key)
+{
+	return slot->pool == pool && !memcmp(&slot->key, key, sizeof(*key));
+}
+
+static struct pmem_cc_slot *pmem_cc_find(int pool,
+		struct cleancache_filekey *key, pgoff_t index)
+{
+	struct pmem_cc_slot *slot;
+	struct hlist_node *pos;
+
+	hlist_for_each_entry(slot, pos, pmem_cc_bucket(pool, key), hash)
+		if (slot->index == index && pmem_cc_match(slot, pool, key))
+			return slot;
+	return NULL;
+}
+
+/* forget the page held in slot, caller holds pmem_cc_lock */
+static void pmem_cc_drop(struct pmem_cc_slot *slot)
+{
+	hlist_del(&slot->hash);
+	slot->pool = -1;
+	list_move(&slot->list, &pmem_cc_free);
+	pmem_cc_stat.used--;
+}
+
+/* first slot on list that isn't being copied, caller holds pmem_cc_lock */
+static struct pmem_cc_slot *pmem_cc_first_idle(struct list_head *list)
+{
+	struct pmem_cc_slot *slot;
+
+	list_for_each_entry(slot, list, list)
+		if (!slot->busy)
+			return slot;
+	return NULL;
+}
+
+static void pmem_cc_clean(struct pmem_cc_slot *slot, void *vaddr)
+{
+	if (!pmem[slot->id].cached)
+		return;
+	dmac_flush_range(vaddr, vaddr + PAGE_SIZE);
+#ifdef CONFIG_OUTER_CACHE
+	outer_flush_range(pmem_cc_paddr(slot), pmem_cc_paddr(slot) + PAGE_SIZE);
+#endif
+}
+
+static inline int pmem_cc_page_free(int id, unsigned long page)
+{
+	unsigned long bit = page * PAGE_SIZE / pmem[id].quantum;
+
+	return !(pmem[id].allocator.bitmap.bitmap[bit >> 5] &
+		(1U << (bit & 31)));
+}
+
+/* lend every page of [bit, bit + quanta) that the bitmap says is free */
+static void pmem_cc_lend(int id, int bit, int quanta)
+{
+	unsigned long page, first, last, flags;
+
+	if (!pmem[id].cc_slots)
+		return;
+
+	first = DIV_ROUND_UP((unsigned long)bit * pmem[id].quantum, PAGE_SIZE);
+	last = min(((unsigned long)bit + quanta) * pmem[id].quantum /
+		PAGE_SIZE, pmem[id].cc_pages);
+
+	spin_lock_irqsave(&pmem_cc_lock, flags);
+	for (page = first; page < last; page++) {
+		struct pmem_cc_slot *slot = &pmem[id].cc_slots[page];
+
+		if (slot->lent || !pmem_cc_page_free(id, page))
+			continue;
+		slot->lent = 1;
+		slot->pool = -1;
+		list_add_tail(&slot->list, &pmem_cc_free);
+		pmem[id].cc_lent++;
+	}
+	spin_unlock_irqrestore(&pmem_cc_lock, flags);
+}
+
+/* take back every page overlapping [bit, bit + quanta) */
+static void pmem_cc_reclaim(int id, int bit, int quanta)
+{
+	unsigned long page, first, last, flags;
+
+	if (!pmem[id].cc_slots)
+		return;
+
+	first = (unsigned long)bit * pmem[id].quantum / PAGE_SIZE;
+	last = min(DIV_ROUND_UP(((unsigned long)bit + quanta) *
+		pmem[id].quantum, PAGE_SIZE), pmem[id].cc_pages);
+
+	spin_lock_irqsave(&pmem_cc_lock, flags);
+	for (page = first; page < last; page++) {
+		struct pmem_cc_slot *slot = &pmem[id].cc_slots[page];
+
+		if (!slot->lent)
+			continue;
+		/* copies don't sleep, so this is short */
+		while (slot->busy) {
+			spin_unlock_irqrestore(&pmem_cc_lock, flags);
+			cpu_relax();
+			spin_lock_irqsave(&pmem_cc_lock, flags);
+		}
+		if (slot->pool >= 0) {
+			pmem_cc_drop(slot);
+			pmem_cc_stat.reclaims++;
+		}
+		list_del_init(&slot->list);
+		slot->lent = 0;
+		pmem[id].cc_lent--;
+	}
+	spin_unlock_irqrestore(&pmem_cc_lock, flags);
+
+	/* no longer lent, so nothing else touches these slots */
+	for (page = first; page < last; page++) {
+		struct pmem_cc_slot *slot = &pmem[id].cc_slots[page];
+		void *vaddr = pmem_cc_vaddr(slot);
+
+		if (!slot->scrub)
+			continue;
+		memset(vaddr, 0, PAGE_SIZE);
+		pmem_cc_clean(slot, vaddr);
+		slot->scrub = 0;
+	}
+}
+
+static int pmem_cc_init_fs(size_t pagesize)
+{
+	unsigned long flags;
+	int pool;
+
+	if (pagesize != PAGE_SIZE)
+		return -1;
+
+	spin_lock_irqsave(&pmem_cc_lock, flags);
+	pool = find_first_zero_bit(&pmem_cc_pools, PMEM_CC_MAX_POOLS);
+	if (pool < PMEM_CC_MAX_POOLS)
+		__set_bit(pool, &pmem_cc_pools);
+	else
+		pool = -1;
+	spin_unlock_irqrestore(&pmem_cc_lock, flags);
+	return pool;
+}
+
+static int pmem_cc_init_shared_fs(char *uuid, size_t pagesize)
+{
+	return pmem_cc_init_fs(pagesize);
+}
+
+static int pmem_cc_get_page(int pool, struct cleancache_filekey key,
+		pgoff_t index, struct page *page)
+{
+	struct pmem_cc_slot *slot;
+	unsigned long flags;
+	void *dst;
+
+	/* mapped up front so that the copy below can't be preempted */
+	dst = kmap_atomic(page, KM_USER0);
+	spin_lock_irqsave(&pmem_cc_lock, flags);
+	pmem_cc_stat.gets++;
+	slot = pmem_cc_find(pool, &key, index);
+	if (!slot || slot->filling) {
+		spin_unlock_irqrestore(&pmem_cc_lock, flags);
+		kunmap_atomic(dst, KM_USER0);
+		return -1;
+	}
+	slot->busy++;
+	list_move_tail(&slot->list, &pmem_cc_lru);
+	pmem_cc_stat.hits++;
+	spin_unlock_irqrestore(&pmem_cc_lock, flags);
+
+	memcpy(dst, pmem_cc_vaddr(slot), PAGE_SIZE);
+
+	spin_lock_irqsave(&pmem_cc_lock, flags);
+	slot->busy--;
+	spin_unlock_irqrestore(&pmem_cc_lock, flags);
+	kunmap_atomic(dst, KM_USER0);
+	return 0;
+}
+
+static void pmem_cc_put_page(int pool, struct cleancache_filekey key,
+		pgoff_t index, struct page *page)
+{
+	struct pmem_cc_slot *slot;
+	unsigned long flags;
+	void *src, *dst;
+
+	/* mapped up front so that the copy below can't be preempted */
+	src = kmap_atomic(page, KM_USER0);
+	spin_lock_irqsave(&pmem_cc_lock, flags);
+	slot = pmem_cc_find(pool, &key, index);
+	/* someone is still reading the old copy, leave it to them */
+	if (slot && slot->busy) {
+		pmem_cc_drop(slot);
+		slot = NULL;
+	}
+	if (!slot) {
+		slot = pmem_cc_first_idle(&pmem_cc_free);
+		if (!slot) {
+			slot = pmem_cc_first_idle(&pmem_cc_lru);
+			if (!slot)
+				goto out;
+			pmem_cc_drop(slot);
+			pmem_cc_stat.evictions++;
+		}
+		slot->pool = pool;
+		slot->key = key;
+		slot->index = index;
+		hlist_add_head(&slot->hash, pmem_cc_bucket(pool, &key));
+		pmem_cc_stat.used++;
+	}
+	list_move_tail(&slot->list, &pmem_cc_lru);
+	slot->busy++;
+	slot->filling = 1;
+	slot->scrub = 1;
+	spin_unlock_irqrestore(&pmem_cc_lock, flags);
+
+	dst = pmem_cc_vaddr(slot);
+	memcpy(dst, src, PAGE_SIZE);
+	/* leave nothing dirty behind for whoever gets this page next */
+	pmem_cc_clean(slot, dst);
+
+	spin_lock_irqsave(&pmem_cc_lock, flags);
+	/* a flush while copying has left it on pmem_cc_free */
+	slot->filling = 0;
+	slot->busy--;
+	pmem_cc_stat.puts++;
+out:
+	spin_unlock_irqrestore(&pmem_cc_lock, flags);
+	kunmap_atomic(src, KM_USER0);
+}
+
+static void pmem_cc_flush_page(int pool, struct cleancache_filekey key,
+		pgoff_t index)
+{
+	struct pmem_cc_slot *slot;
+	unsigned long flags;
+
+	spin_lock_irqsave(&pmem_cc_lock, flags);
+	slot = pmem_cc_find(pool, &key, index);
+	if (slot)
+		pmem_cc_drop(slot);
+	spin_unlock_irqrestore(&pmem_cc_lock, flags);
+}
+
+static void pmem_cc_flush_inode(int pool, struct cleancache_filekey key)
+{
+	struct pmem_cc_slot *slot;
+	struct hlist_node *pos, *n;
+	unsigned long flags;
+
+	spin_lock_irqsave(&pmem_cc_lock, flags);
+	hlist_for_each_entry_safe(slot, pos, n, pmem_cc_bucket(pool, &key),
+			hash)
+		if (pmem_cc_match(slot, pool, &key))
+			pmem_cc_drop(slot);
+	spin_unlock_irqrestore(&pmem_cc_lock, flags);
+}
+
+static void pmem_cc_flush_fs(int pool)
+{
+	struct pmem_cc_slot *slot, *n;
+	unsigned long flags;
+
+	if (pool < 0 || pool >= PMEM_CC_MAX_POOLS)
+		return;
+
+	spin_lock_irqsave(&pmem_cc_lock, flags);
+	list_for_each_entry_safe(slot, n, &pmem_cc_lru, list)
+		if (slot->pool == pool)
+			pmem_cc_drop(slot);
+	__clear_bit(pool, &pmem_cc_pools);
+	spin_unlock_irqrestore(&pmem_cc_lock, flags);
+}
+
+static struct cleancache_ops pmem_cc_ops = {
+	.init_fs = pmem_cc_init_fs,
+	.init_shared_fs = pmem_cc_init_shared_fs,
+	.get_page = pmem_cc_get_page,
+	.put_page = pmem_cc_put_page,
+	.flush_page = pmem_cc_flush_page,
+	.flush_inode = pmem_cc_flush_inode,
+	.flush_fs = pmem_cc_flush_fs,
+};
+
+static void pmem_cc_setup(int id)
+{
+	struct cleancache_ops old;
+	unsigned long i;
+
+	/* the lent pages are only reachable through a permanent mapping */
+	if (pmem[id].allocator_type != PMEM_ALLOCATORTYPE_BITMAP ||
+			pmem[id].map_on_demand) {
+		pr_warning("pmem: %s can't lend memory to cleancache\n",
+			pmem[id].name);
+		return;
+	}
+
+	pmem[id].cc_pages = (pmem[id].num_entries * pmem[id].quantum) >>
+		PAGE_SHIFT;
+	pmem[id].cc_slots = vmalloc(pmem[id].cc_pages *
+			sizeof(*pmem[id].cc_slots));
+	if (!pmem[id].cc_slots) {
+		pr_err("pmem: no memory for %s cleancache slots\n",
+			pmem[id].name);
+		return;
+	}
+	for (i = 0; i < pmem[id].cc_pages; i++) {
+		pmem[id].cc_slots[i].pool = -1;
+		pmem[id].cc_slots[i].id = id;
+		pmem[id].cc_slots[i].lent = 0;
+		pmem[id].cc_slots[i].busy = 0;
+		pmem[id].cc_slots[i].filling = 0;
+		pmem[id].cc_slots[i].scrub = 0;
+		INIT_LIST_HEAD(&pmem[id].cc_slots[i].list);
+	}
+
+	if (!pmem[id].vbase)
+		ioremap_pmem(id);
+	if (!pmem[id].vbase) {
+		vfree(pmem[id].cc_slots);
+		pmem[id].cc_slots = NULL;
+		return;
+	}
+
+	pmem_cc_lend(id, 0, pmem[id].num_entries);
+	pr_info("pmem: lending %lu free pages of %s to cleancache\n",
+		pmem[id].cc_lent, pmem[id].name);
+
+	if (!pmem_cc_registered) {
+		old = cleancache_register_ops(&pmem_cc_ops);
+		if (old.init_fs)
+			pr_warning("pmem: replaced an existing cleancache "
+				"backend\n");
+		pmem_cc_registered = 1;
+	}
+}
+#else
+static inline void pmem_cc_lend(int id, int bit, int quanta) { }
+static inline void pmem_cc_reclaim(int id, int bit, int quanta) { }
+static inline void pmem_cc_setup(int id) { }
+#endif
+
 #define PMEM_SYSFS_DIR_NAME "pmem_regions" /* under /sys/kernel/ */
 static struct kset *pmem_kset;
 
@@ -531,6 +987,91 @@ static ssize_t show_pmem_bits_allocated(int id, char *buf)
 }
 RO_PMEM_ATTR(bits_allocated);
 
+static ssize_t show_pmem_free_extents(int id, char *buf)
+{
+	struct rb_node *node;
+	ssize_t ret;
+
+	mutex_lock(&pmem[id].arena_mutex);
+
+	ret = scnprintf(buf, PAGE_SIZE, "bitnum\tquanta free\n");
+	for (node = rb_first(&pmem[id].allocator.bitmap.free_by_addr);
+			node && (PAGE_SIZE - ret); node = rb_next(node)) {
+		struct pmem_extent *ext =
+			rb_entry(node, struct pmem_extent, addr_node);
+
+		ret += scnprintf(buf + ret, PAGE_SIZE - ret, "%d\t%d\n",
+			ext->start, ext->len);
+	}
+
+	mutex_unlock(&pmem[id].arena_mutex);
+	return ret;
+}
+RO_PMEM_ATTR(free_extents);
+
+static ssize_t show_pmem_compact(int id, char *buf)
+{
+	ssize_t ret;
+
+	mutex_lock(&pmem[id].arena_mutex);
+	ret = scnprintf(buf, PAGE_SIZE, "runs %lu moves %lu quanta %lu\n",
+		pmem[id].allocator.bitmap.compact_runs,
+		pmem[id].allocator.bitmap.compact_moves,
+		pmem[id].allocator.bitmap.compact_quanta);
+	mutex_unlock(&pmem[id].arena_mutex);
+	return ret;
+}
+
+static ssize_t store_pmem_compact(int id, const char *buf,
+		const size_t count)
+{
+	mutex_lock(&pmem[id].arena_mutex);
+	pmem_compact_bitmap(id);
+	mutex_unlock(&pmem[id].arena_mutex);
+	return count;
+}
+RW_PMEM_ATTR(compact);
+
+static ssize_t show_pmem_compact_on_fail(int id, char *buf)
+{
+	return scnprintf(buf, PAGE_SIZE, "%d\n",
+		pmem[id].allocator.bitmap.compact_on_fail);
+}
+
+static ssize_t store_pmem_compact_on_fail(int id, const char *buf,
+		const size_t count)
+{
+	unsigned long val;
+
+	if (strict_strtoul(buf, 10, &val))
+		return -EINVAL;
+
+	mutex_lock(&pmem[id].arena_mutex);
+	pmem[id].allocator.bitmap.compact_on_fail = !!val;
+	mutex_unlock(&pmem[id].arena_mutex);
+	return count;
+}
+RW_PMEM_ATTR(compact_on_fail);
+
+#ifdef CONFIG_ANDROID_PMEM_CLEANCACHE
+static ssize_t show_pmem_cleancache(int id, char *buf)
+{
+	unsigned long flags;
+	ssize_t ret;
+
+	spin_lock_irqsave(&pmem_cc_lock, flags);
+	ret = scnprintf(buf, PAGE_SIZE,
+		"lent %lu\nused %lu\nputs %lu\ngets %lu\nhits %lu\n"
+		"evictions %lu\nreclaims %lu\n",
+		pmem[id].cc_lent, pmem_cc_stat.used, pmem_cc_stat.puts,
+		pmem_cc_stat.gets, pmem_cc_stat.hits,
+		pmem_cc_stat.evictions, pmem_cc_stat.reclaims);
+	spin_unlock_irqrestore(&pmem_cc_lock, flags);
+	return ret;
+}
+RO_PMEM_ATTR(cleancache);
+#endif
+
 static struct attribute *pmem_bitmap_attrs[] = {
 	PMEM_COMMON_SYSFS_ATTRS,
 
@@ -538,6 +1079,12 @@ static struct attribute *pmem_bitmap_attrs[] = {
 
 	&pmem_attr_free_quanta.attr,
 	&pmem_attr_bits_allocated.attr,
+	&pmem_attr_free_extents.attr,
+	&pmem_attr_compact.attr,
+	&pmem_attr_compact_on_fail.attr,
+#ifdef CONFIG_ANDROID_PMEM_CLEANCACHE
+	&pmem_attr_cleancache.attr,
+#endif
 
 	NULL
 };
@@ -799,6 +1346,186 @@ static void bitmap_bits_clear_all(uint32_t *bitp, int bit_start, int bit_end)
 	}
 }
 
+static void extent_insert(int id, struct pmem_extent *ext)
+{
+	struct rb_node **p, *parent = NULL;
+	struct pmem_extent *e;
+
+	/* ties on size go to the lower address so best fit packs low */
+	p = &pmem[id].allocator.bitmap.free_by_size.rb_node;
+	while (*p) {
+		parent = *p;
+		e = rb_entry(parent, struct pmem_extent, size_node);
+		if (ext->len < e->len ||
+				(ext->len == e->len && ext->start < e->start))
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&ext->size_node, parent, p);
+	rb_insert_color(&ext->size_node,
+			&pmem[id].allocator.bitmap.free_by_size);
+
+	parent = NULL;
+	p = &pmem[id].allocator.bitmap.free_by_addr.rb_node;
+	while (*p) {
+		parent = *p;
+		e = rb_entry(parent, struct pmem_extent, addr_node);
+		if (ext->start < e->start)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+	rb_link_node(&ext->addr_node, parent, p);
+	rb_insert_color(&ext->addr_node,
+			&pmem[id].allocator.bitmap.free_by_addr);
+}
+
+static void extent_remove(int id, struct pmem_extent *ext)
+{
+	rb_erase(&ext->size_node, &pmem[id].allocator.bitmap.free_by_size);
+	rb_erase(&ext->addr_node, &pmem[id].allocator.bitmap.free_by_addr);
+}
+
+static struct pmem_extent *extent_get(int id)
+{
+	struct pmem_extent *ext;
+
+	/* extent_reserve_nodes() guarantees this never runs dry */
+	BUG_ON(list_empty(&pmem[id].allocator.bitmap.extent_pool));
+	ext = list_first_entry(&pmem[id].allocator.bitmap.extent_pool,
+			struct pmem_extent, list);
+	list_del(&ext->list);
+	return ext;
+}
+
+static void extent_put(int id, struct pmem_extent *ext)
+{
+	list_add(&ext->list, &pmem[id].allocator.bitmap.extent_pool);
+}
+
+static int extent_reserve_nodes(int id)
+{
+	/* free space can be split into at most one more extent than
+	 * there are allocations; keep that many nodes, plus one for the
+	 * allocation in progress, so that a free never has to allocate */
+	while (pmem[id].allocator.bitmap.extent_nodes <
+			pmem[id].allocator.bitmap.bitmap_used + 2) {
+		struct pmem_extent *ext = kmalloc(sizeof(*ext), GFP_KERNEL);
+
+		if (!ext)
+			return -ENOMEM;
+		extent_put(id, ext);
+		pmem[id].allocator.bitmap.extent_nodes++;
+	}
+	return 0;
+}
+
+/* returns the free extent containing bit, or NULL */
+static struct pmem_extent *extent_lookup(int id, int bit)
+{
+	struct rb_node *node = pmem[id].allocator.bitmap.free_by_addr.rb_node;
+
+	while (node) {
+		struct pmem_extent *e =
+			rb_entry(node, struct pmem_extent, addr_node);
+
+		if (bit < e->start)
+			node = node->rb_left;
+		else if (bit >= e->start + e->len)
+			node = node->rb_right;
+		else
+			return e;
+	}
+	return NULL;
+}
+
+/* take [bit, bit + quanta) out of the free extent ext */
+static void extent_carve(int id, struct pmem_extent *ext, int bit,
+		int quanta)
+{
+	int end = ext->start + ext->len;
+
+	extent_remove(id, ext);
+	if (bit > ext->start) {
+		ext->len = bit - ext->start;
+		extent_insert(id, ext);
+		ext = NULL;
+	}
+	if (bit + quanta < end) {
+		if (!ext)
+			ext = extent_get(id);
+		ext->start = bit + quanta;
+		ext->len = end - ext->start;
+		extent_insert(id, ext);
+	} else if (ext) {
+		extent_put(id, ext);
+	}
+}
+
+/* return [bit, bit + quanta) to the free extents, merging neighbours */
+static void extent_release(int id, int bit, int quanta)
+{
+	struct rb_node *node = pmem[id].allocator.bitmap.free_by_addr.rb_node;
+	struct pmem_extent *prev = NULL, *next = NULL, *e;
+
+	while (node) {
+		e = rb_entry(node, struct pmem_extent, addr_node);
+		if (e->start < bit) {
+			prev = e;
+			node = node->rb_right;
+		} else {
+			next = e;
+			node = node->rb_left;
+		}
+	}
+	if (prev && prev->start + prev->len != bit)
+		prev = NULL;
+	if (next && next->start != bit + quanta)
+		next = NULL;
+
+	if (prev) {
+		extent_remove(id, prev);
+		prev->len += quanta;
+		if (next) {
+			extent_remove(id, next);
+			prev->len += next->len;
+			extent_put(id, next);
+		}
+		extent_insert(id, prev);
+	} else if (next) {
+		extent_remove(id, next);
+		next->start = bit;
+		next->len += quanta;
+		extent_insert(id, next);
+	} else {
+		e = extent_get(id);
+		e->start = bit;
+		e->len = quanta;
+		extent_insert(id, e);
+	}
+}
+
+static void extent_free_all(int id)
+{
+	struct pmem_extent *ext, *tmp;
+	struct rb_node *node;
+
+	if (!pmem[id].allocator.bitmap.extent_pool.next)
+		return;
+
+	while ((node = rb_first(&pmem[id].allocator.bitmap.free_by_addr))) {
+		ext = rb_entry(node, struct pmem_extent, addr_node);
+		extent_remove(id, ext);
+		kfree(ext);
+	}
+	list_for_each_entry_safe(ext, tmp,
+			&pmem[id].allocator.bitmap.extent_pool, list)
+		kfree(ext);
+	INIT_LIST_HEAD(&pmem[id].allocator.bitmap.extent_pool);
+	pmem[id].allocator.bitmap.extent_nodes = 0;
+}
+
 static int pmem_free_bitmap(int id, int bitnum)
 {
 	/* caller should hold the lock on arena_mutex! */
@@ -817,7 +1544,10 @@ static int pmem_free_bitmap(int id, int bitnum)
 
 			bitmap_bits_clear_all(pmem[id].allocator.bitmap.bitmap,
 				curr_bit, curr_bit + curr_quanta);
+			extent_release(id, curr_bit, curr_quanta);
+			pmem_cc_lend(id, curr_bit, curr_quanta);
 			pmem[id].allocator.bitmap.bitmap_free += curr_quanta;
+			pmem[id].allocator.bitmap.bitmap_used--;
 			pmem[id].allocator.bitmap.bitm_alloc[i].bit = -1;
 			pmem[id].allocator.bitmap.bitm_alloc[i].quanta = 0;
 			return 0;
@@ -853,48 +1583,15 @@ static int pmem_free_system(int id, int index)
 
 static int pmem_free_space_bitmap(int id, struct pmem_freespace *fs)
 {
-	int i, j;
-	int max_allocs = pmem[id].allocator.bitmap.bitmap_allocs;
-	int alloc_start = 0;
-	int next_alloc;
-	unsigned long size = 0;
-
-	fs->total = 0;
-	fs->largest = 0;
-
-	for (i = 0; i < max_allocs; i++) {
-
-		int alloc_quanta = 0;
-		int alloc_idx = 0;
-		next_alloc = pmem[id].num_entries;
-
-		/* Look for the lowest bit where next allocation starts */
-		for (j = 0; j < max_allocs; j++) {
-			const int curr_alloc = pmem[id].allocator.
-						bitmap.bitm_alloc[j].bit;
-			if (curr_alloc != -1) {
-				if (alloc_start == curr_alloc)
-					alloc_idx = j;
-				if (alloc_start >= curr_alloc)
-					continue;
-				if (curr_alloc < next_alloc)
-					next_alloc = curr_alloc;
-			}
-		}
-		alloc_quanta = pmem[id].allocator.bitmap.
-				bitm_alloc[alloc_idx].quanta;
-		size = (next_alloc - (alloc_start + alloc_quanta)) *
-				pmem[id].quantum;
+	/* caller should hold the lock on arena_mutex! */
+	struct rb_node *largest =
+		rb_last(&pmem[id].allocator.bitmap.free_by_size);
 
-		if (size > fs->largest)
-			fs->largest = size;
-		fs->total += size;
-
-		if (next_alloc == pmem[id].num_entries)
-			break;
-		else
-			alloc_start = next_alloc;
-	}
+	fs->total = (unsigned long)pmem[id].allocator.bitmap.bitmap_free *
+		pmem[id].quantum;
+	fs->largest = largest ? (unsigned long)rb_entry(largest,
+			struct pmem_extent, size_node)->len *
+		pmem[id].quantum : 0;
 
 	return 0;
 }
@@ -999,6 +1696,7 @@ static int pmem_open(struct inode *inode, struct file *file)
 	data->index = -1;
 	data->task = NULL;
 	data->vma = NULL;
+	data->map_count = 0;
 	data->pid = 0;
 	data->master_file = NULL;
 #if PMEM_DEBUG
@@ -1140,68 +1838,43 @@ static void bitmap_bits_set_all(uint32_t *bitp, int bit_start, int bit_end)
 	}
 }
 
-static int
-bitmap_allocate_contiguous(uint32_t *bitp, int num_bits_to_alloc,
-		int total_bits, int spacing, int start_bit)
+static int bitmap_align_bits(const int id, unsigned int align,
+		int *start_bit, int *spacing)
 {
-	int bit_start, last_bit, word_index;
-
-	if (num_bits_to_alloc <= 0)
+	/* alignment should be a valid power of 2 */
+	*start_bit = bit_from_paddr(id,
+		(pmem[id].base + align - 1) & ~(align - 1));
+	if (*start_bit <= -1) {
+#if PMEM_DEBUG
+		printk(KERN_ALERT
+			"pmem: %s: bit_from_paddr fails for"
+			" %u alignment.\n", __func__, align);
+#endif
 		return -1;
+	}
+	*spacing = align / pmem[id].quantum;
+	*spacing = *spacing > 1 ? *spacing : 1;
+	return 0;
+}
 
-	for (bit_start = start_bit; ;
-		bit_start = ((last_bit +
-			(word_index << PMEM_32BIT_WORD_ORDER) + spacing - 1)
-			& ~(spacing - 1)) + start_bit) {
-		int bit_end = bit_start + num_bits_to_alloc, total_words;
-
-		if (bit_end > total_bits)
-			return -1; /* out of contiguous memory */
-
-		word_index = bit_start >> PMEM_32BIT_WORD_ORDER;
-		total_words = compute_total_words(bit_end, word_index);
-
-		if (total_words <= 0)
-			return -1;
-
-		if (total_words == 1) {
-			last_bit = fls(bitp[word_index] &
-					(start_mask(bit_start) &
-						end_mask(bit_end)));
-			if (last_bit)
-				continue;
-		} else {
-			int end_word = word_index + (total_words - 1);
-			last_bit =
-				fls(bitp[word_index] & start_mask(bit_start));
-			if (last_bit)
-				continue;
-
-			for (word_index++;
-					word_index < end_word;
-					word_index++) {
-				last_bit = fls(bitp[word_index]);
-				if (last_bit)
-					break;
-			}
-			if (last_bit)
-				continue;
+/* first suitably aligned bit at which quanta fit in [start, start + len),
+ * or -1 */
+static inline int extent_fit(int start, int len, int quanta,
+		int start_bit, int spacing)
+{
+	int bit = start_bit;
 
-			last_bit = fls(bitp[word_index] & end_mask(bit_end));
-			if (last_bit)
-				continue;
-		}
-		bitmap_bits_set_all(bitp, bit_start, bit_end);
-		return bit_start;
-	}
-	return -1;
+	if (start > start_bit)
+		bit += ALIGN(start - start_bit, spacing);
+	return bit + quanta <= start + len ? bit : -1;
 }
 
 static int reserve_quanta(const unsigned int quanta_needed,
 		const int id,
 		unsigned int align)
 {
-	/* alignment should be a valid power of 2 */
+	struct rb_node *node;
+	struct pmem_extent *ext = NULL;
 	int ret = -1, start_bit = 0, spacing = 1;
 
 	/* Sanity check */
@@ -1214,27 +1887,39 @@ static int reserve_quanta(const unsigned int quanta_needed,
 		return -1;
 	}
 
-	start_bit = bit_from_paddr(id,
-		(pmem[id].base + align - 1) & ~(align - 1));
-	if (start_bit <= -1) {
-#if PMEM_DEBUG
-		printk(KERN_ALERT
-			"pmem: %s: bit_from_paddr fails for"
-			" %u alignment.\n", __func__, align);
-#endif
+	if (bitmap_align_bits(id, align, &start_bit, &spacing))
 		return -1;
-	}
-	spacing = align / pmem[id].quantum;
-	spacing = spacing > 1 ? spacing : 1;
 
-	ret = bitmap_allocate_contiguous(pmem[id].allocator.bitmap.bitmap,
-		quanta_needed,
-		(pmem[id].size + pmem[id].quantum - 1) / pmem[id].quantum,
-		spacing,
-		start_bit);
+	/* best fit: the smallest extent that can hold the request, then
+	 * larger ones until one also satisfies the alignment */
+	node = pmem[id].allocator.bitmap.free_by_size.rb_node;
+	while (node) {
+		struct pmem_extent *e =
+			rb_entry(node, struct pmem_extent, size_node);
+
+		if (e->len >= quanta_needed) {
+			ext = e;
+			node = node->rb_left;
+		} else {
+			node = node->rb_right;
+		}
+	}
+	for (node = ext ? &ext->size_node : NULL; node; node = rb_next(node)) {
+		ext = rb_entry(node, struct pmem_extent, size_node);
+		ret = extent_fit(ext->start, ext->len, quanta_needed,
+				start_bit, spacing);
+		if (ret >= 0)
+			break;
+	}
 
+	if (ret >= 0) {
+		extent_carve(id, ext, ret, quanta_needed);
+		bitmap_bits_set_all(pmem[id].allocator.bitmap.bitmap,
+			ret, ret + quanta_needed);
+		pmem_cc_reclaim(id, ret, quanta_needed);
+	}
 #if PMEM_DEBUG
-	if (ret < 0)
+	else
 		printk(KERN_ALERT "pmem: %s: not enough contiguous bits free "
 			"in bitmap! Region memory is either too fragmented or"
 			" request is too large for available memory.\n",
@@ -1275,7 +1960,17 @@ static int pmem_allocator_bitmap(const int id,
 		return -1;
 	}
 
+	if (extent_reserve_nodes(id)) {
+#if PMEM_DEBUG
+		pr_alert("pmem: can't allocate free extents, id %d\n", id);
+#endif
+		return -1;
+	}
+
 	bitnum = reserve_quanta(quanta_needed, id, align);
+	if (bitnum == -1 && pmem[id].allocator.bitmap.compact_on_fail &&
+			pmem_compact_bitmap(id))
+		bitnum = reserve_quanta(quanta_needed, id, align);
 	if (bitnum == -1)
 		goto leave;
 
@@ -1337,12 +2032,136 @@ static int pmem_allocator_bitmap(const int id,
 	DLOG("bitnum %d, bitm_alloc index %d\n", bitnum, i);
 
 	pmem[id].allocator.bitmap.bitmap_free -= quanta_needed;
+	pmem[id].allocator.bitmap.bitmap_used++;
 	pmem[id].allocator.bitmap.bitm_alloc[i].bit = bitnum;
 	pmem[id].allocator.bitmap.bitm_alloc[i].quanta = quanta_needed;
+	pmem[id].allocator.bitmap.bitm_alloc[i].align = align;
 leave:
 	return bitnum;
 }
 
+static int pmem_is_relocatable(struct pmem_data *data)
+{
+	/* must be called with the write lock held on data->sem */
+	return data->index != -1 && !data->map_count &&
+		!(data->flags & (PMEM_FLAGS_BUSY | PMEM_FLAGS_CONNECTED |
+			PMEM_FLAGS_SUBMAP | PMEM_FLAGS_UNSUBMAP |
+			PMEM_FLAGS_PINNED));
+}
+
+static void pmem_bitmap_move(int id, int from, int to, int quanta)
+{
+	void *src = (void *)pmem[id].vbase + from * pmem[id].quantum;
+	void *dst = (void *)pmem[id].vbase + to * pmem[id].quantum;
+	unsigned long len = quanta * pmem[id].quantum;
+
+	if (pmem[id].cached) {
+		dmac_flush_range(src, src + len);
+#ifdef CONFIG_OUTER_CACHE
+		outer_flush_range(paddr_from_bit(id, from),
+			paddr_from_bit(id, from) + len);
+#endif
+	}
+	memmove(dst, src, len);
+	if (pmem[id].cached) {
+		dmac_flush_range(dst, dst + len);
+#ifdef CONFIG_OUTER_CACHE
+		outer_flush_range(paddr_from_bit(id, to),
+			paddr_from_bit(id, to) + len);
+#endif
+	}
+}
+
+/* slide one allocation down into the lowest free extent that takes it,
+ * returns 1 if it moved */
+static int pmem_bitmap_relocate(int id, struct pmem_data *data)
+{
+	/* caller should hold the lock on arena_mutex! */
+	struct rb_node *node;
+	struct pmem_extent *ext;
+	int i, old = data->index, quanta, start_bit, spacing, bit = -1;
+
+	for (i = 0; i < pmem[id].allocator.bitmap.bitmap_allocs; i++)
+		if (pmem[id].allocator.bitmap.bitm_alloc[i].bit == old)
+			break;
+	if (i >= pmem[id].allocator.bitmap.bitmap_allocs)
+		return 0;
+	quanta = pmem[id].allocator.bitmap.bitm_alloc[i].quanta;
+
+	if (bitmap_align_bits(id, pmem[id].allocator.bitmap.bitm_alloc[i].align,
+			&start_bit, &spacing))
+		return 0;
+
+	for (node = rb_first(&pmem[id].allocator.bitmap.free_by_addr); node;
+			node = rb_next(node)) {
+		int len;
+
+		ext = rb_entry(node, struct pmem_extent, addr_node);
+		if (ext->start >= old)
+			return 0;
+		/* an extent right below us grows by our own size once the
+		 * allocation is lifted out */
+		len = ext->len;
+		if (ext->start + len == old)
+			len += quanta;
+		bit = extent_fit(ext->start, len, quanta, start_bit, spacing);
+		if (bit >= 0 && bit < old)
+			break;
+	}
+	if (!node)
+		return 0;
+
+	bitmap_bits_clear_all(pmem[id].allocator.bitmap.bitmap,
+		old, old + quanta);
+	extent_release(id, old, quanta);
+	extent_carve(id, extent_lookup(id, bit), bit, quanta);
+	bitmap_bits_set_all(pmem[id].allocator.bitmap.bitmap,
+		bit, bit + quanta);
+	pmem_cc_reclaim(id, bit, quanta);
+
+	pmem_bitmap_move(id, old, bit, quanta);
+	pmem_cc_lend(id, old, quanta);
+
+	pmem[id].allocator.bitmap.bitm_alloc[i].bit = bit;
+	data->index = bit;
+
+	pmem[id].allocator.bitmap.compact_moves++;
+	pmem[id].allocator.bitmap.compact_quanta += quanta;
+	DLOG("moved %d quanta from bit %d to %d\n", quanta, old, bit);
+	return 1;
+}
+
+static int pmem_compact_bitmap(int id)
+{
+	/* caller should hold the lock on arena_mutex!
+	 *
+	 * That inverts the usual lock order, so everything else is only
+	 * trylocked and whatever is busy right now simply stays put. */
+	struct pmem_data *data;
+	int pass, moved, total = 0;
+
+	if (!mutex_trylock(&pmem[id].data_list_mutex))
+		return 0;
+
+	pmem[id].allocator.bitmap.compact_runs++;
+	for (pass = 0; pass < PMEM_COMPACT_MAX_PASSES; pass++) {
+		moved = 0;
+		list_for_each_entry(data, &pmem[id].data_list, list) {
+			if (!down_write_trylock(&data->sem))
+				continue;
+			if (pmem_is_relocatable(data))
+				moved += pmem_bitmap_relocate(id, data);
+			up_write(&data->sem);
+		}
+		total += moved;
+		if (!moved)
+			break;
+	}
+
+	mutex_unlock(&pmem[id].data_list_mutex);
+	return total;
+}
+
 static int pmem_allocator_system(const int id,
 		const unsigned long len,
 		const unsigned int align)
@@ -1572,11 +2391,12 @@ static void pmem_vma_open(struct vm_area_struct *vma)
 		current->parent->pid, file, file_count(file));
 	/* this should never be called as we don't support copying pmem
 	 * ranges via fork */
-	down_read(&data->sem);
+	down_write(&data->sem);
 	BUG_ON(!has_allocation(file));
+	data->map_count++;
 	/* remap the garbage pages, forkers don't get access to the data */
 	pmem_unmap_pfn_range(id, vma, data, 0, vma->vm_start - vma->vm_end);
-	up_read(&data->sem);
+	up_write(&data->sem);
 }
 
 static void pmem_vma_close(struct vm_area_struct *vma)
@@ -1607,6 +2427,7 @@ static void pmem_vma_close(struct vm_area_struct *vma)
 		       "exist!\n");
 		return;
 	}
+	data->map_count--;
 	if (data->vma == vma) {
 		data->vma = NULL;
 		if ((data->flags & PMEM_FLAGS_CONNECTED) &&
@@ -1731,6 +2552,7 @@ static int pmem_mmap(struct file *file, struct vm_area_struct *vma)
 		data->pid = current->pid;
 	}
 	vma->vm_ops = &vm_ops;
+	data->map_count++;
 error:
 	up_write(&data->sem);
 	return ret;
@@ -1779,7 +2601,7 @@ int get_pmem_addr(struct file *file, unsigned long *start,
 	if (is_pmem_file(file)) {
 		struct pmem_data *data = file->private_data;
 
-		down_read(&data->sem);
+		down_write(&data->sem);
 		if (has_allocation(file)) {
 			int id = get_id(file);
 
@@ -1787,18 +2609,17 @@ int get_pmem_addr(struct file *file, unsigned long *start,
 			*len = pmem[id].len(id, data);
 			*vstart = (unsigned long)
 				pmem_start_vaddr(id, data);
-			up_read(&data->sem);
+			data->flags |= PMEM_FLAGS_PINNED;
 #if PMEM_DEBUG
-			down_write(&data->sem);
 			data->ref++;
-			up_write(&data->sem);
 #endif
+			up_write(&data->sem);
 			DLOG("returning start %#lx len %lu "
 				"vstart %#lx\n",
 				*start, *len, *vstart);
 			ret = 0;
 		} else {
-			up_read(&data->sem);
+			up_write(&data->sem);
 		}
 	}
 	return ret;
@@ -1971,23 +2792,33 @@ end:
 	up_read(&data->sem);
 }
 
-int pmem_cache_maint(struct file *file, unsigned int cmd,
-		struct pmem_addr *pmem_addr)
+int pmem_cache_maint_ranges(struct file *file, unsigned int cmd,
+		const struct pmem_addr *addrs, unsigned int nr,
+		unsigned long *time_us)
 {
+	struct msm_cache_range *ranges;
 	struct pmem_data *data;
-	int id;
-	unsigned long vaddr, paddr, length, offset,
-		      pmem_len, pmem_start_addr;
+	int id, i, ret = 0;
+	unsigned int op;
+	unsigned long pmem_len, pmem_start_addr;
+
+	if (time_us)
+		*time_us = 0;
 
 	/* Called from kernel-space so file may be NULL */
 	if (!file)
 		return -EBADF;
 
-	/*
-	 * check that the vaddr passed for flushing is valid
-	 * so that you don't crash the kernel
-	 */
-	if (!pmem_addr->vaddr)
+	if (!nr || nr > PMEM_MAX_CACHE_RANGES)
+		return -EINVAL;
+
+	if (cmd == PMEM_CLEAN_INV_CACHES)
+		op = MSM_CACHE_OP_FLUSH;
+	else if (cmd == PMEM_CLEAN_CACHES)
+		op = MSM_CACHE_OP_CLEAN;
+	else if (cmd == PMEM_INV_CACHES)
+		op = MSM_CACHE_OP_INV;
+	else
 		return -EINVAL;
 
 	data = file->private_data;
@@ -1996,9 +2827,6 @@ int pmem_cache_maint(struct file *file, unsigned int cmd,
 	if (!pmem[id].cached)
 		return 0;
 
-	offset = pmem_addr->offset;
-	length = pmem_addr->length;
-
 	down_read(&data->sem);
 	if (!has_allocation(file)) {
 		up_read(&data->sem);
@@ -2008,24 +2836,47 @@ int pmem_cache_maint(struct file *file, unsigned int cmd,
 	pmem_start_addr = pmem[id].start_addr(id, data);
 	up_read(&data->sem);
 
-	if (offset + length > pmem_len)
-		return -EINVAL;
+	ranges = kmalloc(nr * sizeof(*ranges), GFP_KERNEL);
+	if (!ranges)
+		return -ENOMEM;
 
-	vaddr = pmem_addr->vaddr;
-	paddr = pmem_start_addr + offset;
+	for (i = 0; i < nr; i++) {
+		unsigned long end = addrs[i].offset + addrs[i].length;
 
-	DLOG("pmem cache maint on dev %s(id: %d)"
-		"(vaddr %lx paddr %lx len %lu bytes)\n",
-		get_name(file), id, vaddr, paddr, length);
-	if (cmd == PMEM_CLEAN_INV_CACHES)
-		clean_and_invalidate_caches(vaddr,
-				length, paddr);
-	else if (cmd == PMEM_CLEAN_CACHES)
-		clean_caches(vaddr, length, paddr);
-	else if (cmd == PMEM_INV_CACHES)
-		invalidate_caches(vaddr, length, paddr);
+		/*
+		 * check that the vaddr passed for flushing is valid
+		 * so that you don't crash the kernel
+		 */
+		if (!addrs[i].vaddr || end < addrs[i].offset ||
+				end > pmem_len) {
+			ret = -EINVAL;
+			goto out;
+		}
+		ranges[i].vstart = addrs[i].vaddr;
+		ranges[i].pstart = pmem_start_addr + addrs[i].offset;
+		ranges[i].length = addrs[i].length;
 
-	return 0;
+		DLOG("pmem cache maint on dev %s(id: %d)"
+			"(vaddr %lx paddr %lx len %lu bytes)\n",
+			get_name(file), id, ranges[i].vstart,
+			ranges[i].pstart, ranges[i].length);
+	}
+
+	if (time_us)
+		*time_us = div_u64(msm_cache_maint_ranges(op, ranges, nr),
+				NSEC_PER_USEC);
+	else
+		msm_cache_maint_ranges(op, ranges, nr);
+out:
+	kfree(ranges);
+	return ret;
+}
+EXPORT_SYMBOL(pmem_cache_maint_ranges);
+
+int pmem_cache_maint(struct file *file, unsigned int cmd,
+		struct pmem_addr *pmem_addr)
+{
+	return pmem_cache_maint_ranges(file, cmd, pmem_addr, 1, NULL);
 }
 EXPORT_SYMBOL(pmem_cache_maint);
 
@@ -2071,10 +2922,10 @@ static int pmem_connect(unsigned long connect, struct file *file)
 			goto put_src_file;
 		}
 
-		down_read(&src_data->sem);
+		down_write(&src_data->sem);
 
 		if (unlikely(!has_allocation(src_file))) {
-			up_read(&src_data->sem);
+			up_write(&src_data->sem);
 			pr_err("pmem: %s: src file has no allocation!\n",
 				__func__);
 			ret = -EINVAL;
@@ -2082,7 +2933,9 @@ static int pmem_connect(unsigned long connect, struct file *file)
 			struct pmem_data *data;
 			int src_index = src_data->index;
 
-			up_read(&src_data->sem);
+			/* connected files share the index, keep it put */
+			src_data->flags |= PMEM_FLAGS_PINNED;
+			up_write(&src_data->sem);
 
 			data = file->private_data;
 			if (!data) {
@@ -2339,15 +3192,16 @@ static void pmem_get_size(struct pmem_region *region, struct file *file)
 	struct pmem_data *data = file->private_data;
 	int id = get_id(file);
 
-	down_read(&data->sem);
+	down_write(&data->sem);
 	if (!has_allocation(file)) {
 		region->offset = 0;
 		region->len = 0;
 	} else {
 		region->offset = pmem[id].start_addr(id, data);
 		region->len = pmem[id].len(id, data);
+		data->flags |= PMEM_FLAGS_PINNED;
 	}
-	up_read(&data->sem);
+	up_write(&data->sem);
 	DLOG("offset 0x%lx len 0x%lx\n", region->offset, region->len);
 }
 
@@ -2374,15 +3228,16 @@ static long pmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			struct pmem_region region;
 
 			DLOG("get_phys\n");
-			down_read(&data->sem);
+			down_write(&data->sem);
 			if (!has_allocation(file)) {
 				region.offset = 0;
 				region.len = 0;
 			} else {
 				region.offset = pmem[id].start_addr(id, data);
 				region.len = pmem[id].len(id, data);
+				data->flags |= PMEM_FLAGS_PINNED;
 			}
-			up_read(&data->sem);
+			up_write(&data->sem);
 
 			if (copy_to_user((void __user *)arg, &region,
 						sizeof(struct pmem_region)))
@@ -2540,6 +3395,38 @@ static long pmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 
 			return pmem_cache_maint(file, cmd, &pmem_addr);
 		}
+	case PMEM_CACHE_MAINT_RANGES:
+		{
+			struct pmem_cache_ranges req;
+			struct pmem_addr *addrs;
+			int ret;
+
+			if (copy_from_user(&req, (void __user *)arg,
+						sizeof(req)))
+				return -EFAULT;
+			if (!req.nr || req.nr > PMEM_MAX_CACHE_RANGES)
+				return -EINVAL;
+
+			addrs = kmalloc(req.nr * sizeof(*addrs), GFP_KERNEL);
+			if (!addrs)
+				return -ENOMEM;
+			if (copy_from_user(addrs, (void __user *)req.ranges,
+						req.nr * sizeof(*addrs))) {
+				kfree(addrs);
+				return -EFAULT;
+			}
+
+			ret = pmem_cache_maint_ranges(file, req.cmd, addrs,
+					req.nr, &req.time_us);
+			kfree(addrs);
+			if (ret)
+				return ret;
+
+			if (copy_to_user((void __user *)arg, &req,
+						sizeof(req)))
+				return -EFAULT;
+			break;
+		}
 	default:
 		if (pmem[id].ioctl)
 			return pmem[id].ioctl(file, cmd, arg);
@@ -2733,6 +3620,21 @@ int pmem_setup(struct android_pmem_platform_data *pdata,
 			goto err_cant_register_device;
 		}
 		pmem[id].allocator.bitmap.bitmap_free = pmem[id].num_entries;
+		pmem[id].allocator.bitmap.bitmap_used = 0;
+
+		/* the whole region starts out as a single free extent */
+		pmem[id].allocator.bitmap.free_by_size = RB_ROOT;
+		pmem[id].allocator.bitmap.free_by_addr = RB_ROOT;
+		INIT_LIST_HEAD(&pmem[id].allocator.bitmap.extent_pool);
+		pmem[id].allocator.bitmap.extent_nodes = 0;
+		if (extent_reserve_nodes(id)) {
+			pr_alert("pmem: %s: Unable to register pmem "
+				"driver - can't allocate free extents!\n",
+				__func__);
+			goto err_cant_register_device;
+		}
+		if (pmem[id].num_entries)
+			extent_release(id, 0, pmem[id].num_entries);
 
 		pmem[id].allocate = pmem_allocator_bitmap;
 		pmem[id].free = pmem_free_bitmap;
@@ -2844,6 +3746,9 @@ int pmem_setup(struct android_pmem_platform_data *pdata,
 	if (pdata->release_region)
 		pmem[id].mem_release = pdata->release_region;
 
+	if (pdata->cleancache)
+		pmem_cc_setup(id);
+
 	return 0;
 
 cleanup_vm:
@@ -2860,6 +3765,7 @@ out_put_kobj:
 	else if (pmem[id].allocator_type == PMEM_ALLOCATORTYPE_BITMAP) {
 		kfree(pmem[id].allocator.bitmap.bitmap);
 		kfree(pmem[id].allocator.bitmap.bitm_alloc);
+		extent_free_all(id);
 	}
 err_reset_pmem_info:
 	pmem[id].allocate = 0;
@@ -2901,6 +3807,7 @@ static int pmem_remove(struct platform_device *pdev)
 	else if (pmem[id].allocator_type == PMEM_ALLOCATORTYPE_BITMAP) {
 		kfree(pmem[id].allocator.bitmap.bitmap);
 		kfree(pmem[id].allocator.bitmap.bitm_alloc);
+		extent_free_all(id);
 	}
 	misc_deregister(&pmem[id].dev);
 	return 0;
@@ -44,6 +44,7 @@
 #include <linux/regulator/consumer.h>
 #include <linux/slab.h>
 #include <linux/pm_qos_params.h>
+#include <linux/math64.h>
 
 #include <asm/cacheflush.h>
 #include <asm/div64.h>
@@ -191,6 +192,7 @@ static inline void msmsdcc_delay(struct msmsdcc_host *host);
 static void msmsdcc_dump_sdcc_state(struct msmsdcc_host *host);
 static int msmsdcc_vreg_reset(struct msmsdcc_host *host);
 static void msmsdcc_sg_start(struct msmsdcc_host *host);
+static void msmsdcc_clk_gate_adapt(struct msmsdcc_host *host);
 
 static inline unsigned short msmsdcc_get_nr_sg(struct msmsdcc_host *host)
 {
@@ -381,6 +383,30 @@ static void msmsdcc_reset_and_restore(struct msmsdcc_host *host)
 		host->dummy_52_needed = 0;
 }
 
+static void
+msmsdcc_stats_req_done(struct msmsdcc_host *host, struct mmc_request *mrq)
+{
+	struct msmsdcc_stats *stats = &host->stats;
+	unsigned int us = ktime_us_delta(ktime_get(), stats->start);
+
+	stats->reqs++;
+	stats->total_us += us;
+	if (us > stats->max_us)
+		stats->max_us = us;
+	if (mrq->data) {
+		stats->data_reqs++;
+		stats->data_us += us;
+		stats->bytes += mrq->data->bytes_xfered;
+	}
+	if (mrq->data && host->curr.pio) {
+		stats->pio_reqs++;
+		stats->pio_us += us;
+		stats->pio_bytes += mrq->data->bytes_xfered;
+		if (host->curr.pio_polled)
+			stats->pio_polled++;
+	}
+}
+
 static int
 msmsdcc_request_end(struct msmsdcc_host *host, struct mmc_request *mrq)
 {
@@ -395,6 +421,9 @@ msmsdcc_request_end(struct msmsdcc_host *host, struct mmc_request *mrq)
 	if (mrq->cmd->error == -ETIMEDOUT)
 		mdelay(5);
 
+	msmsdcc_stats_req_done(host, mrq);
+	host->clk_gate.last_end = ktime_get();
+
 	/* Clear current request information as current request has ended */
 	memset(&host->curr, 0, sizeof(struct msmsdcc_curr_req));
 
@@ -526,8 +555,10 @@ msmsdcc_dma_complete_tlet(unsigned long data)
 		if (!mrq->data->error)
 			mrq->data->error = -EIO;
 	}
-	dma_unmap_sg(mmc_dev(host->mmc), host->dma.sg, host->dma.num_ents,
-		     host->dma.dir);
+	/* Buffers mapped by msmsdcc_pre_req() are unmapped in post_req */
+	if (!mrq->data->host_cookie)
+		dma_unmap_sg(mmc_dev(host->mmc), host->dma.sg,
+			     host->dma.num_ents, host->dma.dir);
 
 	if (host->curr.user_pages) {
 		struct scatterlist *sg = host->dma.sg;
@@ -564,6 +595,8 @@ msmsdcc_dma_complete_tlet(unsigned long data)
 			(mrq->sbc && !mrq->data->error)) {
 			mrq->data->bytes_xfered = host->curr.data_xfered;
 			del_timer(&host->req_tout_timer);
+			msmsdcc_stats_req_done(host, mrq);
+			host->clk_gate.last_end = ktime_get();
 			/*
 			 * Clear current request information as current
 			 * request has ended
@@ -693,8 +726,9 @@ static void msmsdcc_sps_complete_tlet(unsigned long data)
 	}
 
 	/* Unmap sg buffers */
-	dma_unmap_sg(mmc_dev(host->mmc), host->sps.sg, host->sps.num_ents,
-			 host->sps.dir);
+	if (!mrq->data->host_cookie)
+		dma_unmap_sg(mmc_dev(host->mmc), host->sps.sg,
+			     host->sps.num_ents, host->sps.dir);
 
 	host->sps.sg = NULL;
 	host->sps.busy = 0;
@@ -724,6 +758,8 @@ static void msmsdcc_sps_complete_tlet(unsigned long data)
 			(mrq->sbc && !mrq->data->error)) {
 			mrq->data->bytes_xfered = host->curr.data_xfered;
 			del_timer(&host->req_tout_timer);
+			msmsdcc_stats_req_done(host, mrq);
+			host->clk_gate.last_end = ktime_get();
 			/*
 			 * Clear current request information as current
 			 * request has ended
@@ -764,8 +800,9 @@ static void msmsdcc_sps_exit_curr_xfer(struct msmsdcc_host *host)
 		mrq->data->error = -EIO;
 
 	/* Unmap sg buffers */
-	dma_unmap_sg(mmc_dev(host->mmc), host->sps.sg, host->sps.num_ents,
-			 host->sps.dir);
+	if (!mrq->data->host_cookie)
+		dma_unmap_sg(mmc_dev(host->mmc), host->sps.sg,
+			     host->sps.num_ents, host->sps.dir);
 
 	host->sps.sg = NULL;
 	host->sps.busy = 0;
@@ -804,67 +841,48 @@ msmsdcc_dma_complete_func(struct msm_dmov_cmd *cmd,
 	tasklet_schedule(&host->dma_tlet);
 }
 
-static int msmsdcc_check_dma_op_req(struct mmc_data *data)
+/*
+ * Data mover setup and completion cost more than moving a few FIFOs
+ * worth of data by hand, so small transfers are left to PIO.
+ */
+static int msmsdcc_check_dma_op_req(struct msmsdcc_host *host,
+				    struct mmc_data *data)
 {
-	if (((data->blksz * data->blocks) < MCI_FIFOSIZE) ||
+	if (((data->blksz * data->blocks) < host->dma_threshold) ||
 	     ((data->blksz * data->blocks) % MCI_FIFOSIZE))
 		return -EINVAL;
 	else
 		return 0;
 }
 
-static int msmsdcc_config_dma(struct msmsdcc_host *host, struct mmc_data *data)
+static inline enum dma_data_direction msmsdcc_get_dma_dir(struct mmc_data *data)
+{
+	if (data->flags & MMC_DATA_READ)
+		return DMA_FROM_DEVICE;
+	else
+		return DMA_TO_DEVICE;
+}
+
+/* Build the data mover box command list for already mapped buffers */
+static int msmsdcc_build_dma_cmds(struct msmsdcc_host *host,
+				  struct mmc_data *data)
 {
-	struct msmsdcc_nc_dmadata *nc;
+	struct msmsdcc_nc_dmadata *nc = host->dma.nc;
 	dmov_box *box;
 	uint32_t rows;
-	unsigned int n;
-	int i, err = 0, box_cmd_cnt = 0;
+	int i, box_cmd_cnt = 0;
 	struct scatterlist *sg = data->sg;
 	unsigned int len, offset;
 
-	if ((host->dma.channel == -1) || (host->dma.crci == -1))
-		return -ENOENT;
-
-	BUG_ON((host->pdev_id < 1) || (host->pdev_id > 5));
-
-	host->dma.sg = data->sg;
-	host->dma.num_ents = data->sg_len;
-
-	/* Prevent memory corruption */
-	BUG_ON(host->dma.num_ents > msmsdcc_get_nr_sg(host));
-
-	nc = host->dma.nc;
-
-	if (data->flags & MMC_DATA_READ)
-		host->dma.dir = DMA_FROM_DEVICE;
-	else
-		host->dma.dir = DMA_TO_DEVICE;
-
-	n = dma_map_sg(mmc_dev(host->mmc), host->dma.sg,
-			host->dma.num_ents, host->dma.dir);
-
-	if (n != host->dma.num_ents) {
-		pr_err("%s: Unable to map in all sg elements\n",
-		       mmc_hostname(host->mmc));
-		host->dma.sg = NULL;
-		host->dma.num_ents = 0;
-		return -ENOMEM;
-	}
-
-	/* host->curr.user_pages = (data->flags & MMC_DATA_USERPAGE); */
-	host->curr.user_pages = 0;
 	box = &nc->cmd[0];
-	for (i = 0; i < host->dma.num_ents; i++) {
+	for (i = 0; i < data->sg_len; i++) {
 		len = sg_dma_len(sg);
 		offset = 0;
 
 		do {
 			/* Check if we can do DMA */
-			if (!len || (box_cmd_cnt >= MMC_MAX_DMA_CMDS)) {
-				err = -ENOTSUPP;
-				goto unmap;
-			}
+			if (!len || (box_cmd_cnt >= MMC_MAX_DMA_CMDS))
+				return -ENOTSUPP;
 
 			box->cmd = CMD_MODE_BOX;
 
@@ -909,6 +927,52 @@ static int msmsdcc_config_dma(struct msmsdcc_host *host, struct mmc_data *data)
 	BUG_ON(host->dma.cmd_busaddr & 0x07);
 
 	nc->cmdptr = (host->dma.cmd_busaddr >> 3) | CMD_PTR_LP;
+
+	return 0;
+}
+
+static int msmsdcc_config_dma(struct msmsdcc_host *host, struct mmc_data *data)
+{
+	unsigned int n;
+	int err = 0;
+
+	if ((host->dma.channel == -1) || (host->dma.crci == -1))
+		return -ENOENT;
+
+	BUG_ON((host->pdev_id < 1) || (host->pdev_id > 5));
+
+	host->dma.sg = data->sg;
+	host->dma.num_ents = data->sg_len;
+
+	/* Prevent memory corruption */
+	BUG_ON(host->dma.num_ents > msmsdcc_get_nr_sg(host));
+
+	host->dma.dir = msmsdcc_get_dma_dir(data);
+
+	/* The buffers may already have been mapped by msmsdcc_pre_req() */
+	if (!data->host_cookie) {
+		n = dma_map_sg(mmc_dev(host->mmc), host->dma.sg,
+				host->dma.num_ents, host->dma.dir);
+
+		if (n != host->dma.num_ents) {
+			pr_err("%s: Unable to map in all sg elements\n",
+			       mmc_hostname(host->mmc));
+			host->dma.sg = NULL;
+			host->dma.num_ents = 0;
+			return -ENOMEM;
+		}
+	}
+
+	/* host->curr.user_pages = (data->flags & MMC_DATA_USERPAGE); */
+	host->curr.user_pages = 0;
+
+	/* ...and the command list built as well */
+	if (host->dma.prepared != data)
+		err = msmsdcc_build_dma_cmds(host, data);
+	host->dma.prepared = NULL;
+	if (err)
+		goto unmap;
+
 	host->dma.hdr.cmdptr = DMOV_CMD_PTR_LIST |
 			       DMOV_CMD_ADDR(host->dma.cmdptr_busaddr);
 	host->dma.hdr.complete_func = msmsdcc_dma_complete_func;
@@ -918,8 +982,9 @@ static int msmsdcc_config_dma(struct msmsdcc_host *host, struct mmc_data *data)
 
 unmap:
 	if (err) {
-		dma_unmap_sg(mmc_dev(host->mmc), host->dma.sg,
-				host->dma.num_ents, host->dma.dir);
+		if (!data->host_cookie)
+			dma_unmap_sg(mmc_dev(host->mmc), host->dma.sg,
+					host->dma.num_ents, host->dma.dir);
 		pr_err("%s: cannot do DMA, fall back to PIO mode err=%d\n",
 				mmc_hostname(host->mmc), err);
 	}
@@ -927,6 +992,18 @@ unmap:
 	return err;
 }
 
+/* Undo the mapping made by msmsdcc_pre_req() */
+static void msmsdcc_unprep_xfer(struct msmsdcc_host *host,
+				struct mmc_data *data)
+{
+	if (!data->host_cookie)
+		return;
+
+	dma_unmap_sg(mmc_dev(host->mmc), data->sg, data->sg_len,
+		     msmsdcc_get_dma_dir(data));
+	data->host_cookie = 0;
+}
+
 #ifdef CONFIG_MMC_MSM_SPS_SUPPORT
 /**
  * Submits data transfer request to SPS driver
@@ -964,9 +1041,12 @@ static int msmsdcc_sps_start_xfer(struct msmsdcc_host *host,
 		sps_pipe_handle = host->sps.cons.pipe_handle;
 	}
 
-	/* Make sg buffers DMA ready */
-	rc = dma_map_sg(mmc_dev(host->mmc), data->sg, data->sg_len,
-			host->sps.dir);
+	/* Make sg buffers DMA ready, unless msmsdcc_pre_req() did */
+	if (data->host_cookie)
+		rc = data->sg_len;
+	else
+		rc = dma_map_sg(mmc_dev(host->mmc), data->sg, data->sg_len,
+				host->sps.dir);
 
 	if (rc != data->sg_len) {
 		pr_err("%s: Unable to map in all sg elements, rc=%d\n",
@@ -1018,8 +1098,9 @@ static int msmsdcc_sps_start_xfer(struct msmsdcc_host *host,
 
 dma_map_err:
 	/* unmap sg buffers */
-	dma_unmap_sg(mmc_dev(host->mmc), host->sps.sg, host->sps.num_ents,
-			host->sps.dir);
+	if (!data->host_cookie)
+		dma_unmap_sg(mmc_dev(host->mmc), host->sps.sg,
+			     host->sps.num_ents, host->sps.dir);
 out:
 	return rc;
 }
@@ -1117,7 +1198,7 @@ msmsdcc_start_data(struct msmsdcc_host *host, struct mmc_data *data,
 	if (host->curr.wait_for_auto_prog_done)
 		datactrl |= MCI_AUTO_PROG_DONE;
 
-	if (!msmsdcc_check_dma_op_req(data)) {
+	if (!msmsdcc_check_dma_op_req(host, data)) {
 		if (host->is_dma_mode && !msmsdcc_config_dma(host, data)) {
 			datactrl |= MCI_DPSM_DMAENABLE;
 		} else if (host->is_sps_mode) {
@@ -1146,10 +1227,22 @@ msmsdcc_start_data(struct msmsdcc_host *host, struct mmc_data *data,
 
 	/* Is data transfer in PIO mode required? */
 	if (!(datactrl & MCI_DPSM_DMAENABLE)) {
+		/* The CPU is going to touch the buffers */
+		msmsdcc_unprep_xfer(host, data);
+		host->curr.pio = 1;
+
 		if (data->flags & MMC_DATA_READ) {
-			pio_irqmask = MCI_RXFIFOHALFFULLMASK;
-			if (host->curr.xfer_remain < MCI_FIFOSIZE)
-				pio_irqmask |= MCI_RXDATAAVLBLMASK;
+			/*
+			 * A read that fits the FIFO needs no PIO irqs: it
+			 * is drained in one go once DATAEND is seen.
+			 */
+			if (host->curr.xfer_size <= MCI_FIFOSIZE) {
+				host->curr.pio_polled = 1;
+			} else {
+				pio_irqmask = MCI_RXFIFOHALFFULLMASK;
+				if (host->curr.xfer_remain < MCI_FIFOSIZE)
+					pio_irqmask |= MCI_RXDATAAVLBLMASK;
+			}
 		} else
 			pio_irqmask = MCI_TXFIFOHALFEMPTYMASK |
 					MCI_TXFIFOEMPTYMASK;
@@ -1272,17 +1365,27 @@ msmsdcc_pio_read(struct msmsdcc_host *host, char *buffer, unsigned int remain)
 	void __iomem	*base = host->base;
 	uint32_t	*ptr = (uint32_t *) buffer;
 	int		count = 0;
+	uint32_t	status;
 
 	if (remain % 4)
 		remain = ((remain >> 2) + 1) << 2;
 
-	while (readl_relaxed(base + MMCISTATUS) & MCI_RXDATAAVLBL) {
+	while ((status = readl_relaxed(base + MMCISTATUS)) & MCI_RXDATAAVLBL) {
 
-		*ptr = readl_relaxed(base + MMCIFIFO + (count % MCI_FIFOSIZE));
-		ptr++;
-		count += sizeof(uint32_t);
-
-		remain -=  sizeof(uint32_t);
+		/* Half the FIFO is known to be there, no need to poll */
+		if ((status & MCI_RXFIFOHALFFULL) &&
+		    remain >= MCI_FIFOHALFSIZE) {
+			readsl(base + MMCIFIFO, ptr, MCI_FIFOHALFSIZE >> 2);
+			ptr += MCI_FIFOHALFSIZE >> 2;
+			count += MCI_FIFOHALFSIZE;
+			remain -= MCI_FIFOHALFSIZE;
+		} else {
+			*ptr = readl_relaxed(base + MMCIFIFO +
+					     (count % MCI_FIFOSIZE));
+			ptr++;
+			count += sizeof(uint32_t);
+			remain -=  sizeof(uint32_t);
+		}
 		if (remain == 0)
 			break;
 	}
@@ -1468,7 +1571,10 @@ msmsdcc_pio_irq(int irq, void *dev_id)
 
 	status = readl_relaxed(base + MMCISTATUS);
 
-	if (((readl_relaxed(host->base + MMCIMASK0) & status) &
+	/* Polled reads keep the PIO irqs masked */
+	if (!(host->curr.pio_polled && host->curr.data &&
+	      (status & MCI_RXDATAAVLBL)) &&
+	    ((readl_relaxed(host->base + MMCIMASK0) & status) &
 				(MCI_IRQ_PIO)) == 0) {
 		spin_unlock(&host->lock);
 		return IRQ_NONE;
@@ -1520,6 +1626,12 @@ msmsdcc_pio_irq(int irq, void *dev_id)
 	msmsdcc_sg_stop(host);
 	local_irq_restore(flags);
 
+	/* Polled reads never unmask the PIO irqs */
+	if (host->curr.pio_polled) {
+		spin_unlock(&host->lock);
+		return IRQ_HANDLED;
+	}
+
 	if (status & MCI_RXACTIVE && host->curr.xfer_remain < MCI_FIFOSIZE) {
 		writel_relaxed((readl_relaxed(host->base + MMCIMASK0) &
 				(~(MCI_IRQ_PIO))) | MCI_RXDATAAVLBLMASK,
@@ -1586,6 +1698,15 @@ static void msmsdcc_do_cmdirq(struct msmsdcc_host *host, uint32_t status)
 	struct mmc_command *cmd = host->curr.cmd;
 
 	host->curr.cmd = NULL;
+	if (host->clk_gate.ttfb_pending) {
+		unsigned int us = ktime_us_delta(ktime_get(),
+						 host->clk_gate.ungate_time);
+
+		host->clk_gate.ttfb_pending = 0;
+		host->stats.ttfb_us += us;
+		if (us > host->stats.ttfb_max_us)
+			host->stats.ttfb_max_us = us;
+	}
 	cmd->resp[0] = readl_relaxed(host->base + MMCIRESPONSE0);
 	cmd->resp[1] = readl_relaxed(host->base + MMCIRESPONSE1);
 	cmd->resp[2] = readl_relaxed(host->base + MMCIRESPONSE2);
@@ -1893,6 +2014,7 @@ msmsdcc_request(struct mmc_host *mmc, struct mmc_request *mrq)
 	}
 
 	spin_lock_irqsave(&host->lock, flags);
+	msmsdcc_clk_gate_adapt(host);
 	WARN(host->curr.mrq, "Request in progress\n");
 	WARN(!host->pwr, "SDCC power is turned off\n");
 	WARN(!host->clks_on, "SDCC clocks are turned off\n");
@@ -1919,6 +2041,7 @@ msmsdcc_request(struct mmc_host *mmc, struct mmc_request *mrq)
 			(jiffies + msecs_to_jiffies(MSM_MMC_REQ_TIMEOUT)));
 
 	host->curr.mrq = mrq;
+	host->stats.start = ktime_get();
 	if (mrq->data && (mrq->data->flags & MMC_DATA_WRITE)) {
 		if (mrq->cmd->opcode == SD_IO_RW_EXTENDED ||
 			mrq->cmd->opcode == 54) {
@@ -1955,6 +2078,67 @@ msmsdcc_request(struct mmc_host *mmc, struct mmc_request *mrq)
 	spin_unlock_irqrestore(&host->lock, flags);
 }
 
+/*
+ * Map the buffers of a data request before it is issued, and if the data
+ * mover is idle build its command list too, so that msmsdcc_request()
+ * only has to kick off the transfer.
+ */
+static void
+msmsdcc_pre_req(struct mmc_host *mmc, struct mmc_request *mrq,
+		bool is_first_req)
+{
+	struct msmsdcc_host *host = mmc_priv(mmc);
+	struct mmc_data *data = mrq->data;
+	unsigned long flags;
+	int n;
+
+	if (!data)
+		return;
+
+	data->host_cookie = 0;
+
+	if (!host->is_dma_mode && !host->is_sps_mode)
+		return;
+	if (msmsdcc_check_dma_op_req(host, data) ||
+	    data->sg_len > msmsdcc_get_nr_sg(host))
+		return;
+	if (host->is_dma_mode &&
+	    ((host->dma.channel == -1) || (host->dma.crci == -1)))
+		return;
+
+	n = dma_map_sg(mmc_dev(mmc), data->sg, data->sg_len,
+		       msmsdcc_get_dma_dir(data));
+	if (n != data->sg_len)
+		return;
+	data->host_cookie = MSMSDCC_COOKIE_MAPPED;
+
+	spin_lock_irqsave(&host->lock, flags);
+	host->stats.prepared++;
+	if (is_first_req && host->is_dma_mode && !host->dma.busy &&
+	    !host->curr.mrq && !msmsdcc_build_dma_cmds(host, data))
+		host->dma.prepared = data;
+	spin_unlock_irqrestore(&host->lock, flags);
+}
+
+static void
+msmsdcc_post_req(struct mmc_host *mmc, struct mmc_request *mrq, int err)
+{
+	struct msmsdcc_host *host = mmc_priv(mmc);
+	struct mmc_data *data = mrq->data;
+	unsigned long flags;
+
+	if (!data)
+		return;
+
+	/* The request may have ended before its data phase was started */
+	spin_lock_irqsave(&host->lock, flags);
+	if (host->dma.prepared == data)
+		host->dma.prepared = NULL;
+	spin_unlock_irqrestore(&host->lock, flags);
+
+	msmsdcc_unprep_xfer(host, data);
+}
+
 static inline int msmsdcc_vreg_set_voltage(struct msm_mmc_reg_data *vreg,
 					int min_uV, int max_uV)
 {
@@ -2560,6 +2744,56 @@ out:
 	return;
 }
 
+/* The core gates the clocks once the host has been idle this long */
+static void msmsdcc_clk_gate_set_delay(struct msmsdcc_host *host,
+				       unsigned int us)
+{
+	struct mmc_host *mmc = host->mmc;
+	unsigned long flags;
+
+	spin_lock_irqsave(&mmc->clk_lock, flags);
+	mmc->clkgate_delay = DIV_ROUND_UP(us, USEC_PER_MSEC);
+	spin_unlock_irqrestore(&mmc->clk_lock, flags);
+}
+
+/* Called with host->lock held when a request starts */
+static void msmsdcc_clk_gate_adapt(struct msmsdcc_host *host)
+{
+	struct msmsdcc_clk_gate *gate = &host->clk_gate;
+	s64 gap_us;
+
+	if (!gate->max_ms)
+		return;
+
+	/*
+	 * Gaps longer than the longest delay are idle periods. The
+	 * others are gaps within a burst or a stream, and the delay
+	 * follows twice their average so that the core doesn't gate in
+	 * the middle of one: short for bursty SDIO, longer for streaming.
+	 */
+	gap_us = ktime_us_delta(ktime_get(), gate->last_end);
+	if (gap_us < 0 || gap_us >= gate->max_ms * USEC_PER_MSEC)
+		return;
+
+	gate->avg_gap_us = (gate->avg_gap_us * 7 + (u32)gap_us) / 8;
+	msmsdcc_clk_gate_set_delay(host,
+				   clamp_t(unsigned int, 2 * gate->avg_gap_us,
+					   MSMSDCC_CLK_GATE_MIN_US,
+					   gate->max_ms * USEC_PER_MSEC));
+}
+
+static void msmsdcc_clk_gate_set_max(struct msmsdcc_host *host,
+				     unsigned int max_ms)
+{
+	struct msmsdcc_clk_gate *gate = &host->clk_gate;
+
+	gate->max_ms = max_ms;
+	if (!max_ms)
+		return;
+	gate->avg_gap_us = max_ms * USEC_PER_MSEC / 2;
+	msmsdcc_clk_gate_set_delay(host, max_ms * USEC_PER_MSEC);
+}
+
 static void
 msmsdcc_set_ios(struct mmc_host *mmc, struct mmc_ios *ios)
 {
@@ -2600,6 +2834,16 @@ msmsdcc_set_ios(struct mmc_host *mmc, struct mmc_ios *ios)
 			mb();
 			msmsdcc_cfg_sdio_wakeup(host, false);
 		}
+		if (host->clk_gate.gated) {
+			ktime_t now = ktime_get();
+
+			host->clk_gate.gated = 0;
+			host->clk_gate.ungate_time = now;
+			host->clk_gate.ttfb_pending = 1;
+			host->stats.clk_ungates++;
+			host->stats.clk_gated_us += ktime_us_delta(now,
+						host->clk_gate.gate_time);
+		}
 
 		clock = msmsdcc_get_sup_clk_rate(host, ios->clock);
 		/*
@@ -2696,6 +2940,12 @@ msmsdcc_set_ios(struct mmc_host *mmc, struct mmc_ios *ios)
 		msmsdcc_cfg_sdio_wakeup(host, true);
 		msmsdcc_setup_clocks(host, false);
 		host->clks_on = 0;
+		/* A zero clock from mmc_gate_clock() is an idle gate */
+		if (mmc->clk_gated) {
+			host->clk_gate.gated = 1;
+			host->clk_gate.gate_time = ktime_get();
+			host->stats.clk_gates++;
+		}
 	}
 
 	if (host->cmd19_tuning_in_progress)
@@ -3426,6 +3676,8 @@ exit:
 static const struct mmc_host_ops msmsdcc_ops = {
 	.enable		= msmsdcc_enable,
 	.disable	= msmsdcc_disable,
+	.pre_req	= msmsdcc_pre_req,
+	.post_req	= msmsdcc_post_req,
 	.request	= msmsdcc_request,
 	.set_ios	= msmsdcc_set_ios,
 	.get_ro		= msmsdcc_get_ro,
@@ -4026,6 +4278,69 @@ set_polling(struct device *dev, struct device_attribute *attr,
 
 static DEVICE_ATTR(polling, S_IRUGO | S_IWUSR,
 		show_polling, set_polling);
+
+static ssize_t
+show_dma_threshold(struct device *dev, struct device_attribute *attr,
+		   char *buf)
+{
+	struct mmc_host *mmc = dev_get_drvdata(dev);
+	struct msmsdcc_host *host = mmc_priv(mmc);
+
+	return snprintf(buf, PAGE_SIZE, "%u\n", host->dma_threshold);
+}
+
+static ssize_t
+set_dma_threshold(struct device *dev, struct device_attribute *attr,
+		  const char *buf, size_t count)
+{
+	struct mmc_host *mmc = dev_get_drvdata(dev);
+	struct msmsdcc_host *host = mmc_priv(mmc);
+	unsigned long value;
+	unsigned long flags;
+
+	if (strict_strtoul(buf, 0, &value))
+		return -EINVAL;
+
+	/* DMA can't do less than a FIFO's worth */
+	spin_lock_irqsave(&host->lock, flags);
+	host->dma_threshold = max_t(unsigned long, value, MCI_FIFOSIZE);
+	spin_unlock_irqrestore(&host->lock, flags);
+	return count;
+}
+
+static DEVICE_ATTR(dma_threshold, S_IRUGO | S_IWUSR,
+		show_dma_threshold, set_dma_threshold);
+
+static ssize_t
+show_clk_gate_max_ms(struct device *dev, struct device_attribute *attr,
+		     char *buf)
+{
+	struct mmc_host *mmc = dev_get_drvdata(dev);
+	struct msmsdcc_host *host = mmc_priv(mmc);
+
+	return snprintf(buf, PAGE_SIZE, "%u\n", host->clk_gate.max_ms);
+}
+
+static ssize_t
+set_clk_gate_max_ms(struct device *dev, struct device_attribute *attr,
+		    const char *buf, size_t count)
+{
+	struct mmc_host *mmc = dev_get_drvdata(dev);
+	struct msmsdcc_host *host = mmc_priv(mmc);
+	unsigned long value;
+	unsigned long flags;
+
+	if (strict_strtoul(buf, 0, &value) || value > MSEC_PER_SEC)
+		return -EINVAL;
+
+	spin_lock_irqsave(&host->lock, flags);
+	msmsdcc_clk_gate_set_max(host, value);
+	spin_unlock_irqrestore(&host->lock, flags);
+	return count;
+}
+
+static DEVICE_ATTR(clk_gate_max_ms, S_IRUGO | S_IWUSR,
+		show_clk_gate_max_ms, set_clk_gate_max_ms);
 static struct attribute *dev_attrs[] = {
 	&dev_attr_polling.attr,
 	NULL,
@@ -4117,7 +4432,7 @@ static void msmsdcc_dump_sdcc_state(struct msmsdcc_host *host)
 		msmsdcc_print_regs("SDCC-CORE", host->base, 28);
 
 	if (host->curr.data) {
-		if (msmsdcc_check_dma_op_req(host->curr.data))
+		if (msmsdcc_check_dma_op_req(host, host->curr.data))
 			pr_info("%s: PIO mode\n", mmc_hostname(host->mmc));
 		else if (host->is_dma_mode)
 			pr_info("%s: ADM mode: busy=%d, chnl=%d, crci=%d\n",
@@ -4423,6 +4738,7 @@ msmsdcc_probe(struct platform_device *pdev)
 		host->is_sps_mode = 1;
 	else if (dmares)
 		host->is_dma_mode = 1;
+	host->dma_threshold = MSMSDCC_DMA_THRESHOLD;
 
 	host->base = ioremap(core_memres->start,
 			resource_size(core_memres));
@@ -4762,6 +5078,10 @@ msmsdcc_probe(struct platform_device *pdev)
 	setup_timer(&host->req_tout_timer, msmsdcc_req_tout_timer_hdlr,
 			(unsigned long)host);
 
+	/* SDIO_AL clients manage the clocks through sdio_al LPM */
+	if (!plat->is_sdio_al_client)
+		msmsdcc_clk_gate_set_max(host, MSMSDCC_CLK_GATE_MAX_MS);
+
 	mmc_add_host(mmc);
 
 #ifdef CONFIG_HAS_EARLYSUSPEND
@@ -4813,6 +5133,12 @@ msmsdcc_probe(struct platform_device *pdev)
 		if (ret)
 			goto platform_irq_free;
 	}
+	if (device_create_file(&pdev->dev, &dev_attr_dma_threshold))
+		pr_err("%s: failed to create dma_threshold\n",
+		       mmc_hostname(mmc));
+	if (device_create_file(&pdev->dev, &dev_attr_clk_gate_max_ms))
+		pr_err("%s: failed to create clk_gate_max_ms\n",
+		       mmc_hostname(mmc));
 	return 0;
 
  platform_irq_free:
@@ -4891,12 +5217,18 @@ static int msmsdcc_remove(struct platform_device *pdev)
 
 	if (!plat->status_irq)
 		sysfs_remove_group(&pdev->dev.kobj, &dev_attr_grp);
+	device_remove_file(&pdev->dev, &dev_attr_dma_threshold);
+	device_remove_file(&pdev->dev, &dev_attr_clk_gate_max_ms);
 
 	del_timer_sync(&host->req_tout_timer);
 	tasklet_kill(&host->dma_tlet);
 	tasklet_kill(&host->sps.tlet);
 	mmc_remove_host(mmc);
 
+#if defined(CONFIG_DEBUG_FS)
+	debugfs_remove(host->debugfs_stats);
+#endif
+
 	if (plat->status_irq)
 		free_irq(plat->status_irq, host);
 
@@ -5424,12 +5756,114 @@ static const struct file_operations msmsdcc_dbg_state_ops = {
 	.open	= msmsdcc_dbg_state_open,
 };
 
+static ssize_t
+msmsdcc_dbg_stats_read(struct file *file, char __user *ubuf,
+		       size_t count, loff_t *ppos)
+{
+	struct msmsdcc_host *host = (struct msmsdcc_host *) file->private_data;
+	struct msmsdcc_stats stats;
+	unsigned long flags;
+	u64 avg_us = 0, kbps = 0, pio_avg_us = 0, dma_avg_us = 0;
+	u64 ttfb_avg_us = 0, gated_ms;
+	unsigned long dma_reqs;
+	char buf[700];
+	int max, i;
+
+	spin_lock_irqsave(&host->lock, flags);
+	stats = host->stats;
+	spin_unlock_irqrestore(&host->lock, flags);
+
+	if (stats.reqs) {
+		avg_us = stats.total_us;
+		do_div(avg_us, stats.reqs);
+	}
+	if (stats.data_us)
+		kbps = div64_u64(stats.bytes * USEC_PER_SEC, stats.data_us) >> 10;
+	if (stats.pio_reqs) {
+		pio_avg_us = stats.pio_us;
+		do_div(pio_avg_us, stats.pio_reqs);
+	}
+	if (stats.clk_ungates) {
+		ttfb_avg_us = stats.ttfb_us;
+		do_div(ttfb_avg_us, stats.clk_ungates);
+	}
+	gated_ms = stats.clk_gated_us;
+	do_div(gated_ms, USEC_PER_MSEC);
+	dma_reqs = stats.data_reqs - stats.pio_reqs;
+	if (dma_reqs) {
+		dma_avg_us = stats.data_us - stats.pio_us;
+		do_div(dma_avg_us, dma_reqs);
+	}
+
+	i = 0;
+	max = sizeof(buf) - 1;
+
+	i += scnprintf(buf + i, max - i,
+		       "requests: %lu (data %lu, prepared %lu)\n",
+		       stats.reqs, stats.data_reqs, stats.prepared);
+	i += scnprintf(buf + i, max - i, "bytes: %llu\n", stats.bytes);
+	i += scnprintf(buf + i, max - i, "latency: avg %llu us, max %u us\n",
+		       avg_us, stats.max_us);
+	i += scnprintf(buf + i, max - i, "data throughput: %llu KB/s\n",
+		       kbps);
+	i += scnprintf(buf + i, max - i,
+		       "pio: %lu reqs (%lu polled), %llu bytes, avg %llu us\n",
+		       stats.pio_reqs, stats.pio_polled, stats.pio_bytes,
+		       pio_avg_us);
+	i += scnprintf(buf + i, max - i,
+		       "dma: %lu reqs, %llu bytes, avg %llu us\n",
+		       dma_reqs, stats.bytes - stats.pio_bytes, dma_avg_us);
+	i += scnprintf(buf + i, max - i, "dma threshold: %u bytes\n",
+		       host->dma_threshold);
+	i += scnprintf(buf + i, max - i,
+		       "clk gate: delay %lu ms (max %u ms), gates %lu, "
+		       "ungates %lu, gated %llu ms\n",
+		       host->mmc->clkgate_delay, host->clk_gate.max_ms,
+		       stats.clk_gates, stats.clk_ungates, gated_ms);
+	i += scnprintf(buf + i, max - i,
+		       "ungate to first response: avg %llu us, max %u us\n",
+		       ttfb_avg_us, stats.ttfb_max_us);
+
+	return simple_read_from_buffer(ubuf, count, ppos, buf, i);
+}
+
+static ssize_t
+msmsdcc_dbg_stats_write(struct file *file, const char __user *ubuf,
+			size_t count, loff_t *ppos)
+{
+	struct msmsdcc_host *host = (struct msmsdcc_host *) file->private_data;
+	unsigned long flags;
+	ktime_t start;
+
+	/* Any write clears the counters */
+	spin_lock_irqsave(&host->lock, flags);
+	start = host->stats.start;
+	memset(&host->stats, 0, sizeof(host->stats));
+	host->stats.start = start;
+	spin_unlock_irqrestore(&host->lock, flags);
+
+	return count;
+}
+
+static const struct file_operations msmsdcc_dbg_stats_ops = {
+	.read	= msmsdcc_dbg_stats_read,
+	.write	= msmsdcc_dbg_stats_write,
+	.open	= msmsdcc_dbg_state_open,
+};
+
 static void msmsdcc_dbg_createhost(struct msmsdcc_host *host)
 {
+	char name[32];
+
 	if (debugfs_dir) {
 		debugfs_file = debugfs_create_file(mmc_hostname(host->mmc),
 							0644, debugfs_dir, host,
 							&msmsdcc_dbg_state_ops);
+		snprintf(name, sizeof(name), "%s_stats",
+			 mmc_hostname(host->mmc));
+		host->debugfs_stats = debugfs_create_file(name, 0644,
+							debugfs_dir, host,
+							&msmsdcc_dbg_stats_ops);
 	}
 }
 
@@ -24,6 +24,7 @@
 #include <linux/mmc/sdio.h>
 #include <linux/scatterlist.h>
 #include <linux/dma-mapping.h>
+#include <linux/ktime.h>
 #include <linux/wakelock.h>
 #include <linux/earlysuspend.h>
 #include <linux/pm_qos_params.h>
@@ -208,6 +209,13 @@
 
 #define MCI_FIFOHALFSIZE (MCI_FIFOSIZE / 2)
 
+/* Default smallest transfer done by DMA, see dma_threshold in sysfs */
+#define MSMSDCC_DMA_THRESHOLD	(2 * MCI_FIFOSIZE)
+
+/* Bounds of the core's clock gating delay, see msmsdcc_clk_gate_adapt() */
+#define MSMSDCC_CLK_GATE_MIN_US	1000
+#define MSMSDCC_CLK_GATE_MAX_MS	50	/* default, clk_gate_max_ms in sysfs */
+
 #define NR_SG		128
 
 #define MSM_MMC_IDLE_TIMEOUT	5000 /* msecs */
@@ -276,6 +284,7 @@ struct msmsdcc_dma_data {
 	int				crci;
 	struct msmsdcc_host		*host;
 	int				busy; /* Set if DM is busy */
+	struct mmc_data			*prepared; /* cmd list built by pre_req */
 	unsigned int 			result;
 	struct msm_dmov_errdata		err;
 };
@@ -298,6 +307,41 @@ struct msmsdcc_curr_req {
 	int			wait_for_auto_prog_done;
 	int			got_auto_prog_done;
 	int			user_pages;
+	int			pio;		/* Data moved by the CPU */
+	int			pio_polled;	/* ...without PIO irqs */
+};
+
+/* Set in mmc_data.host_cookie when pre_req mapped the buffers */
+#define MSMSDCC_COOKIE_MAPPED	1
+
+struct msmsdcc_stats {
+	unsigned long		reqs;		/* Requests completed */
+	unsigned long		data_reqs;	/* ...of which with data */
+	unsigned long		prepared;	/* Data requests mapped by pre_req */
+	u64			bytes;		/* Data bytes transferred */
+	u64			data_us;	/* Time spent in data requests */
+	u64			total_us;	/* Time spent in all requests */
+	unsigned int		max_us;		/* Longest request */
+	unsigned long		pio_reqs;	/* Data requests done by PIO */
+	unsigned long		pio_polled;	/* ...of which polled */
+	u64			pio_bytes;
+	u64			pio_us;
+	unsigned long		clk_gates;	/* Idle clock gate events */
+	unsigned long		clk_ungates;
+	u64			clk_gated_us;	/* Time spent gated */
+	u64			ttfb_us;	/* Ungate to first response */
+	unsigned int		ttfb_max_us;
+	ktime_t			start;		/* Start of current request */
+};
+
+struct msmsdcc_clk_gate {
+	int			gated;		/* Clocks off by mmc_gate_clock() */
+	unsigned int		max_ms;		/* Longest delay, 0 is fixed */
+	unsigned int		avg_gap_us;	/* Average gap within bursts */
+	ktime_t			last_end;	/* End of the last request */
+	ktime_t			gate_time;
+	ktime_t			ungate_time;
+	int			ttfb_pending;	/* No response since ungate */
 };
 
 struct msmsdcc_sps_ep_conn_data {
@@ -399,6 +443,12 @@ struct msmsdcc_host {
 	bool sdcc_irq_disabled;
 	bool sdcc_suspended;
 	bool sdio_wakeupirq_disabled;
+	unsigned int dma_threshold;	/* Smallest transfer done by DMA */
+	struct msmsdcc_clk_gate clk_gate;
+	struct msmsdcc_stats stats;
+#if defined(CONFIG_DEBUG_FS)
+	struct dentry *debugfs_stats;
+#endif
 };
 
 int msmsdcc_set_pwrsave(struct mmc_host *mmc, int pwrsave);
@@ -77,6 +77,19 @@ static const char *ch_name[RMNET_DEVICE_COUNT] = {
 
 #define HEADROOM_FOR_QOS    8
 
+/* packets handled per NAPI poll */
+#define RMNET_NAPI_WEIGHT 64
+
+/* receive skbs kept around for reuse, each holds RMNET_DATA_LEN bytes */
+#define RMNET_RX_POOL_MAX 32
+#define RMNET_RX_SKB_SIZE (RMNET_DATA_LEN + NET_IP_ALIGN)
+
+/* packets per poll histogram: 0, 1, 2-3, 4-7, ... 32-63, 64+ */
+#define RMNET_POLL_HIST_SIZE 8
+
+/* Lower bound for the tx byte limit, two full frames plus SMD headers */
+#define RMNET_TX_LIMIT_MIN (2 * (RMNET_DATA_LEN + HEADROOM_FOR_QOS + 20))
+
 static struct completion *port_complete[RMNET_DEVICE_COUNT];
 
 struct rmnet_private
@@ -91,9 +104,29 @@ struct rmnet_private
 	unsigned long wakeups_rcv;
 	unsigned long timeout_us;
 #endif
-	struct sk_buff *skb;
+	struct sk_buff_head txq;
+	unsigned txq_bytes;
 	spinlock_t lock;
 	struct tasklet_struct tsklt;
+	/*
+	 * Byte queue limit for the SMD fifo: the queue is stopped once
+	 * queued plus unread bytes reach tx_limit and restarted when they
+	 * drop to half of it.  tx_limit grows when the modem drained the
+	 * fifo before we restarted and decays otherwise.
+	 */
+	unsigned tx_fifo_size;
+	unsigned tx_limit;
+	unsigned long tx_stops;
+	unsigned long tx_starved;
+	unsigned long tx_batches;
+	unsigned long tx_batch_pkts;
+	struct napi_struct napi;
+	struct sk_buff_head rx_pool;
+	unsigned long rx_polls;
+	unsigned long rx_poll_full;
+	unsigned long rx_poll_hist[RMNET_POLL_HIST_SIZE];
+	unsigned long rx_pool_hits;
+	unsigned long rx_pool_misses;
 	u32 operation_mode;    /* IOCTL specified mode (protocol, QoS header) */
 	struct platform_driver pdrv;
 	struct completion complete;
@@ -256,80 +289,158 @@ static __be16 rmnet_ip_type_trans(struct sk_buff *skb, struct net_device *dev)
 	return protocol;
 }
 
-static void smd_net_data_handler(unsigned long arg);
-static DECLARE_TASKLET(smd_net_data_tasklet, smd_net_data_handler, 0);
+static struct sk_buff *rmnet_alloc_rx_skb(struct net_device *dev, int sz)
+{
+	struct rmnet_private *p = netdev_priv(dev);
+	struct sk_buff *skb = NULL;
+
+	if (sz <= RMNET_DATA_LEN)
+		skb = skb_dequeue(&p->rx_pool);
+	if (skb) {
+		p->rx_pool_hits++;
+		skb->dev = dev;
+		skb_reserve(skb, NET_IP_ALIGN);
+		return skb;
+	}
+
+	p->rx_pool_misses++;
+	return netdev_alloc_skb_ip_align(dev, sz);
+}
+
+/* Keep skbs the driver is done with for the receive path. */
+static void rmnet_recycle_skb(struct rmnet_private *p, struct sk_buff *skb)
+{
+	if (skb_queue_len(&p->rx_pool) < RMNET_RX_POOL_MAX &&
+	    skb_recycle_check(skb, RMNET_RX_SKB_SIZE))
+		skb_queue_head(&p->rx_pool, skb);
+	else
+		dev_kfree_skb_any(skb);
+}
+
+static ssize_t rx_poll_stats_show(struct device *d,
+				  struct device_attribute *attr, char *buf)
+{
+	struct rmnet_private *p = netdev_priv(to_net_dev(d));
+	ssize_t len;
+	int i;
+
+	len = sprintf(buf, "polls: %lu\nbudget exhausted: %lu\n"
+		      "pool hits: %lu\npool misses: %lu\n",
+		      p->rx_polls, p->rx_poll_full,
+		      p->rx_pool_hits, p->rx_pool_misses);
+
+	len += sprintf(buf + len, "packets per poll:\n");
+	len += sprintf(buf + len, "     0: %lu\n", p->rx_poll_hist[0]);
+	for (i = 1; i < RMNET_POLL_HIST_SIZE - 1; i++)
+		len += sprintf(buf + len, "%3u-%-2u: %lu\n", 1U << (i - 1),
+			       (1U << i) - 1, p->rx_poll_hist[i]);
+	len += sprintf(buf + len, "%5u+: %lu\n", 1U << (i - 1),
+		       p->rx_poll_hist[i]);
+
+	return len;
+}
+
+static DEVICE_ATTR(rx_poll_stats, 0444, rx_poll_stats_show, NULL);
 
 /* Called in soft-irq context */
-static void smd_net_data_handler(unsigned long arg)
+static int rmnet_poll(struct napi_struct *napi, int budget)
 {
-	struct net_device *dev = (struct net_device *) arg;
+	struct net_device *dev = napi->dev;
 	struct rmnet_private *p = netdev_priv(dev);
 	struct sk_buff *skb;
 	void *ptr = 0;
 	int sz;
-	u32 opmode = p->operation_mode;
+	int work = 0;
+	u32 opmode;
 	unsigned long flags;
 
-	for (;;) {
+	spin_lock_irqsave(&p->lock, flags);
+	opmode = p->operation_mode;
+	spin_unlock_irqrestore(&p->lock, flags);
+
+	while (p->ch && work < budget) {
 		sz = smd_cur_packet_size(p->ch);
 		if (sz == 0) break;
 		if (smd_read_avail(p->ch) < sz) break;
 
-		skb = dev_alloc_skb(sz + NET_IP_ALIGN);
+		skb = rmnet_alloc_rx_skb(dev, sz);
 		if (skb == NULL) {
 			pr_err("[%s] rmnet_recv() cannot allocate skb\n",
 			       dev->name);
-			/* out of memory, reschedule a later attempt */
-			smd_net_data_tasklet.data = (unsigned long)dev;
-			tasklet_schedule(&smd_net_data_tasklet);
+			/* out of memory, stay scheduled and retry */
+			work = budget;
 			break;
+		}
+
+		work++;
+		ptr = skb_put(skb, sz);
+		if (smd_read(p->ch, ptr, sz) != sz) {
+			pr_err("[%s] rmnet_recv() smd lied about avail?!",
+				dev->name);
+			rmnet_recycle_skb(p, skb);
+			continue;
+		}
+
+		/* Handle Rx frame format */
+		if (RMNET_IS_MODE_IP(opmode)) {
+			/* Driver in IP mode, there is no link layer header */
+			skb->protocol = rmnet_ip_type_trans(skb, dev);
+			skb_reset_mac_header(skb);
 		} else {
-			skb->dev = dev;
-			skb_reserve(skb, NET_IP_ALIGN);
-			ptr = skb_put(skb, sz);
-			wake_lock_timeout(&p->wake_lock, HZ / 2);
-			if (smd_read(p->ch, ptr, sz) != sz) {
-				pr_err("[%s] rmnet_recv() smd lied about avail?!",
-					dev->name);
-				ptr = 0;
-				dev_kfree_skb_irq(skb);
-			} else {
-				/* Handle Rx frame format */
-				spin_lock_irqsave(&p->lock, flags);
-				opmode = p->operation_mode;
-				spin_unlock_irqrestore(&p->lock, flags);
-
-				if (RMNET_IS_MODE_IP(opmode)) {
-					/* Driver in IP mode */
-					skb->protocol =
-					  rmnet_ip_type_trans(skb, dev);
-				} else {
-					/* Driver in Ethernet mode */
-					skb->protocol =
-					  eth_type_trans(skb, dev);
-				}
-				if (RMNET_IS_MODE_IP(opmode) ||
-				    count_this_packet(ptr, skb->len)) {
+			/* Driver in Ethernet mode */
+			skb->protocol = eth_type_trans(skb, dev);
+		}
+
+		/* GRO only merges TCP segments with a known checksum.  A
+		 * valid IPv4 header sums to zero, so the sum over the whole
+		 * packet is the one the transport layer wants.
+		 */
+		if (skb->protocol == htons(ETH_P_IP)) {
+			skb->csum = csum_partial(skb->data, skb->len, 0);
+			skb->ip_summed = CHECKSUM_COMPLETE;
+		}
+
+		if (RMNET_IS_MODE_IP(opmode) ||
+		    count_this_packet(ptr, skb->len)) {
 #ifdef CONFIG_MSM_RMNET_DEBUG
-					p->wakeups_rcv +=
-					rmnet_cause_wakeup(p);
+			p->wakeups_rcv += rmnet_cause_wakeup(p);
 #endif
-					p->stats.rx_packets++;
-					p->stats.rx_bytes += skb->len;
-				}
-				DBG1("[%s] Rx packet #%lu len=%d\n",
-					dev->name, p->stats.rx_packets,
-					skb->len);
-
-				/* Deliver to network stack */
-				netif_rx(skb);
-			}
-			continue;
+			p->stats.rx_packets++;
+			p->stats.rx_bytes += skb->len;
 		}
-		if (smd_read(p->ch, ptr, sz) != sz)
-			pr_err("[%s] rmnet_recv() smd lied about avail?!",
-				dev->name);
+		DBG1("[%s] Rx packet #%lu len=%d\n",
+			dev->name, p->stats.rx_packets, skb->len);
+
+		/* Deliver to network stack.  GRO compares the Ethernet
+		 * headers of the packets it merges, so raw IP frames can't
+		 * go through it.
+		 */
+		if (RMNET_IS_MODE_IP(opmode))
+			netif_receive_skb(skb);
+		else
+			napi_gro_receive(napi, skb);
+	}
+
+	if (work)
+		wake_lock_timeout(&p->wake_lock, HZ / 2);
+
+	p->rx_polls++;
+	p->rx_poll_hist[min(fls(work), RMNET_POLL_HIST_SIZE - 1)]++;
+	if (work >= budget) {
+		p->rx_poll_full++;
+		return budget;
 	}
+
+	napi_complete(napi);
+
+	/* smd_net_notify() can't reschedule us until napi_complete(), pick
+	 * up anything that came in before that.
+	 */
+	if (p->ch && smd_read_avail(p->ch) &&
+	    smd_read_avail(p->ch) >= smd_cur_packet_size(p->ch))
+		napi_schedule(napi);
+
+	return work;
 }
 
 static int _rmnet_xmit(struct sk_buff *skb, struct net_device *dev)
@@ -337,23 +448,13 @@ static int _rmnet_xmit(struct sk_buff *skb, struct net_device *dev)
 	struct rmnet_private *p = netdev_priv(dev);
 	smd_channel_t *ch = p->ch;
 	int smd_ret;
-	struct QMI_QOS_HDR_S *qmih;
 	u32 opmode;
 	unsigned long flags;
 
-	/* For QoS mode, prepend QMI header and assign flow ID from skb->mark */
 	spin_lock_irqsave(&p->lock, flags);
 	opmode = p->operation_mode;
 	spin_unlock_irqrestore(&p->lock, flags);
 
-	if (RMNET_IS_MODE_QOS(opmode)) {
-		qmih = (struct QMI_QOS_HDR_S *)
-			skb_push(skb, sizeof(struct QMI_QOS_HDR_S));
-		qmih->version = 1;
-		qmih->flags = 0;
-		qmih->flow_id = skb->mark;
-	}
-
 	dev->trans_start = jiffies;
 	smd_ret = smd_write(ch, skb->data, skb->len);
 	if (smd_ret != skb->len) {
@@ -376,30 +477,122 @@ static int _rmnet_xmit(struct sk_buff *skb, struct net_device *dev)
 
 xmit_out:
 	/* data xmited, safe to release skb */
-	dev_kfree_skb_irq(skb);
+	rmnet_recycle_skb(p, skb);
 	return 0;
 }
 
-static void _rmnet_resume_flow(unsigned long param)
+/* Bytes written to the SMD fifo that the modem hasn't read yet.
+ * Called with p->lock held.
+ */
+static unsigned rmnet_tx_inflight(struct rmnet_private *p)
+{
+	unsigned avail = smd_write_avail(p->ch);
+
+	/* the fifo is empty at some point, the largest space seen is its size */
+	if (avail > p->tx_fifo_size) {
+		p->tx_fifo_size = avail;
+		if (p->tx_limit > avail)
+			p->tx_limit = max(avail, (unsigned)RMNET_TX_LIMIT_MIN);
+	}
+	return p->tx_fifo_size - avail;
+}
+
+/* Called with p->lock held, decides whether the queue may run again. */
+static void rmnet_tx_restart(struct net_device *dev)
+{
+	struct rmnet_private *p = netdev_priv(dev);
+	unsigned inflight = rmnet_tx_inflight(p);
+
+	if (inflight + p->txq_bytes > p->tx_limit / 2) {
+		/* wait for the modem to read more */
+		smd_enable_read_intr(p->ch);
+
+		/* it may have caught up before it saw the flag */
+		inflight = rmnet_tx_inflight(p);
+		if (inflight + p->txq_bytes > p->tx_limit / 2)
+			return;
+	}
+
+	smd_disable_read_intr(p->ch);
+	if (!netif_queue_stopped(dev))
+		return;
+
+	if (inflight == 0) {
+		/* the modem ran dry while we were stopped */
+		p->tx_starved++;
+		p->tx_limit = min(p->tx_limit + p->tx_limit / 2,
+				  p->tx_fifo_size);
+	} else {
+		p->tx_limit = max(p->tx_limit - p->tx_limit / 16,
+				  (unsigned)RMNET_TX_LIMIT_MIN);
+	}
+	netif_wake_queue(dev);
+}
+
+/*
+ * Writes out everything rmnet_xmit() queued since the last run that fits
+ * in the SMD fifo.  Packets stay one per SMD packet, but the modem only
+ * gets interrupted once per batch.
+ */
+static void rmnet_tx_flush(unsigned long param)
 {
 	struct net_device *dev = (struct net_device *)param;
 	struct rmnet_private *p = netdev_priv(dev);
-	struct sk_buff *skb = NULL;
+	struct sk_buff *skb;
+	smd_channel_t *ch;
 	unsigned long flags;
+	unsigned n = 0;
 
-	/* xmit and enable the flow only once even if
-	   multiple tasklets were scheduled by smd_net_notify */
 	spin_lock_irqsave(&p->lock, flags);
-	if (p->skb && (smd_write_avail(p->ch) >= p->skb->len)) {
-		skb = p->skb;
-		p->skb = NULL;
+	ch = p->ch;
+	spin_unlock_irqrestore(&p->lock, flags);
+	if (!ch)
+		return;
+
+	smd_write_batch_start(ch);
+	for (;;) {
+		spin_lock_irqsave(&p->lock, flags);
+		skb = __skb_dequeue(&p->txq);
+		if (skb && smd_write_avail(ch) < skb->len) {
+			__skb_queue_head(&p->txq, skb);
+			skb = NULL;
+		}
+		if (skb)
+			p->txq_bytes -= skb->len;
 		spin_unlock_irqrestore(&p->lock, flags);
+
+		if (!skb)
+			break;
 		_rmnet_xmit(skb, dev);
-		netif_wake_queue(dev);
-	} else
-		spin_unlock_irqrestore(&p->lock, flags);
+		n++;
+	}
+	smd_write_batch_end(ch);
+
+	spin_lock_irqsave(&p->lock, flags);
+	if (n) {
+		p->tx_batches++;
+		p->tx_batch_pkts += n;
+	}
+	if (p->ch)
+		rmnet_tx_restart(dev);
+	spin_unlock_irqrestore(&p->lock, flags);
+}
+
+static ssize_t tx_stats_show(struct device *d,
+			     struct device_attribute *attr, char *buf)
+{
+	struct rmnet_private *p = netdev_priv(to_net_dev(d));
+
+	return sprintf(buf, "limit: %u\nfifo: %u\nqueued: %u\n"
+		       "stops: %lu\nstarved: %lu\n"
+		       "batches: %lu\nbatched packets: %lu\n",
+		       p->tx_limit, p->tx_fifo_size, p->txq_bytes,
+		       p->tx_stops, p->tx_starved,
+		       p->tx_batches, p->tx_batch_pkts);
 }
 
+static DEVICE_ATTR(tx_stats, 0444, tx_stats_show, NULL);
+
 static void msm_rmnet_unload_modem(void *pil)
 {
 	if (pil)
@@ -440,7 +633,8 @@ static void smd_net_notify(void *_dev, unsigned event)
 	switch (event) {
 	case SMD_EVENT_DATA:
 		spin_lock(&p->lock);
-		if (p->skb && (smd_write_avail(p->ch) >= p->skb->len)) {
+		if ((netif_queue_stopped(_dev) || p->txq_bytes) &&
+		    rmnet_tx_inflight(p) + p->txq_bytes <= p->tx_limit / 2) {
 			smd_disable_read_intr(p->ch);
 			tasklet_hi_schedule(&p->tsklt);
 		}
@@ -448,10 +642,8 @@ static void smd_net_notify(void *_dev, unsigned event)
 		spin_unlock(&p->lock);
 
 		if (smd_read_avail(p->ch) &&
-			(smd_read_avail(p->ch) >= smd_cur_packet_size(p->ch))) {
-			smd_net_data_tasklet.data = (unsigned long) _dev;
-			tasklet_schedule(&smd_net_data_tasklet);
-		}
+			(smd_read_avail(p->ch) >= smd_cur_packet_size(p->ch)))
+			napi_schedule(&p->napi);
 		break;
 
 	case SMD_EVENT_OPEN:
@@ -516,13 +708,18 @@ static int __rmnet_close(struct net_device *dev)
 
 static int rmnet_open(struct net_device *dev)
 {
+	struct rmnet_private *p = netdev_priv(dev);
 	int rc = 0;
 
 	DBG0("[%s] rmnet_open()\n", dev->name);
 
 	rc = __rmnet_open(dev);
-	if (rc == 0)
+	if (rc == 0) {
+		napi_enable(&p->napi);
+		/* drain anything that queued up while we were down */
+		napi_schedule(&p->napi);
 		netif_start_queue(dev);
+	}
 
 	return rc;
 }
@@ -530,11 +727,19 @@ static int rmnet_open(struct net_device *dev)
 static int rmnet_stop(struct net_device *dev)
 {
 	struct rmnet_private *p = netdev_priv(dev);
+	unsigned long flags;
 
 	DBG0("[%s] rmnet_stop()\n", dev->name);
 
 	netif_stop_queue(dev);
+	napi_disable(&p->napi);
 	tasklet_kill(&p->tsklt);
+	skb_queue_purge(&p->rx_pool);
+
+	spin_lock_irqsave(&p->lock, flags);
+	__skb_queue_purge(&p->txq);
+	p->txq_bytes = 0;
+	spin_unlock_irqrestore(&p->lock, flags);
 
 	/* TODO: unload modem safely,
 	   currently, this causes unnecessary unloads */
@@ -563,7 +768,7 @@ static int rmnet_change_mtu(struct net_device *dev, int new_mtu)
 static int rmnet_xmit(struct sk_buff *skb, struct net_device *dev)
 {
 	struct rmnet_private *p = netdev_priv(dev);
-	smd_channel_t *ch = p->ch;
+	struct QMI_QOS_HDR_S *qmih;
 	unsigned long flags;
 
 	if (netif_queue_stopped(dev)) {
@@ -573,17 +778,34 @@ static int rmnet_xmit(struct sk_buff *skb, struct net_device *dev)
 	}
 
 	spin_lock_irqsave(&p->lock, flags);
-	smd_enable_read_intr(ch);
-	if (smd_write_avail(ch) < skb->len) {
-		netif_stop_queue(dev);
-		p->skb = skb;
+	if (!p->ch) {
 		spin_unlock_irqrestore(&p->lock, flags);
+		p->stats.tx_dropped++;
+		dev_kfree_skb_any(skb);
 		return 0;
 	}
-	smd_disable_read_intr(ch);
+
+	/* For QoS mode, prepend QMI header and assign flow ID from skb->mark */
+	if (RMNET_IS_MODE_QOS(p->operation_mode)) {
+		qmih = (struct QMI_QOS_HDR_S *)
+			skb_push(skb, sizeof(struct QMI_QOS_HDR_S));
+		qmih->version = 1;
+		qmih->flags = 0;
+		qmih->flow_id = skb->mark;
+	}
+
+	/* rmnet_tx_flush() writes it out once the stack is done handing us
+	 * packets, together with whatever else got queued meanwhile.
+	 */
+	__skb_queue_tail(&p->txq, skb);
+	p->txq_bytes += skb->len;
+	if (p->txq_bytes + rmnet_tx_inflight(p) >= p->tx_limit) {
+		netif_stop_queue(dev);
+		p->tx_stops++;
+	}
 	spin_unlock_irqrestore(&p->lock, flags);
 
-	_rmnet_xmit(skb, dev);
+	tasklet_hi_schedule(&p->tsklt);
 
 	return 0;
 }
@@ -793,10 +1015,14 @@ static int __init rmnet_init(void)
 		p->chname = ch_name[n];
 		/* Initial config uses Ethernet */
 		p->operation_mode = RMNET_MODE_LLP_ETH;
-		p->skb = NULL;
+		skb_queue_head_init(&p->txq);
+		p->txq_bytes = 0;
+		p->tx_limit = UINT_MAX;
 		spin_lock_init(&p->lock);
-		tasklet_init(&p->tsklt, _rmnet_resume_flow,
+		tasklet_init(&p->tsklt, rmnet_tx_flush,
 				(unsigned long)dev);
+		netif_napi_add(dev, &p->napi, rmnet_poll, RMNET_NAPI_WEIGHT);
+		skb_queue_head_init(&p->rx_pool);
 		wake_lock_init(&p->wake_lock, WAKE_LOCK_SUSPEND, ch_name[n]);
 #ifdef CONFIG_MSM_RMNET_DEBUG
 		p->timeout_us = timeout_us;
@@ -822,6 +1048,10 @@ static int __init rmnet_init(void)
 			return ret;
 		}
 
+		if (device_create_file(d, &dev_attr_rx_poll_stats))
+			continue;
+		if (device_create_file(d, &dev_attr_tx_stats))
+			continue;
 
 #ifdef CONFIG_MSM_RMNET_DEBUG
 		if (device_create_file(d, &dev_attr_timeout))
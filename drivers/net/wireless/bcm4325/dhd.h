@@ -288,6 +288,7 @@ extern void * dhd_os_open_image(char * filename);
 extern int dhd_os_get_image_block(char * buf, int len, void * image);
 extern void dhd_os_close_image(void * image);
 extern void dhd_os_wd_timer(void *bus, uint wdtick);
+extern void dhd_os_set_rxglom(dhd_pub_t *pub, bool enable);
 extern void dhd_os_sdlock(dhd_pub_t * pub);
 extern void dhd_os_sdunlock(dhd_pub_t * pub);
 extern void dhd_os_sdlock_txq(dhd_pub_t * pub);
@@ -384,6 +385,15 @@ extern uint dhd_sdiod_drive_strength;
 /* Override to force tx queueing all the time */
 extern uint dhd_force_tx_queueing;
 
+/* Dongle rx glomming (superframes), see dhd_os_set_rxglom() */
+extern uint dhd_rxglom;
+#define DHD_RXGLOM_OFF	0	/* Never glom */
+#define DHD_RXGLOM_ON	1	/* Always glom */
+#define DHD_RXGLOM_AUTO	2	/* Glom while rx comes in bursts */
+
+/* Preallocate rx packets, see osl_rxpool_init() */
+extern uint dhd_rxpool;
+
 #ifdef SDTEST
 /* Echo packet generator (SDIO), pkts/s */
 extern uint dhd_pktgen;
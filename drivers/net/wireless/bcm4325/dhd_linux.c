@@ -40,6 +40,7 @@
 #include <linux/ethtool.h>
 #include <linux/fcntl.h>
 #include <linux/fs.h>
+#include <linux/debugfs.h>
 
 #include <asm/uaccess.h>
 #include <asm/unaligned.h>
@@ -158,6 +159,11 @@ typedef struct dhd_info {
 	bool set_multicast;
 	bool set_macaddress;
 	struct ether_addr macvalue;
+	bool set_rxglom;
+	uint32 rxglom;
+#ifdef CONFIG_DEBUG_FS
+	struct dentry *debugfs_dir;
+#endif
 	wait_queue_head_t ctrl_wait;
 	atomic_t pend_8021x_cnt;
 } dhd_info_t;
@@ -257,6 +263,14 @@ module_param(dhd_rxbound, uint, 0);
 extern uint dhd_deferred_tx;
 module_param(dhd_deferred_tx, uint, 0);
 
+/* Dongle rx glomming: 0 off, 1 on, 2 follow the rx burst size */
+uint dhd_rxglom = DHD_RXGLOM_AUTO;
+module_param(dhd_rxglom, uint, 0);
+
+/* Keep a pool of preallocated rx packets */
+uint dhd_rxpool = 1;
+module_param(dhd_rxpool, uint, 0);
+
 
 
 #ifdef SDTEST
@@ -592,6 +606,32 @@ _dhd_set_mac_address(dhd_info_t *dhd, int ifidx, struct ether_addr *addr)
 	return ret;
 }
 
+static void
+_dhd_set_rxglom(dhd_info_t *dhd, uint32 glom)
+{
+	char buf[32];
+	wl_ioctl_t ioc;
+	int ret;
+
+	if (dhd->pub.busstate != DHD_BUS_DATA)
+		return;
+
+	glom = htol32(glom);
+	if (!bcm_mkiovar("bus:txglom", (char *)&glom, sizeof(glom), buf, sizeof(buf))) {
+		DHD_ERROR(("%s: mkiovar failed for bus:txglom\n", __FUNCTION__));
+		return;
+	}
+	memset(&ioc, 0, sizeof(ioc));
+	ioc.cmd = WLC_SET_VAR;
+	ioc.buf = buf;
+	ioc.len = sizeof(buf);
+	ioc.set = TRUE;
+
+	ret = dhd_prot_ioctl(&dhd->pub, 0, &ioc, ioc.buf, ioc.len);
+	if (ret < 0)
+		DHD_ERROR(("%s: set bus:txglom %d failed\n", __FUNCTION__, ltoh32(glom)));
+}
+
 #ifdef SOFTAP
 extern struct net_device *ap_net_dev;
 #endif
@@ -684,6 +724,10 @@ _dhd_sysioc_thread(void *data)
 				}
 			}
 		}
+		if (dhd->set_rxglom) {
+			dhd->set_rxglom = FALSE;
+			_dhd_set_rxglom(dhd, dhd->rxglom);
+		}
 	}
 	complete_and_exit(&dhd->sysioc_exited, 0);
 }
@@ -1699,6 +1743,75 @@ dhd_del_if(dhd_info_t *dhd, int ifidx)
 	up(&dhd->sysioc_sem);
 }
 
+#ifdef CONFIG_DEBUG_FS
+#define DHD_DEBUGFS_BUFLEN	4096
+
+/* Bus counters (the "dump" iovar's bus section); any write clears them */
+static ssize_t
+dhd_debugfs_bus_read(struct file *file, char __user *ubuf, size_t count, loff_t *ppos)
+{
+	dhd_info_t *dhd = file->private_data;
+	struct bcmstrbuf b;
+	char *buf;
+	ssize_t ret;
+
+	if (!(buf = MALLOC(dhd->pub.osh, DHD_DEBUGFS_BUFLEN)))
+		return -ENOMEM;
+
+	bcm_binit(&b, buf, DHD_DEBUGFS_BUFLEN);
+	dhd_bus_dump(&dhd->pub, &b);
+	ret = simple_read_from_buffer(ubuf, count, ppos, buf,
+	                              DHD_DEBUGFS_BUFLEN - b.size);
+
+	MFREE(dhd->pub.osh, buf, DHD_DEBUGFS_BUFLEN);
+	return ret;
+}
+
+static ssize_t
+dhd_debugfs_bus_write(struct file *file, const char __user *ubuf, size_t count,
+                      loff_t *ppos)
+{
+	dhd_info_t *dhd = file->private_data;
+
+	dhd_bus_clearcounts(&dhd->pub);
+	return count;
+}
+
+static int
+dhd_debugfs_open(struct inode *inode, struct file *file)
+{
+	file->private_data = inode->i_private;
+	return 0;
+}
+
+static const struct file_operations dhd_debugfs_bus_fops = {
+	.open = dhd_debugfs_open,
+	.read = dhd_debugfs_bus_read,
+	.write = dhd_debugfs_bus_write,
+};
+
+static void
+dhd_debugfs_init(dhd_info_t *dhd)
+{
+	dhd->debugfs_dir = debugfs_create_dir("dhd", NULL);
+	if (IS_ERR_OR_NULL(dhd->debugfs_dir)) {
+		dhd->debugfs_dir = NULL;
+		return;
+	}
+	debugfs_create_file("bus", 0644, dhd->debugfs_dir, dhd, &dhd_debugfs_bus_fops);
+}
+
+static void
+dhd_debugfs_remove(dhd_info_t *dhd)
+{
+	debugfs_remove_recursive(dhd->debugfs_dir);
+	dhd->debugfs_dir = NULL;
+}
+#else
+static void dhd_debugfs_init(dhd_info_t *dhd) {}
+static void dhd_debugfs_remove(dhd_info_t *dhd) {}
+#endif /* CONFIG_DEBUG_FS */
+
 dhd_pub_t *
 dhd_attach(osl_t *osh, struct dhd_bus *bus, uint bus_hdrlen)
 {
@@ -1814,6 +1927,8 @@ dhd_attach(osl_t *osh, struct dhd_bus *bus, uint bus_hdrlen)
 		dhd->sysioc_pid = -1;
 	}
 
+	dhd_debugfs_init(dhd);
+
 	/*
 	 * Save the dhd_info into the priv
 	 */
@@ -2109,6 +2224,8 @@ dhd_detach(dhd_pub_t *dhdp)
 			wait_for_completion(&dhd->sysioc_exited);
 		}
 
+		dhd_debugfs_remove(dhd);
+
 		dhd_bus_detach(dhdp);
 
 		if (dhdp->prot)
@@ -2319,6 +2436,22 @@ dhd_os_wd_timer(void *bus, uint wdtick)
 	dhd->wd_timer_valid = TRUE;
 }
 
+/* Dongle glomming is switched with an iovar, which waits for the dongle's
+ * response in the dpc; hand it to the sysioc thread instead.
+ */
+void
+dhd_os_set_rxglom(dhd_pub_t *pub, bool enable)
+{
+	dhd_info_t *dhd = (dhd_info_t *)pub->info;
+
+	if (dhd->sysioc_pid < 0)
+		return;
+
+	dhd->rxglom = enable ? 1 : 0;
+	dhd->set_rxglom = TRUE;
+	up(&dhd->sysioc_sem);
+}
+
 void *
 dhd_os_open_image(char * filename)
 {
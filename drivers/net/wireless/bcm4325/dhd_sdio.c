@@ -79,6 +79,15 @@
 
 #define DHD_TXMINMAX	1	/* Max tx frames if rx still pending */
 
+/* Dongle glomming follows the average rx frames per dpc pass (in 1/16) */
+#define DHD_RXGLOM_ON_BURST	(6 << 4)
+#define DHD_RXGLOM_OFF_BURST	(2 << 4)
+#define DHD_RXGLOM_HOLDOFF	32	/* Rx passes between two switches */
+
+/* Preallocated rx packet classes, see osl_rxpool_init() */
+#define DHD_RXPOOL_SMALL	512
+#define DHD_RXPOOL_LARGE	(MAX_RX_DATASZ + DHD_FIRSTREAD + DHD_SDALIGN)
+
 #define MEMBLOCK    2048 /* Block size used for downloading of dongle image */
 #define MAX_DATA_BUF (32 * 1024)	/* which should be more than
 						* and to hold biggest glom possible
@@ -255,6 +264,10 @@ typedef struct dhd_bus {
 	bool		alp_only; /* Don't use HT clock (ALP only) */
 	/* Field to decide if rx of control frames happen in rxbuf or lb-pool */
 	bool		usebufpool;
+	uint		rxglom_mode;	/* Dongle glomming: DHD_RXGLOM_OFF/ON/AUTO */
+	bool		rxglom_on;	/* Dongle glomming last requested */
+	uint		rxburst_avg;	/* Running avg of rx frames per pass (1/16) */
+	uint		rxglom_holdoff;	/* Rx passes until the next auto switch */
 
 #ifdef SDTEST
 	/* external loopback */
@@ -299,6 +312,9 @@ typedef struct dhd_bus {
 	uint	f2rxdata;	/* Number of frame data reads */
 	uint	f2txdata;	/* Number of f2 frame writes */
 	uint	f1regdata;	/* Number of f1 register accesses */
+	uint	f2rxpasses;	/* Number of dpc passes that read frames */
+	uint	f2txpasses;	/* Number of dpc passes that sent frames */
+	uint	rxglom_switches; /* Number of dongle glom mode changes */
 
 } dhd_bus_t;
 
@@ -1467,6 +1483,7 @@ enum {
 	IOV_IDLECLOCK,
 	IOV_SD1IDLE,
 	IOV_SLEEP,
+	IOV_RXGLOM,
 	IOV_VARS
 };
 
@@ -1490,6 +1507,7 @@ const bcm_iovar_t dhdsdio_iovars[] = {
 	{"txbound",	IOV_TXBOUND,	0,	IOVT_UINT32,	0 },
 	{"rxbound",	IOV_RXBOUND,	0,	IOVT_UINT32,	0 },
 	{"txminmax",	IOV_TXMINMAX,	0,	IOVT_UINT32,	0 },
+	{"rxglom",	IOV_RXGLOM,	0,	IOVT_UINT32,	0 },
 #ifdef DHD_DEBUG
 	{"sdreg",	IOV_SDREG,	0,	IOVT_BUFFER,	sizeof(sdreg_t) },
 	{"sbreg",	IOV_SBREG,	0,	IOVT_BUFFER,	sizeof(sdreg_t) },
@@ -1548,6 +1566,16 @@ dhd_bus_dump(dhd_pub_t *dhdp, struct bcmstrbuf *strbuf)
 	bcm_bprintf(strbuf, "f2rx (hdrs/data) %d (%d/%d), f2tx %d f1regs %d\n",
 	            (bus->f2rxhdrs + bus->f2rxdata), bus->f2rxhdrs, bus->f2rxdata,
 	            bus->f2txdata, bus->f1regdata);
+	bcm_bprintf(strbuf, "rxglom mode %d on %d switches %d, f2rx passes %d f2tx passes %d\n",
+	            bus->rxglom_mode, bus->rxglom_on, bus->rxglom_switches,
+	            bus->f2rxpasses, bus->f2txpasses);
+	{
+		osl_rxpool_stats_t st;
+
+		osl_rxpool_stats(bus->dhd->osh, &st);
+		bcm_bprintf(strbuf, "rxpool avail %d hits %d misses %d recycled %d refilled %d\n",
+		            st.avail, st.hits, st.misses, st.recycled, st.refilled);
+	}
 	{
 		dhd_dump_pct(strbuf, "\nRx: pkts/f2rd", bus->dhd->rx_packets,
 		             (bus->f2rxhdrs + bus->f2rxdata));
@@ -1560,6 +1588,8 @@ dhd_bus_dump(dhd_pub_t *dhdp, struct bcmstrbuf *strbuf)
 		dhd_dump_pct(strbuf, "Rx: glom pct", (100 * bus->rxglompkts),
 		             bus->dhd->rx_packets);
 		dhd_dump_pct(strbuf, ", pkts/glom", bus->rxglompkts, bus->rxglomframes);
+		dhd_dump_pct(strbuf, ", pkts/pass", bus->dhd->rx_packets, bus->f2rxpasses);
+		dhd_dump_pct(strbuf, ", avg pkts/pass", bus->rxburst_avg, 16);
 		bcm_bprintf(strbuf, "\n");
 
 		dhd_dump_pct(strbuf, "Tx: pkts/f2wr", bus->dhd->tx_packets, bus->f2txdata);
@@ -1567,6 +1597,7 @@ dhd_bus_dump(dhd_pub_t *dhdp, struct bcmstrbuf *strbuf)
 		dhd_dump_pct(strbuf, ", pkts/sd", bus->dhd->tx_packets,
 		             (bus->f2txdata + bus->f1regdata));
 		dhd_dump_pct(strbuf, ", pkts/int", bus->dhd->tx_packets, bus->intrcount);
+		dhd_dump_pct(strbuf, ", pkts/pass", bus->dhd->tx_packets, bus->f2txpasses);
 		bcm_bprintf(strbuf, "\n");
 
 		dhd_dump_pct(strbuf, "Total: pkts/f2rw",
@@ -1612,6 +1643,7 @@ dhd_bus_clearcounts(dhd_pub_t *dhdp)
 	bus->tx_sderrs = bus->fc_rcvd = bus->fc_xoff = bus->fc_xon = 0;
 	bus->rxglomfail = bus->rxglomframes = bus->rxglompkts = 0;
 	bus->f2rxhdrs = bus->f2rxdata = bus->f2txdata = bus->f1regdata = 0;
+	bus->f2rxpasses = bus->f2txpasses = bus->rxglom_switches = 0;
 }
 
 #ifdef SDTEST
@@ -2093,6 +2125,21 @@ dhdsdio_doiovar(dhd_bus_t *bus, const bcm_iovar_t *vi, uint32 actionid, const ch
 	case IOV_SVAL(IOV_TXMINMAX):
 		dhd_txminmax = (uint)int_val;
 		break;
+
+	case IOV_GVAL(IOV_RXGLOM):
+		int_val = (int32)bus->rxglom_mode;
+		bcopy(&int_val, arg, val_size);
+		break;
+
+	case IOV_SVAL(IOV_RXGLOM):
+		if ((uint)int_val > DHD_RXGLOM_AUTO) {
+			bcmerror = BCME_RANGE;
+			break;
+		}
+		bus->rxglom_mode = (uint)int_val;
+		/* Apply on the next rx pass */
+		bus->rxglom_holdoff = 0;
+		break;
 #ifdef DHD_DEBUG
 
 #endif /* DHD_DEBUG */
@@ -2476,6 +2523,11 @@ dhd_bus_stop(struct dhd_bus *bus, bool enforce_mutex)
 
 	bus->glom = bus->glomd = NULL;
 
+	/* Dongle comes back up with glomming off (see dhd_preinit_ioctls) */
+	bus->rxglom_on = FALSE;
+	bus->rxburst_avg = 0;
+	bus->rxglom_holdoff = 0;
+
 	/* Clear rx control and wake any waiters */
 	bus->rxlen = 0;
 	dhd_os_ioctl_resp_wake(bus->dhd);
@@ -2811,7 +2863,7 @@ dhdsdio_rxglom(dhd_bus_t *bus, uint8 rxseq)
 			}
 
 			/* Allocate/chain packet for next subframe */
-			if ((pnext = PKTGET(osh, sublen + DHD_SDALIGN, FALSE)) == NULL) {
+			if ((pnext = PKTGET_RX(osh, sublen + DHD_SDALIGN, FALSE)) == NULL) {
 				DHD_ERROR(("%s: PKTGET failed, num %d len %d\n",
 				           __FUNCTION__, num, sublen));
 				break;
@@ -3222,7 +3274,7 @@ dhdsdio_readframes(dhd_bus_t *bus, uint maxframes, bool *finished)
 			 */
 			/* Allocate a packet buffer */
 			dhd_os_sdlock_rxq(bus->dhd);
-			if (!(pkt = PKTGET(osh, rdlen + DHD_SDALIGN, FALSE))) {
+			if (!(pkt = PKTGET_RX(osh, rdlen + DHD_SDALIGN, FALSE))) {
 				if (bus->bus == SPI_BUS) {
 					bus->usebufpool = FALSE;
 					bus->rxctl = bus->rxbuf;
@@ -3595,7 +3647,7 @@ dhdsdio_readframes(dhd_bus_t *bus, uint maxframes, bool *finished)
 		}
 
 		dhd_os_sdlock_rxq(bus->dhd);
-		if (!(pkt = PKTGET(osh, (rdlen + firstread + DHD_SDALIGN), FALSE))) {
+		if (!(pkt = PKTGET_RX(osh, (rdlen + firstread + DHD_SDALIGN), FALSE))) {
 			/* Give up on data, request rtx of events */
 			DHD_ERROR(("%s: PKTGET failed: rdlen %d chan %d\n",
 			           __FUNCTION__, rdlen, chan));
@@ -3711,6 +3763,50 @@ deliver:
 	return rxcount;
 }
 
+/* Ask the dongle to glom its rx frames into superframes while we see
+ * bursts, and to send them singly again when traffic gets sparse.
+ */
+static void
+dhdsdio_rxglom_adapt(dhd_bus_t *bus, uint framecnt)
+{
+	bool glom;
+
+	bus->f2rxpasses++;
+	bus->rxburst_avg = ((bus->rxburst_avg * 7) + (framecnt << 4)) / 8;
+
+	if (bus->rxglom_holdoff) {
+		bus->rxglom_holdoff--;
+		return;
+	}
+
+	switch (bus->rxglom_mode) {
+	case DHD_RXGLOM_OFF:
+		glom = FALSE;
+		break;
+	case DHD_RXGLOM_ON:
+		glom = TRUE;
+		break;
+	default:
+		if (bus->rxburst_avg >= DHD_RXGLOM_ON_BURST)
+			glom = TRUE;
+		else if (bus->rxburst_avg <= DHD_RXGLOM_OFF_BURST)
+			glom = FALSE;
+		else
+			return;
+		break;
+	}
+
+	if (glom == bus->rxglom_on)
+		return;
+
+	DHD_INFO(("%s: dongle glom %s, avg %d/16 frames per pass\n",
+	          __FUNCTION__, glom ? "on" : "off", bus->rxburst_avg));
+	bus->rxglom_on = glom;
+	bus->rxglom_holdoff = DHD_RXGLOM_HOLDOFF;
+	bus->rxglom_switches++;
+	dhd_os_set_rxglom(bus->dhd, glom);
+}
+
 static uint32
 dhdsdio_hostmail(dhd_bus_t *bus)
 {
@@ -3948,6 +4044,8 @@ dhdsdio_dpc(dhd_bus_t *bus)
 #endif /* CONFIG_BRCM_LGE_WL_HOSTWAKEUP */
 /* LGE_CHANGE_S [yoohoo@lge.com] 2009-11-19, Support Host Wakeup */
 		framecnt = dhdsdio_readframes(bus, rxlimit, &rxdone);
+		if (framecnt)
+			dhdsdio_rxglom_adapt(bus, framecnt);
 		if (rxdone || bus->rxskip)
 			intstatus &= ~I_HMB_FRAME_IND;
 		rxlimit -= MIN(framecnt, rxlimit);
@@ -3973,6 +4071,8 @@ clkwait:
 	    pktq_mlen(&bus->txq, ~bus->flowcontrol) && txlimit && DATAOK(bus)) {
 		framecnt = rxdone ? txlimit : MIN(txlimit, dhd_txminmax);
 		framecnt = dhdsdio_sendfromq(bus, framecnt);
+		if (framecnt)
+			bus->f2txpasses++;
 		txlimit -= framecnt;
 	}
 
@@ -4382,6 +4482,9 @@ dhd_bus_watchdog(dhd_pub_t *dhdp)
 
 	dhd_os_sdunlock(bus->dhd);
 
+	/* Top up the rx packet pool; the sdlock may be a spinlock */
+	osl_rxpool_fill(bus->dhd->osh);
+
 	return bus->ipend;
 }
 
@@ -4819,8 +4922,15 @@ dhdsdio_probe_init(dhd_bus_t *bus, osl_t *osh, void *sdh)
 	/* ...and initialize clock/power states */
 	bus->clkstate = CLK_SDONLY;
 	bus->idletime = (int32)dhd_idletime;
+	bus->rxglom_mode = MIN(dhd_rxglom, DHD_RXGLOM_AUTO);
 	bus->idleclock = DHD_IDLE_ACTIVE;
 
+	/* Enough rx packets for one full dpc pass */
+	if (dhd_rxpool &&
+	    osl_rxpool_init(osh, DHD_RXPOOL_SMALL, dhd_rxbound / 2,
+	                    DHD_RXPOOL_LARGE, dhd_rxbound) != 0)
+		DHD_ERROR(("%s: rx pool only partially filled\n", __FUNCTION__));
+
 	/* Query the SD clock speed */
 	if (bcmsdh_iovar_op(sdh, "sd_divisor", NULL, 0,
 	                    &bus->sd_divisor, sizeof(int32), FALSE) != BCME_OK) {
@@ -253,6 +253,24 @@ extern void osl_dma_unmap(osl_t *osh, uint pa, uint size, int direction);
 
 extern void *osl_pktget(osl_t *osh, uint len);
 extern void osl_pktfree(osl_t *osh, void *skb, bool send);
+
+/* Preallocated rx packets in two size classes.  PKTGET_RX takes from the
+ * smallest class that fits and falls back to PKTGET; PKTFREE hands suitable
+ * packets back to the pool.  osl_rxpool_fill tops the pool up and must be
+ * called from process context.
+ */
+#define	PKTGET_RX(osh, len, send)	osl_pktget_rx((osh), (len))
+typedef struct {
+	uint	avail;		/* Packets currently in the pool */
+	uint	hits;		/* PKTGET_RX served from the pool */
+	uint	misses;		/* PKTGET_RX that fell back to allocation */
+	uint	recycled;	/* Packets returned to the pool by PKTFREE */
+	uint	refilled;	/* Packets allocated by osl_rxpool_fill */
+} osl_rxpool_stats_t;
+extern int osl_rxpool_init(osl_t *osh, uint small_len, uint nsmall, uint large_len, uint nlarge);
+extern void osl_rxpool_fill(osl_t *osh);
+extern void osl_rxpool_stats(osl_t *osh, osl_rxpool_stats_t *stats);
+extern void *osl_pktget_rx(osl_t *osh, uint len);
 extern void *osl_pktget_static(osl_t *osh, uint len);
 extern void osl_pktfree_static(osl_t *osh, void *skb, bool send);
 extern void *osl_pktdup(osl_t *osh, void *skb);
@@ -69,6 +69,14 @@ typedef struct bcm_static_pkt {
 static bcm_static_pkt_t *bcm_static_skb = 0;
 #endif	/* USE_STATIC_SKB */
 #endif 
+#define OSL_RXPOOL_CLASSES	2	/* small, large */
+
+typedef struct osl_rxpool {
+	struct sk_buff_head q;
+	uint	len;		/* Buffer length of this class */
+	uint	target;		/* Packets kept in the pool */
+} osl_rxpool_t;
+
 typedef struct bcm_mem_link {
 	struct bcm_mem_link *prev;
 	struct bcm_mem_link *next;
@@ -85,6 +93,8 @@ struct osl_info {
 	uint failed;
 	uint bustype;
 	bcm_mem_link_t *dbgmem_list;
+	osl_rxpool_t rxpool[OSL_RXPOOL_CLASSES];
+	osl_rxpool_stats_t rxstats;
 };
 
 static int16 linuxbcmerrormap[] =
@@ -175,6 +185,8 @@ osl_attach(void *pdev, uint bustype, bool pkttag)
 	osh->pdev = pdev;
 	osh->pub.pkttag = pkttag;
 	osh->bustype = bustype;
+	skb_queue_head_init(&osh->rxpool[0].q);
+	skb_queue_head_init(&osh->rxpool[1].q);
 
 	switch (bustype) {
 		case PCI_BUS:
@@ -246,6 +258,8 @@ osl_detach(osl_t *osh)
 	}
 #endif	/* USE_STATIC_SKB */
 #endif 
+	skb_queue_purge(&osh->rxpool[0].q);
+	skb_queue_purge(&osh->rxpool[1].q);
 	ASSERT(osh->magic == OS_HANDLE_MAGIC);
 	kfree(osh);
 }
@@ -268,6 +282,97 @@ osl_pktget(osl_t *osh, uint len)
 }
 
 
+int
+osl_rxpool_init(osl_t *osh, uint small_len, uint nsmall, uint large_len, uint nlarge)
+{
+	ASSERT(small_len <= large_len);
+
+	osh->rxpool[0].len = small_len;
+	osh->rxpool[0].target = nsmall;
+	osh->rxpool[1].len = large_len;
+	osh->rxpool[1].target = nlarge;
+
+	osl_rxpool_fill(osh);
+
+	return (skb_queue_len(&osh->rxpool[0].q) == nsmall &&
+	        skb_queue_len(&osh->rxpool[1].q) == nlarge) ? 0 : BCME_NOMEM;
+}
+
+void
+osl_rxpool_fill(osl_t *osh)
+{
+	osl_rxpool_t *pool;
+	struct sk_buff *skb;
+	int i;
+
+	/* Filling is what keeps GFP_ATOMIC off the rx path */
+	if (in_atomic())
+		return;
+
+	for (i = 0; i < OSL_RXPOOL_CLASSES; i++) {
+		pool = &osh->rxpool[i];
+		while (skb_queue_len(&pool->q) < pool->target) {
+			if (!(skb = __dev_alloc_skb(pool->len, GFP_KERNEL)))
+				return;
+			skb_queue_tail(&pool->q, skb);
+			osh->rxstats.refilled++;
+		}
+	}
+}
+
+void
+osl_rxpool_stats(osl_t *osh, osl_rxpool_stats_t *stats)
+{
+	*stats = osh->rxstats;
+	stats->avail = skb_queue_len(&osh->rxpool[0].q) + skb_queue_len(&osh->rxpool[1].q);
+}
+
+void*
+osl_pktget_rx(osl_t *osh, uint len)
+{
+	struct sk_buff *skb;
+	int i;
+
+	for (i = 0; i < OSL_RXPOOL_CLASSES; i++) {
+		if (len > osh->rxpool[i].len)
+			continue;
+		if ((skb = skb_dequeue(&osh->rxpool[i].q))) {
+			skb_put(skb, len);
+			skb->priority = 0;
+			osh->pub.pktalloced++;
+			osh->rxstats.hits++;
+			return ((void*) skb);
+		}
+	}
+
+	osh->rxstats.misses++;
+	return osl_pktget(osh, len);
+}
+
+/* Put a packet being freed back into the largest class it can serve */
+static bool
+osl_rxpool_put(osl_t *osh, struct sk_buff *skb)
+{
+	osl_rxpool_t *pool;
+	int i;
+
+	for (i = OSL_RXPOOL_CLASSES - 1; i >= 0; i--) {
+		pool = &osh->rxpool[i];
+		if (!pool->target ||
+		    (skb_end_pointer(skb) - skb->head) < SKB_DATA_ALIGN(pool->len + NET_SKB_PAD))
+			continue;
+		if (skb_queue_len(&pool->q) >= pool->target)
+			return FALSE;
+		if (!skb_recycle_check(skb, pool->len))
+			return FALSE;
+		skb_queue_tail(&pool->q, skb);
+		osh->rxstats.recycled++;
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
 void
 osl_pktfree(osl_t *osh, void *p, bool send)
 {
@@ -283,6 +388,11 @@ osl_pktfree(osl_t *osh, void *p, bool send)
 		nskb = skb->next;
 		skb->next = NULL;
 
+		if (osl_rxpool_put(osh, skb)) {
+			osh->pub.pktalloced--;
+			skb = nskb;
+			continue;
+		}
 
 		if (skb->destructor) {
 			
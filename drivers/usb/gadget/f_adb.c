@@ -28,9 +28,30 @@
 #include <linux/miscdevice.h>
 
 #define ADB_BULK_BUFFER_SIZE           4096
+#define ADB_MAX_REQ_LEN                (128 * 1024)
 
-/* number of tx requests to allocate */
-#define TX_REQ_MAX 4
+/* most tx requests we will allocate */
+#define TX_REQ_MAX 16
+
+/*
+ * Size and number of the bulk requests.  adbd writes a packet header and
+ * its payload back to back, so a deeper tx queue lets it stay ahead of
+ * the host during pull and sync.  The rx request is sized for the
+ * largest read adbd may post.  16K is the most msm72k_udc takes per
+ * request; if the buffers can't be allocated at bind time we fall back
+ * to ADB_BULK_BUFFER_SIZE.
+ */
+static unsigned int adb_tx_req_len = 16384;
+module_param(adb_tx_req_len, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(adb_tx_req_len, "Size of ADB bulk in requests");
+
+static unsigned int adb_rx_req_len = 16384;
+module_param(adb_rx_req_len, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(adb_rx_req_len, "Size of ADB bulk out request");
+
+static unsigned int adb_tx_reqs = 8;
+module_param(adb_tx_reqs, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(adb_tx_reqs, "Number of ADB bulk in requests");
 
 static const char adb_shortname[] = "android_adb";
 
@@ -55,6 +76,9 @@ struct adb_dev {
 	wait_queue_head_t write_wq;
 	struct usb_request *rx_req;
 	int rx_done;
+
+	unsigned tx_req_len;
+	unsigned rx_req_len;
 };
 
 static struct usb_interface_descriptor adb_interface_desc = {
@@ -121,6 +145,14 @@ static inline struct adb_dev *func_to_adb(struct usb_function *f)
 }
 
 
+/* largest bulk request the UDC will take, msm72k_udc queues one dTD */
+static unsigned adb_max_req_len(struct usb_gadget *gadget)
+{
+	if (gadget_is_msm72k(gadget))
+		return 16384;
+	return ADB_MAX_REQ_LEN;
+}
+
 static struct usb_request *adb_request_new(struct usb_ep *ep, int buffer_size)
 {
 	struct usb_request *req = usb_ep_alloc_request(ep, GFP_KERNEL);
@@ -241,16 +273,31 @@ static int adb_create_bulk_endpoints(struct adb_dev *dev,
 	dev->ep_out = ep;
 
 	/* now allocate requests for our endpoints */
-	req = adb_request_new(dev->ep_out, ADB_BULK_BUFFER_SIZE);
-	if (!req)
-		goto fail;
+	dev->rx_req_len = clamp(adb_rx_req_len, (unsigned)ADB_BULK_BUFFER_SIZE,
+				adb_max_req_len(cdev->gadget));
+	req = adb_request_new(dev->ep_out, dev->rx_req_len);
+	if (!req) {
+		dev->rx_req_len = ADB_BULK_BUFFER_SIZE;
+		req = adb_request_new(dev->ep_out, dev->rx_req_len);
+		if (!req)
+			goto fail;
+	}
 	req->complete = adb_complete_out;
 	dev->rx_req = req;
 
-	for (i = 0; i < TX_REQ_MAX; i++) {
-		req = adb_request_new(dev->ep_in, ADB_BULK_BUFFER_SIZE);
-		if (!req)
-			goto fail;
+	dev->tx_req_len = clamp(adb_tx_req_len, (unsigned)ADB_BULK_BUFFER_SIZE,
+				adb_max_req_len(cdev->gadget));
+retry_tx_alloc:
+	for (i = 0; i < clamp(adb_tx_reqs, 1U, (unsigned)TX_REQ_MAX); i++) {
+		req = adb_request_new(dev->ep_in, dev->tx_req_len);
+		if (!req) {
+			if (dev->tx_req_len == ADB_BULK_BUFFER_SIZE)
+				goto fail;
+			while ((req = adb_req_get(dev, &dev->tx_idle)))
+				adb_request_free(req, dev->ep_in);
+			dev->tx_req_len = ADB_BULK_BUFFER_SIZE;
+			goto retry_tx_alloc;
+		}
 		req->complete = adb_complete_in;
 		adb_req_put(dev, &dev->tx_idle, req);
 	}
@@ -274,9 +321,6 @@ static ssize_t adb_read(struct file *fp, char __user *buf,
 	if (!_adb_dev)
 		return -ENODEV;
 
-	if (count > ADB_BULK_BUFFER_SIZE)
-		return -EINVAL;
-
 	if (adb_lock(&dev->read_excl))
 		return -EBUSY;
 
@@ -295,6 +339,11 @@ static ssize_t adb_read(struct file *fp, char __user *buf,
 		r = -EIO;
 		goto done;
 	}
+	/* the request is only sized once the function is bound */
+	if (count > dev->rx_req_len) {
+		r = -EINVAL;
+		goto done;
+	}
 
 requeue_req:
 	/* queue a request */
@@ -372,8 +421,8 @@ static ssize_t adb_write(struct file *fp, const char __user *buf,
 		}
 
 		if (req != 0) {
-			if (count > ADB_BULK_BUFFER_SIZE)
-				xfer = ADB_BULK_BUFFER_SIZE;
+			if (count > dev->tx_req_len)
+				xfer = dev->tx_req_len;
 			else
 				xfer = count;
 			if (copy_from_user(req->buf, buf, xfer)) {
@@ -316,6 +316,30 @@ static const char fsg_string_interface[] = "Mass Storage";
 static int write_error_after_csw_sent;
 static int csw_hack_sent;
 #endif
+
+/*
+ * Depth and size of the data buffer ring.  More and larger buffers let
+ * the USB transfers and the backing file I/O overlap further.  Both are
+ * read when the function is bound.
+ */
+static unsigned int fsg_num_buffers = CONFIG_USB_GADGET_STORAGE_NUM_BUFFERS;
+module_param(fsg_num_buffers, uint, S_IRUGO);
+MODULE_PARM_DESC(fsg_num_buffers, "Number of mass storage data buffers");
+
+#define FSG_MAX_BUFLEN	((u32)131072)
+
+static unsigned int fsg_buflen = CONFIG_USB_GADGET_STORAGE_BUFLEN;
+module_param(fsg_buflen, uint, S_IRUGO);
+MODULE_PARM_DESC(fsg_buflen, "Size of each mass storage data buffer");
+
+/* Initial direct_io setting of the LUNs */
+#ifdef CONFIG_USB_GADGET_STORAGE_DIRECT_IO
+static int fsg_direct_io = 1;
+#else
+static int fsg_direct_io;
+#endif
+module_param(fsg_direct_io, bool, S_IRUGO);
+MODULE_PARM_DESC(fsg_direct_io, "Bypass the page cache for block devices");
 /*-------------------------------------------------------------------------*/
 
 struct fsg_dev;
@@ -366,7 +390,9 @@ struct fsg_common {
 
 	struct fsg_buffhd	*next_buffhd_to_fill;
 	struct fsg_buffhd	*next_buffhd_to_drain;
-	struct fsg_buffhd	buffhds[FSG_NUM_BUFFERS];
+	struct fsg_buffhd	*buffhds;
+	unsigned int		num_buffers;
+	unsigned int		buflen;
 
 	int			cmnd_size;
 	u8			cmnd[MAX_COMMAND_SIZE];
@@ -738,6 +764,136 @@ static int sleep_thread(struct fsg_common *common)
 }
 
 
+/*-------------------------------------------------------------------------*/
+
+/*
+ * Direct I/O for LUNs backed by a block device.  The data buffers are
+ * physically contiguous kmalloc() memory, so they can go straight into
+ * bios instead of being copied through the page cache by vfs_read() and
+ * vfs_write().
+ */
+
+struct fsg_dio {
+	atomic_t		pending;
+	int			error;
+	struct completion	done;
+};
+
+static void fsg_dio_end_io(struct bio *bio, int err)
+{
+	struct fsg_dio *dio = bio->bi_private;
+
+	if (err)
+		dio->error = err;
+	else if (!test_bit(BIO_UPTODATE, &bio->bi_flags))
+		dio->error = -EIO;
+	bio_put(bio);
+
+	if (atomic_dec_and_test(&dio->pending))
+		complete(&dio->done);
+}
+
+static int fsg_lun_use_dio(struct fsg_lun *curlun, loff_t offset,
+			   unsigned int amount)
+{
+	struct address_space *mapping = curlun->filp->f_mapping;
+
+	if (!curlun->direct_io || !S_ISBLK(mapping->host->i_mode) ||
+	    ((offset | amount) &
+	     (bdev_logical_block_size(I_BDEV(mapping->host)) - 1)))
+		return 0;
+
+	/*
+	 * Anything written through the page cache before has to reach the
+	 * device first, and whatever is cached goes stale from now on.
+	 */
+	if (!curlun->dio_active) {
+		filemap_write_and_wait(mapping);
+		invalidate_mapping_pages(mapping, 0, -1);
+		curlun->dio_active = 1;
+	}
+
+	return 1;
+}
+
+/*
+ * A request the direct path can't take goes through the page cache, which
+ * the direct path never looks at.  Write back and drop what it left there
+ * so that later direct I/O neither misses it nor leaves it stale.
+ */
+static void fsg_lun_dio_drop_cached(struct fsg_lun *curlun, loff_t offset,
+				    unsigned int amount)
+{
+	struct address_space *mapping = curlun->filp->f_mapping;
+
+	if (!curlun->dio_active || !amount)
+		return;
+
+	filemap_write_and_wait_range(mapping, offset, offset + amount - 1);
+	invalidate_mapping_pages(mapping, offset >> PAGE_CACHE_SHIFT,
+				 (offset + amount - 1) >> PAGE_CACHE_SHIFT);
+}
+
+static ssize_t fsg_lun_dio(struct fsg_lun *curlun, int rw, void *buf,
+			   unsigned int amount, loff_t offset)
+{
+	struct block_device *bdev = I_BDEV(curlun->filp->f_mapping->host);
+	struct bio *bio = NULL;
+	struct fsg_dio dio;
+	unsigned int done = 0;
+
+	atomic_set(&dio.pending, 1);
+	dio.error = 0;
+	init_completion(&dio.done);
+
+	while (done < amount) {
+		void *p = buf + done;
+		unsigned int len = min_t(unsigned int, amount - done,
+					 PAGE_SIZE - offset_in_page(p));
+
+		if (!bio) {
+			bio = bio_alloc(GFP_NOIO,
+				DIV_ROUND_UP(amount - done, PAGE_SIZE) + 1);
+			if (!bio) {
+				dio.error = -ENOMEM;
+				break;
+			}
+			bio->bi_bdev = bdev;
+			bio->bi_sector = (offset + done) >> 9;
+			bio->bi_end_io = fsg_dio_end_io;
+			bio->bi_private = &dio;
+		}
+
+		if (bio_add_page(bio, virt_to_page(p), len,
+				 offset_in_page(p)) == len) {
+			done += len;
+			continue;
+		}
+
+		/* The queue won't take more, send what we have so far */
+		if (!bio->bi_vcnt) {
+			bio_put(bio);
+			bio = NULL;
+			dio.error = -EIO;
+			break;
+		}
+		atomic_inc(&dio.pending);
+		submit_bio(rw, bio);
+		bio = NULL;
+	}
+
+	if (bio) {
+		atomic_inc(&dio.pending);
+		submit_bio(rw, bio);
+	}
+
+	if (!atomic_dec_and_test(&dio.pending))
+		wait_for_completion(&dio.done);
+
+	return dio.error ? dio.error : amount;
+}
+
+
 /*-------------------------------------------------------------------------*/
 
 static int do_read(struct fsg_common *common)
@@ -796,7 +952,7 @@ static int do_read(struct fsg_common *common)
 		 * If this means reading 0 then we were asked to read past
 		 *	the end of file.
 		 */
-		amount = min(amount_left, FSG_BUFLEN);
+		amount = min(amount_left, common->buflen);
 		amount = min((loff_t)amount,
 			     curlun->file_length - file_offset);
 		partial_page = file_offset & (PAGE_CACHE_SIZE - 1);
@@ -832,9 +988,15 @@ static int do_read(struct fsg_common *common)
 #ifdef CONFIG_USB_MSC_PROFILING
 		start = ktime_get();
 #endif
-		nread = vfs_read(curlun->filp,
-				 (char __user *)bh->buf,
-				 amount, &file_offset_tmp);
+		if (fsg_lun_use_dio(curlun, file_offset, amount)) {
+			nread = fsg_lun_dio(curlun, READ, bh->buf, amount,
+					    file_offset);
+		} else {
+			nread = vfs_read(curlun->filp,
+					 (char __user *)bh->buf,
+					 amount, &file_offset_tmp);
+			fsg_lun_dio_drop_cached(curlun, file_offset, amount);
+		}
 		VLDBG(curlun, "file read %u @ %llu -> %d\n", amount,
 		     (unsigned long long) file_offset, (int) nread);
 #ifdef CONFIG_USB_MSC_PROFILING
@@ -965,7 +1127,7 @@ static int do_write(struct fsg_common *common)
 			 *	to write past the end of file.
 			 * Finally, round down to a block boundary.
 			 */
-			amount = min(amount_left_to_req, FSG_BUFLEN);
+			amount = min(amount_left_to_req, common->buflen);
 			amount = min((loff_t)amount,
 				     curlun->file_length - usb_offset);
 			partial_page = usb_offset & (PAGE_CACHE_SIZE - 1);
@@ -1054,9 +1216,18 @@ static int do_write(struct fsg_common *common)
 #ifdef CONFIG_USB_MSC_PROFILING
 			start = ktime_get();
 #endif
-			nwritten = vfs_write(curlun->filp,
-					     (char __user *)bh->buf,
-					     amount, &file_offset_tmp);
+			if (fsg_lun_use_dio(curlun, file_offset, amount)) {
+				nwritten = fsg_lun_dio(curlun,
+					(curlun->filp->f_flags & O_SYNC) ?
+					WRITE_FUA : WRITE,
+					bh->buf, amount, file_offset);
+			} else {
+				nwritten = vfs_write(curlun->filp,
+						     (char __user *)bh->buf,
+						     amount, &file_offset_tmp);
+				fsg_lun_dio_drop_cached(curlun, file_offset,
+							amount);
+			}
 			VLDBG(curlun, "file write %u @ %llu -> %d\n", amount,
 			      (unsigned long long)file_offset, (int)nwritten);
 #ifdef CONFIG_USB_MSC_PROFILING
@@ -1106,12 +1277,13 @@ write_error:
 				 * yet from the host. So there is no point in
 				 * csw right away without the complete data.
 				 */
-				for (i = 0; i < FSG_NUM_BUFFERS; i++) {
+				for (i = 0; i < common->num_buffers; i++) {
 					if (common->buffhds[i].state ==
 							BUF_STATE_BUSY)
 						break;
 				}
-				if (!amount_left_to_req && i == FSG_NUM_BUFFERS) {
+				if (!amount_left_to_req &&
+				    i == common->num_buffers) {
 					csw_hack_sent = 1;
 					send_status(common);
 				}
@@ -1220,7 +1392,7 @@ static int do_verify(struct fsg_common *common)
 		 * If this means reading 0 then we were asked to read
 		 * past the end of file.
 		 */
-		amount = min(amount_left, FSG_BUFLEN);
+		amount = min(amount_left, common->buflen);
 		amount = min((loff_t)amount,
 			     curlun->file_length - file_offset);
 		if (amount == 0) {
@@ -1449,7 +1621,7 @@ static int do_mode_sense(struct fsg_common *common, struct fsg_buffhd *bh)
 	} else {			/* MODE_SENSE_10 */
 		buf[3] = (curlun->ro ? 0x80 : 0x00);		/* WP, DPOFUA */
 		buf += 8;
-		limit = 65535;		/* Should really be FSG_BUFLEN */
+		limit = 65535;		/* Should really be common->buflen */
 	}
 
 	/* No block descriptors */
@@ -1688,7 +1860,7 @@ static int throw_away_data(struct fsg_common *common)
 		bh = common->next_buffhd_to_fill;
 		if (bh->state == BUF_STATE_EMPTY
 		 && common->usb_amount_left > 0) {
-			amount = min(common->usb_amount_left, FSG_BUFLEN);
+			amount = min(common->usb_amount_left, common->buflen);
 
 			/*
 			 * amount is always divisible by 512, hence by
@@ -2441,7 +2613,7 @@ reset:
 	if (common->fsg) {
 		fsg = common->fsg;
 
-		for (i = 0; i < FSG_NUM_BUFFERS; ++i) {
+		for (i = 0; i < common->num_buffers; ++i) {
 			struct fsg_buffhd *bh = &common->buffhds[i];
 
 			if (bh->inreq) {
@@ -2468,7 +2640,7 @@ reset:
 
 
 	/* Allocate the requests */
-	for (i = 0; i < FSG_NUM_BUFFERS; ++i) {
+	for (i = 0; i < common->num_buffers; ++i) {
 		struct fsg_buffhd	*bh = &common->buffhds[i];
 
 		rc = alloc_request(common, fsg->bulk_in, &bh->inreq);
@@ -2572,7 +2744,7 @@ static void handle_exception(struct fsg_common *common)
 
 	/* Cancel all the pending transfers */
 	if (likely(common->fsg)) {
-		for (i = 0; i < FSG_NUM_BUFFERS; ++i) {
+		for (i = 0; i < common->num_buffers; ++i) {
 			bh = &common->buffhds[i];
 			if (bh->inreq_busy)
 				usb_ep_dequeue(common->fsg->bulk_in, bh->inreq);
@@ -2584,7 +2756,7 @@ static void handle_exception(struct fsg_common *common)
 		/* Wait until everything is idle */
 		for (;;) {
 			int num_active = 0;
-			for (i = 0; i < FSG_NUM_BUFFERS; ++i) {
+			for (i = 0; i < common->num_buffers; ++i) {
 				bh = &common->buffhds[i];
 				num_active += bh->inreq_busy + bh->outreq_busy;
 			}
@@ -2607,7 +2779,7 @@ static void handle_exception(struct fsg_common *common)
 	 */
 	spin_lock_irq(&common->lock);
 
-	for (i = 0; i < FSG_NUM_BUFFERS; ++i) {
+	for (i = 0; i < common->num_buffers; ++i) {
 		bh = &common->buffhds[i];
 		bh->state = BUF_STATE_EMPTY;
 	}
@@ -2790,10 +2962,46 @@ static int fsg_main_thread(void *common_)
 
 /*************************** DEVICE ATTRIBUTES ***************************/
 
+static ssize_t fsg_show_direct_io(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct fsg_lun	*curlun = fsg_lun_from_dev(dev);
+
+	return sprintf(buf, "%u\n", curlun->direct_io);
+}
+
+static ssize_t fsg_store_direct_io(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t count)
+{
+	struct fsg_lun		*curlun = fsg_lun_from_dev(dev);
+	struct rw_semaphore	*filesem = dev_get_drvdata(dev);
+	unsigned		direct_io;
+	int			ret;
+
+	ret = kstrtouint(buf, 2, &direct_io);
+	if (ret)
+		return ret;
+
+	down_write(filesem);
+	/* The page cache missed every direct write, drop it */
+	if (!direct_io && curlun->dio_active) {
+		if (fsg_lun_is_open(curlun))
+			invalidate_mapping_pages(curlun->filp->f_mapping,
+						 0, -1);
+		curlun->dio_active = 0;
+	}
+	curlun->direct_io = direct_io;
+	up_write(filesem);
+
+	return count;
+}
+
 /* Write permission is checked per LUN in store_*() functions. */
 static DEVICE_ATTR(ro, 0644, fsg_show_ro, fsg_store_ro);
 static DEVICE_ATTR(nofua, 0644, fsg_show_nofua, fsg_store_nofua);
 static DEVICE_ATTR(file, 0644, fsg_show_file, fsg_store_file);
+static DEVICE_ATTR(direct_io, 0644, fsg_show_direct_io, fsg_store_direct_io);
 #ifdef CONFIG_USB_MSC_PROFILING
 static DEVICE_ATTR(perf, 0644, fsg_show_perf, fsg_store_perf);
 #endif
@@ -2882,6 +3090,7 @@ static struct fsg_common *fsg_common_init(struct fsg_common *common,
 		curlun->initially_ro = curlun->ro;
 		curlun->removable = lcfg->removable;
 		curlun->nofua = lcfg->nofua;
+		curlun->direct_io = fsg_direct_io;
 		curlun->dev.release = fsg_lun_release;
 		curlun->dev.parent = &gadget->dev;
 		/* curlun->dev.driver = &fsg_driver.driver; XXX */
@@ -2909,6 +3118,9 @@ static struct fsg_common *fsg_common_init(struct fsg_common *common,
 		rc = device_create_file(&curlun->dev, &dev_attr_nofua);
 		if (rc)
 			goto error_luns;
+		rc = device_create_file(&curlun->dev, &dev_attr_direct_io);
+		if (rc)
+			goto error_luns;
 #ifdef CONFIG_USB_MSC_PROFILING
 		rc = device_create_file(&curlun->dev, &dev_attr_perf);
 		if (rc)
@@ -2928,14 +3140,30 @@ static struct fsg_common *fsg_common_init(struct fsg_common *common,
 	common->nluns = nluns;
 
 	/* Data buffers cyclic list */
+	common->num_buffers = clamp(fsg_num_buffers, 2U, 32U);
+	common->buflen = fsg_buflen;
+	if (common->buflen < FSG_BUFLEN || common->buflen > FSG_MAX_BUFLEN ||
+	    (common->buflen & (PAGE_SIZE - 1))) {
+		WARNING(common, "invalid buffer length %u, using %u\n",
+			common->buflen, FSG_BUFLEN);
+		common->buflen = FSG_BUFLEN;
+	}
+
+	common->buffhds = kcalloc(common->num_buffers,
+				  sizeof(*common->buffhds), GFP_KERNEL);
+	if (unlikely(!common->buffhds)) {
+		rc = -ENOMEM;
+		goto error_release;
+	}
+
 	bh = common->buffhds;
-	i = FSG_NUM_BUFFERS;
+	i = common->num_buffers;
 	goto buffhds_first_it;
 	do {
 		bh->next = bh + 1;
 		++bh;
 buffhds_first_it:
-		bh->buf = kmalloc(FSG_BUFLEN, GFP_KERNEL);
+		bh->buf = kmalloc(common->buflen, GFP_KERNEL);
 		if (unlikely(!bh->buf)) {
 			rc = -ENOMEM;
 			goto error_release;
@@ -3046,6 +3274,7 @@ static void fsg_common_release(struct kref *ref)
 #ifdef CONFIG_USB_MSC_PROFILING
 			device_remove_file(&lun->dev, &dev_attr_perf);
 #endif
+			device_remove_file(&lun->dev, &dev_attr_direct_io);
 			device_remove_file(&lun->dev, &dev_attr_nofua);
 			device_remove_file(&lun->dev, &dev_attr_ro);
 			device_remove_file(&lun->dev, &dev_attr_file);
@@ -3056,12 +3285,13 @@ static void fsg_common_release(struct kref *ref)
 		kfree(common->luns);
 	}
 
-	{
+	if (common->buffhds) {
 		struct fsg_buffhd *bh = common->buffhds;
-		unsigned i = FSG_NUM_BUFFERS;
+		unsigned i = common->num_buffers;
 		do {
 			kfree(bh->buf);
 		} while (++bh, --i);
+		kfree(common->buffhds);
 	}
 
 	if (common->free_storage_on_release)
@@ -30,6 +30,7 @@
 #include <linux/etherdevice.h>
 
 #include <asm/atomic.h>
+#include <asm/unaligned.h>
 
 #include "u_ether.h"
 #include "rndis.h"
@@ -105,6 +106,22 @@ static inline struct f_rndis *func_to_rndis(struct usb_function *f)
 	return container_of(f, struct f_rndis, port.func);
 }
 
+/*
+ * RNDIS lets either side pack several packet messages into one USB
+ * transfer.  We advertise rndis_ul_max_pkt_per_xfer to the host, and
+ * pack up to rndis_dl_max_pkt_per_xfer ourselves when the host's
+ * MaxTransferSize allows it.  1 keeps the one-packet-per-transfer model.
+ */
+static unsigned int rndis_ul_max_pkt_per_xfer = 3;
+module_param(rndis_ul_max_pkt_per_xfer, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(rndis_ul_max_pkt_per_xfer,
+	"Maximum packets per transfer from the host");
+
+static unsigned int rndis_dl_max_pkt_per_xfer = 3;
+module_param(rndis_dl_max_pkt_per_xfer, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(rndis_dl_max_pkt_per_xfer,
+	"Maximum packets per transfer to the host");
+
 /* peak (theoretical) bulk transfer rate in bits-per-second */
 static unsigned int bitrate(struct usb_gadget *g)
 {
@@ -311,14 +328,14 @@ static struct usb_gadget_strings *rndis_strings[] = {
 static struct sk_buff *rndis_add_header(struct gether *port,
 					struct sk_buff *skb)
 {
-	struct sk_buff *skb2;
-
-	skb2 = skb_realloc_headroom(skb, sizeof(struct rndis_packet_msg_type));
-	if (skb2)
-		rndis_add_hdr(skb2);
+	/* only copy if there's no headroom or the header is shared */
+	if (skb_cow_head(skb, sizeof(struct rndis_packet_msg_type))) {
+		dev_kfree_skb_any(skb);
+		return NULL;
+	}
 
-	dev_kfree_skb_any(skb);
-	return skb2;
+	rndis_add_hdr(skb);
+	return skb;
 }
 
 static void rndis_response_available(void *_rndis)
@@ -399,6 +416,15 @@ static void rndis_command_complete(struct usb_ep *ep, struct usb_request *req)
 		ERROR(cdev, "RNDIS command error %d, %d/%d\n",
 			status, req->actual, req->length);
 //	spin_unlock(&dev->lock);
+
+	/* the host tells us how big a transfer it takes in INITIALIZE */
+	if (req->actual >= 4 && get_unaligned_le32(req->buf)
+			== REMOTE_NDIS_INITIALIZE_MSG) {
+		rndis->port.dl_max_xfer_size =
+			rndis_get_dl_max_xfer_size(rndis->config);
+		DBG(cdev, "RNDIS host MaxTransferSize %u\n",
+			rndis->port.dl_max_xfer_size);
+	}
 }
 
 static int
@@ -555,6 +581,7 @@ static void rndis_disable(struct usb_function *f)
 
 	rndis_uninit(rndis->config);
 	gether_disconnect(&rndis->port);
+	rndis->port.dl_max_xfer_size = 0;
 
 	usb_ep_disable(rndis->notify);
 	rndis->notify->driver_data = NULL;
@@ -707,6 +734,8 @@ rndis_bind(struct usb_configuration *c, struct usb_function *f)
 
 	rndis_set_param_medium(rndis->config, NDIS_MEDIUM_802_3, 0);
 	rndis_set_host_mac(rndis->config, rndis->ethaddr);
+	rndis_set_max_pkt_xfer(rndis->config,
+			       rndis->port.ul_max_pkts_per_xfer);
 
 	if (rndis_set_param_vendor(rndis->config, rndis->vendorID,
 				   rndis->manufacturer))
@@ -843,6 +872,9 @@ rndis_bind_config(struct usb_configuration *c, u8 ethaddr[ETH_ALEN],
 	rndis->port.header_len = sizeof(struct rndis_packet_msg_type);
 	rndis->port.wrap = rndis_add_header;
 	rndis->port.unwrap = rndis_rm_hdr;
+	rndis->port.ul_max_pkts_per_xfer =
+		clamp(rndis_ul_max_pkt_per_xfer, 1U, 255U);
+	rndis->port.dl_max_pkts_per_xfer = max(rndis_dl_max_pkt_per_xfer, 1U);
 
 	rndis->port.func.name = "rndis";
 	rndis->port.func.strings = rndis_strings;
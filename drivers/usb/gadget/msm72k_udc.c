@@ -24,6 +24,7 @@
 
 #include <linux/delay.h>
 #include <linux/timer.h>
+#include <linux/ktime.h>
 #include <linux/interrupt.h>
 #include <linux/dma-mapping.h>
 #include <linux/dmapool.h>
@@ -142,6 +143,16 @@ struct msm_endpoint {
 	unsigned long false_prime_fail_count;
 	unsigned actual_prime_fail_count;
 
+	/* transfer statistics, reported through debugfs ept_stats */
+	unsigned long req_count;
+	unsigned long prime_count;
+	unsigned long chain_count;
+	u64 bytes;
+	ktime_t prime_time;
+	u64 prime_lat_total;
+	unsigned long prime_lat_count;
+	unsigned prime_lat_max;
+
 	unsigned wedged:1;
 	/* pointers to DMA transfer list area */
 	/* these are allocated from the usb_info dma space */
@@ -675,6 +686,26 @@ out:
 	spin_unlock_irqrestore(&ui->lock, flags);
 }
 
+static void usb_ept_fill_item(struct msm_request *req, int last)
+{
+	unsigned info = INFO_BYTES(req->req.length) | INFO_ACTIVE;
+
+	/* the last dTD of a list always interrupts, so that requests
+	 * queued with no_interrupt are still retired by the one behind
+	 */
+	if (last || !req->req.no_interrupt)
+		info |= INFO_IOC;
+
+	req->live = 1;
+	/* prepare the transaction descriptor item for the hardware */
+	req->item->info = info;
+	req->item->page0 = req->dma;
+	req->item->page1 = (req->dma + 0x1000) & 0xfffff000;
+	req->item->page2 = (req->dma + 0x2000) & 0xfffff000;
+	req->item->page3 = (req->dma + 0x3000) & 0xfffff000;
+	req->item->page4 = (req->dma + 0x4000) & 0xfffff000;
+}
+
 static void usb_ept_start(struct msm_endpoint *ept)
 {
 	struct usb_info *ui = ept->ui;
@@ -684,14 +715,7 @@ static void usb_ept_start(struct msm_endpoint *ept)
 	BUG_ON(req->live);
 
 	while (req) {
-		req->live = 1;
-		/* prepare the transaction descriptor item for the hardware */
-		req->item->info =
-			INFO_BYTES(req->req.length) | INFO_IOC | INFO_ACTIVE;
-		req->item->page0 = req->dma;
-		req->item->page1 = (req->dma + 0x1000) & 0xfffff000;
-		req->item->page2 = (req->dma + 0x2000) & 0xfffff000;
-		req->item->page3 = (req->dma + 0x3000) & 0xfffff000;
+		usb_ept_fill_item(req, req->next == NULL);
 
 		if (req->next == NULL) {
 			req->item->next = TERMINATE;
@@ -717,6 +741,57 @@ static void usb_ept_start(struct msm_endpoint *ept)
 	 */
 	writel_relaxed(n, USB_ENDPTPRIME);
 	mod_timer(&ept->prime_timer, EPT_PRIME_CHECK_DELAY);
+
+	ept->prime_count++;
+	ept->prime_time = ktime_get();
+}
+
+/*
+ * Link req behind the last live dTD while the controller may still be
+ * walking the list, so it is picked up without a completion interrupt
+ * and a fresh prime in between.  Follows the "add dTD to a non-empty
+ * list" sequence of the databook: if neither ENDPTPRIME nor (sampled
+ * under the ATDTW tripwire) ENDPTSTAT shows the endpoint as active, the
+ * controller has already retired the list and the link is undone; the
+ * request is then started from handle_endpoint() as before.
+ */
+static int usb_ept_append(struct msm_endpoint *ept, struct msm_request *req)
+{
+	struct usb_info *ui = ept->ui;
+	struct msm_request *last = ept->last;
+	unsigned n = 1 << ept->bit;
+	unsigned stat;
+
+	usb_ept_fill_item(req, 1);
+	req->item->next = TERMINATE;
+
+	/* the new dTD must be visible before the controller can follow it */
+	wmb();
+	last->item->next = req->item_dma;
+	mb();
+
+	if (readl_relaxed(USB_ENDPTPRIME) & n)
+		goto linked;
+
+	do {
+		writel_relaxed(readl_relaxed(USB_USBCMD) | USBCMD_ATDTW,
+			       USB_USBCMD);
+		stat = readl_relaxed(USB_ENDPTSTAT);
+	} while (!(readl_relaxed(USB_USBCMD) & USBCMD_ATDTW));
+	writel_relaxed(readl_relaxed(USB_USBCMD) & ~USBCMD_ATDTW, USB_USBCMD);
+
+	if (stat & n)
+		goto linked;
+
+	last->item->next = TERMINATE;
+	req->item->info = 0;
+	req->live = 0;
+	mb();
+	return 0;
+
+linked:
+	ept->chain_count++;
+	return 1;
 }
 
 int usb_ept_queue_xfer(struct msm_endpoint *ept, struct usb_request *_req)
@@ -782,10 +857,13 @@ int usb_ept_queue_xfer(struct msm_endpoint *ept, struct usb_request *_req)
 	/* Add the new request to the end of the queue */
 	last = ept->last;
 	if (last) {
-		/* Already requests in the queue. add us to the
-		 * end, but let the completion interrupt actually
-		 * start things going, to avoid hw issues
+		/* Already requests in the queue. If the hardware
+		 * is still working on them, chain our dTD behind
+		 * the last one; otherwise add us to the end and
+		 * let the completion interrupt start things going.
 		 */
+		if (last->live)
+			usb_ept_append(ept, req);
 		last->next = req;
 		req->prev = last;
 
@@ -1212,6 +1290,19 @@ static void handle_endpoint(struct usb_info *ui, unsigned bit)
 			req->req.status = 0;
 			req->req.actual =
 				req->req.length - ((info >> 16) & 0x7FFF);
+
+			ept->req_count++;
+			ept->bytes += req->req.actual;
+			if (ept->prime_time.tv64) {
+				unsigned lat = ktime_us_delta(ktime_get(),
+							      ept->prime_time);
+
+				ept->prime_time.tv64 = 0;
+				ept->prime_lat_total += lat;
+				ept->prime_lat_count++;
+				if (lat > ept->prime_lat_max)
+					ept->prime_lat_max = lat;
+			}
 		}
 		req->busy = 0;
 		req->live = 0;
@@ -2023,6 +2114,70 @@ static ssize_t debug_prime_fail_read(struct file *file, char __user *ubuf,
 	return simple_read_from_buffer(ubuf, count, ppos, buf, i);
 }
 
+static char ept_stats_buffer[PAGE_SIZE];
+static ssize_t debug_ept_stats_read(struct file *file, char __user *ubuf,
+				 size_t count, loff_t *ppos)
+{
+	struct usb_info *ui = file->private_data;
+	char *buf = ept_stats_buffer;
+	unsigned long flags;
+	struct msm_endpoint *ept;
+	u64 lat_avg;
+	int n;
+	int i = 0;
+
+	spin_lock_irqsave(&ui->lock, flags);
+	for (n = 0; n < 32; n++) {
+		ept = ui->ept + n;
+		if (ept->ep.maxpacket == 0)
+			continue;
+
+		lat_avg = ept->prime_lat_total;
+		if (ept->prime_lat_count)
+			do_div(lat_avg, ept->prime_lat_count);
+
+		i += scnprintf(buf + i, PAGE_SIZE - i,
+			"ept%d %s reqs=%lu bytes=%llu primes=%lu chained=%lu "
+			"prime_lat_avg=%lluus prime_lat_max=%uus\n",
+			ept->num, (ept->flags & EPT_FLAG_IN) ? "in " : "out",
+			ept->req_count, ept->bytes, ept->prime_count,
+			ept->chain_count, lat_avg, ept->prime_lat_max);
+	}
+	spin_unlock_irqrestore(&ui->lock, flags);
+
+	return simple_read_from_buffer(ubuf, count, ppos, buf, i);
+}
+
+static ssize_t debug_ept_stats_reset(struct file *file,
+		const char __user *ubuf, size_t count, loff_t *ppos)
+{
+	struct usb_info *ui = file->private_data;
+	struct msm_endpoint *ept;
+	unsigned long flags;
+	int n;
+
+	spin_lock_irqsave(&ui->lock, flags);
+	for (n = 0; n < 32; n++) {
+		ept = ui->ept + n;
+		ept->req_count = 0;
+		ept->prime_count = 0;
+		ept->chain_count = 0;
+		ept->bytes = 0;
+		ept->prime_lat_total = 0;
+		ept->prime_lat_count = 0;
+		ept->prime_lat_max = 0;
+	}
+	spin_unlock_irqrestore(&ui->lock, flags);
+
+	return count;
+}
+
+const struct file_operations ept_stats_ops = {
+	.open = debug_open,
+	.read = debug_ept_stats_read,
+	.write = debug_ept_stats_reset,
+};
+
 static int debug_prime_fail_open(struct inode *inode, struct file *file)
 {
 	file->private_data = inode->i_private;
@@ -2049,6 +2204,7 @@ static void usb_debugfs_init(struct usb_info *ui)
 						&debug_wlocks_ops);
 	debugfs_create_file("prime_fail_countt", 0666, dent, ui,
 						&prime_fail_ops);
+	debugfs_create_file("ept_stats", 0644, dent, ui, &ept_stats_ops);
 }
 #else
 static void usb_debugfs_init(struct usb_info *ui) {}
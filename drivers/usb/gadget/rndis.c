@@ -597,6 +597,9 @@ static int rndis_init_response(int configNr, rndis_init_msg_type *buf)
 		return -ENOMEM;
 	resp = (rndis_init_cmplt_type *)r->buf;
 
+	/* largest transfer the host takes from us */
+	params->dl_max_xfer_size = get_unaligned_le32(&buf->MaxTransferSize);
+
 	resp->MessageType = cpu_to_le32(REMOTE_NDIS_INITIALIZE_CMPLT);
 	resp->MessageLength = cpu_to_le32(52);
 	resp->RequestID = buf->RequestID; /* Still LE in msg buffer */
@@ -605,12 +608,12 @@ static int rndis_init_response(int configNr, rndis_init_msg_type *buf)
 	resp->MinorVersion = cpu_to_le32(RNDIS_MINOR_VERSION);
 	resp->DeviceFlags = cpu_to_le32(RNDIS_DF_CONNECTIONLESS);
 	resp->Medium = cpu_to_le32(RNDIS_MEDIUM_802_3);
-	resp->MaxPacketsPerTransfer = cpu_to_le32(1);
-	resp->MaxTransferSize = cpu_to_le32(
-		  params->dev->mtu
+	resp->MaxPacketsPerTransfer = cpu_to_le32(params->max_pkt_per_xfer);
+	resp->MaxTransferSize = cpu_to_le32(params->max_pkt_per_xfer *
+		(params->dev->mtu
 		+ sizeof(struct ethhdr)
 		+ sizeof(struct rndis_packet_msg_type)
-		+ 22);
+		+ 22));
 	resp->PacketAlignmentFactor = cpu_to_le32(0);
 	resp->AFListOffset = cpu_to_le32(0);
 	resp->AFListSize = cpu_to_le32(0);
@@ -922,6 +925,8 @@ int rndis_register(void (*resp_avail)(void *v), void *v)
 			rndis_per_dev_params[i].used = 1;
 			rndis_per_dev_params[i].resp_avail = resp_avail;
 			rndis_per_dev_params[i].v = v;
+			rndis_per_dev_params[i].max_pkt_per_xfer = 1;
+			rndis_per_dev_params[i].dl_max_xfer_size = 0;
 			pr_debug("%s: configNr = %d\n", __func__, i);
 			return i;
 		}
@@ -975,6 +980,24 @@ int rndis_set_param_medium(u8 configNr, u32 medium, u32 speed)
 	return 0;
 }
 
+void rndis_set_max_pkt_xfer(u8 configNr, u8 max_pkt_per_xfer)
+{
+	pr_debug("%s: %u\n", __func__, max_pkt_per_xfer);
+	if (configNr >= RNDIS_MAX_CONFIGS)
+		return;
+
+	rndis_per_dev_params[configNr].max_pkt_per_xfer =
+		max_t(u8, max_pkt_per_xfer, 1);
+}
+
+u32 rndis_get_dl_max_xfer_size(u8 configNr)
+{
+	if (configNr >= RNDIS_MAX_CONFIGS)
+		return 0;
+
+	return rndis_per_dev_params[configNr].dl_max_xfer_size;
+}
+
 void rndis_add_hdr(struct sk_buff *skb)
 {
 	struct rndis_packet_msg_type *header;
@@ -1047,26 +1070,61 @@ int rndis_rm_hdr(struct gether *port,
 			struct sk_buff *skb,
 			struct sk_buff_head *list)
 {
-	/* tmp points to a struct rndis_packet_msg_type */
-	__le32 *tmp = (void *)skb->data;
+	/*
+	 * One transfer may carry several packet messages when we told the
+	 * host MaxPacketsPerTransfer > 1.  Every message but the last goes
+	 * up as a clone sharing the transfer buffer.
+	 */
+	bool first = true;
+
+	for (;;) {
+		struct sk_buff	*skb2;
+		/* tmp points to a struct rndis_packet_msg_type */
+		__le32		*tmp = (void *)skb->data;
+		u32		msg_len, data_offset, data_len;
+
+		/* MessageType, MessageLength */
+		if (skb->len < sizeof(struct rndis_packet_msg_type)
+				|| cpu_to_le32(REMOTE_NDIS_PACKET_MSG)
+				!= get_unaligned(tmp++)) {
+			dev_kfree_skb_any(skb);
+			/* senders may pad the transfer after the last one */
+			return first ? -EINVAL : 0;
+		}
+		msg_len = get_unaligned_le32(tmp++);
+
+		/* DataOffset, DataLength */
+		data_offset = get_unaligned_le32(tmp++);
+		data_len = get_unaligned_le32(tmp++);
+		/* each step has to make progress, and nothing may wrap */
+		if (msg_len < sizeof(struct rndis_packet_msg_type) ||
+				msg_len % 4 || msg_len > skb->len ||
+				data_offset > msg_len - 8 ||
+				data_len > msg_len - 8 - data_offset) {
+			dev_kfree_skb_any(skb);
+			return -EOVERFLOW;
+		}
 
-	/* MessageType, MessageLength */
-	if (cpu_to_le32(REMOTE_NDIS_PACKET_MSG)
-			!= get_unaligned(tmp++)) {
-		dev_kfree_skb_any(skb);
-		return -EINVAL;
-	}
-	tmp++;
+		if (skb->len - msg_len < sizeof(struct rndis_packet_msg_type)) {
+			/* last message, hand up the transfer skb itself */
+			skb_pull(skb, data_offset + 8);
+			skb_trim(skb, data_len);
+			skb_queue_tail(list, skb);
+			return 0;
+		}
 
-	/* DataOffset, DataLength */
-	if (!skb_pull(skb, get_unaligned_le32(tmp++) + 8)) {
-		dev_kfree_skb_any(skb);
-		return -EOVERFLOW;
-	}
-	skb_trim(skb, get_unaligned_le32(tmp++));
+		skb2 = skb_clone(skb, GFP_ATOMIC);
+		if (!skb2) {
+			dev_kfree_skb_any(skb);
+			return -ENOMEM;
+		}
+		skb_pull(skb2, data_offset + 8);
+		skb_trim(skb2, data_len);
+		skb_queue_tail(list, skb2);
 
-	skb_queue_tail(list, skb);
-	return 0;
+		skb_pull(skb, msg_len);
+		first = false;
+	}
 }
 
 #ifdef CONFIG_USB_GADGET_DEBUG_FILES
@@ -242,6 +242,8 @@ struct fsg_lun {
 	unsigned int	registered:1;
 	unsigned int	info_valid:1;
 	unsigned int	nofua:1;
+	unsigned int	direct_io:1;
+	unsigned int	dio_active:1;
 
 	u32		sense_data;
 	u32		sense_data_info;
@@ -632,6 +634,12 @@ static void fsg_lun_close(struct fsg_lun *curlun)
 {
 	if (curlun->filp) {
 		LDBG(curlun, "close backing file\n");
+		/* Don't leave pages the direct I/O path bypassed cached */
+		if (curlun->dio_active) {
+			invalidate_mapping_pages(curlun->filp->f_mapping,
+						 0, -1);
+			curlun->dio_active = 0;
+		}
 		fput(curlun->filp);
 		curlun->filp = NULL;
 	}
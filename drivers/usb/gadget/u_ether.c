@@ -69,8 +69,21 @@ struct eth_dev {
 	struct list_head	tx_reqs, rx_reqs;
 	unsigned		tx_qlen;
 
+	/* packing several packets per IN transfer (RNDIS), needs
+	 * tx_req_bufsize byte buffers preallocated on the tx requests
+	 */
+	unsigned		tx_req_bufsize;
+	unsigned		dl_max_pkts_per_xfer;
+	unsigned		tx_skb_hold_count;
+	unsigned		no_tx_req_used;
+
 	struct sk_buff_head	rx_frames;
 
+	/* rx skbs allocated ahead of time, outside the completion path */
+	struct sk_buff_head	rx_skb_pool;
+	unsigned		rx_pool_len;
+	size_t			rx_buf_size;
+
 	unsigned		header_len;
 	struct sk_buff		*(*wrap)(struct gether *, struct sk_buff *skb);
 	int			(*unwrap)(struct gether *,
@@ -81,6 +94,7 @@ struct eth_dev {
 
 	unsigned long		todo;
 #define	WORK_RX_MEMORY		0
+#define	WORK_RX_POOL		1
 
 	bool			zlp;
 	u8			host_mac[ETH_ALEN];
@@ -92,6 +106,9 @@ struct eth_dev {
 
 #define DEFAULT_QLEN	2	/* double buffering by default */
 
+/* only hold tx packets back for aggregation with this many in flight */
+#define TX_REQ_THRESHOLD	5
+
 
 #ifdef CONFIG_USB_GADGET_DUALSPEED
 
@@ -103,6 +120,15 @@ MODULE_PARM_DESC(qmult, "queue length multiplier at high speed");
 #define qmult		1
 #endif
 
+/* explicit request counts, override qlen() when set */
+static unsigned qlen_rx;
+module_param(qlen_rx, uint, S_IRUGO|S_IWUSR);
+MODULE_PARM_DESC(qlen_rx, "number of rx requests, 0 for the default");
+
+static unsigned qlen_tx;
+module_param(qlen_tx, uint, S_IRUGO|S_IWUSR);
+MODULE_PARM_DESC(qlen_tx, "number of tx requests, 0 for the default");
+
 /* for dual-speed hardware, use deeper queues at highspeed */
 static inline int qlen(struct usb_gadget *gadget)
 {
@@ -112,6 +138,16 @@ static inline int qlen(struct usb_gadget *gadget)
 		return DEFAULT_QLEN;
 }
 
+static inline int rx_qlen(struct usb_gadget *gadget)
+{
+	return qlen_rx ? qlen_rx : qlen(gadget);
+}
+
+static inline int tx_qlen(struct usb_gadget *gadget)
+{
+	return qlen_tx ? qlen_tx : qlen(gadget);
+}
+
 /*-------------------------------------------------------------------------*/
 
 /* REVISIT there must be a better way than having two sets
@@ -202,26 +238,12 @@ static void defer_kevent(struct eth_dev *dev, int flag)
 }
 
 static void rx_complete(struct usb_ep *ep, struct usb_request *req);
+static void tx_complete(struct usb_ep *ep, struct usb_request *req);
 
-static int
-rx_submit(struct eth_dev *dev, struct usb_request *req, gfp_t gfp_flags)
+static size_t rx_buf_size(struct eth_dev *dev, struct gether *link)
 {
-	struct sk_buff	*skb;
-	int		retval = -ENOMEM;
+	struct usb_ep	*out = link->out_ep;
 	size_t		size = 0;
-	struct usb_ep	*out;
-	unsigned long	flags;
-
-	spin_lock_irqsave(&dev->lock, flags);
-	if (dev->port_usb)
-		out = dev->port_usb->out_ep;
-	else
-		out = NULL;
-	spin_unlock_irqrestore(&dev->lock, flags);
-
-	if (!out)
-		return -ENOTCONN;
-
 
 	/* Padding up to RX_EXTRA handles minor disagreements with host.
 	 * Normally we use the USB "terminate on short read" convention;
@@ -236,14 +258,68 @@ rx_submit(struct eth_dev *dev, struct usb_request *req, gfp_t gfp_flags)
 	 * new packets don't only start after a short RX).
 	 */
 	size += sizeof(struct ethhdr) + dev->net->mtu + RX_EXTRA;
-	size += dev->port_usb->header_len;
+	size += link->header_len;
+	if (link->ul_max_pkts_per_xfer > 1)
+		size *= link->ul_max_pkts_per_xfer;
 	size += out->maxpacket - 1;
 	size -= size % out->maxpacket;
 
-	if (dev->port_usb->is_fixed)
-		size = max_t(size_t, size, dev->port_usb->fixed_out_len);
+	if (link->is_fixed)
+		size = max_t(size_t, size, link->fixed_out_len);
+
+	return size;
+}
+
+static struct sk_buff *rx_skb_get(struct eth_dev *dev, gfp_t gfp_flags)
+{
+	struct sk_buff	*skb;
+
+	skb = skb_dequeue(&dev->rx_skb_pool);
+	if (skb_queue_len(&dev->rx_skb_pool) < dev->rx_pool_len / 2)
+		defer_kevent(dev, WORK_RX_POOL);
+
+	/* filled for an earlier link with different framing? */
+	if (skb && skb_tailroom(skb) < dev->rx_buf_size + NET_IP_ALIGN) {
+		dev_kfree_skb_any(skb);
+		skb = NULL;
+	}
+	if (skb)
+		return skb;
+
+	return alloc_skb(dev->rx_buf_size + NET_IP_ALIGN, gfp_flags);
+}
 
-	skb = alloc_skb(size + NET_IP_ALIGN, gfp_flags);
+static void rx_pool_fill(struct eth_dev *dev)
+{
+	struct sk_buff	*skb;
+
+	while (skb_queue_len(&dev->rx_skb_pool) < dev->rx_pool_len) {
+		skb = alloc_skb(dev->rx_buf_size + NET_IP_ALIGN, GFP_KERNEL);
+		if (!skb)
+			break;
+		skb_queue_tail(&dev->rx_skb_pool, skb);
+	}
+}
+
+static int
+rx_submit(struct eth_dev *dev, struct usb_request *req, gfp_t gfp_flags)
+{
+	struct sk_buff	*skb;
+	int		retval = -ENOMEM;
+	struct usb_ep	*out;
+	unsigned long	flags;
+
+	spin_lock_irqsave(&dev->lock, flags);
+	if (dev->port_usb)
+		out = dev->port_usb->out_ep;
+	else
+		out = NULL;
+	spin_unlock_irqrestore(&dev->lock, flags);
+
+	if (!out)
+		return -ENOTCONN;
+
+	skb = rx_skb_get(dev, gfp_flags);
 	if (skb == NULL) {
 		DBG(dev, "no rx skb\n");
 		goto enomem;
@@ -256,7 +332,7 @@ rx_submit(struct eth_dev *dev, struct usb_request *req, gfp_t gfp_flags)
 	skb_reserve(skb, NET_IP_ALIGN);
 
 	req->buf = skb->data;
-	req->length = size;
+	req->length = dev->rx_buf_size;
 	req->complete = rx_complete;
 	req->context = skb;
 
@@ -406,15 +482,16 @@ extra:
 	return 0;
 }
 
-static int alloc_requests(struct eth_dev *dev, struct gether *link, unsigned n)
+static int alloc_requests(struct eth_dev *dev, struct gether *link,
+		unsigned n_tx, unsigned n_rx)
 {
 	int	status;
 
 	spin_lock(&dev->req_lock);
-	status = prealloc(&dev->tx_reqs, link->in_ep, n);
+	status = prealloc(&dev->tx_reqs, link->in_ep, n_tx);
 	if (status < 0)
 		goto fail;
-	status = prealloc(&dev->rx_reqs, link->out_ep, n);
+	status = prealloc(&dev->rx_reqs, link->out_ep, n_rx);
 	if (status < 0)
 		goto fail;
 	goto done;
@@ -425,6 +502,46 @@ done:
 	return status;
 }
 
+/* tx requests own their buffers when packets get packed into them */
+static void free_tx_buffers(struct eth_dev *dev)
+{
+	struct usb_request	*req;
+
+	list_for_each_entry(req, &dev->tx_reqs, list) {
+		kfree(req->buf);
+		req->buf = NULL;
+	}
+	dev->tx_req_bufsize = 0;
+}
+
+static int alloc_tx_buffers(struct eth_dev *dev, struct gether *link)
+{
+	struct usb_request	*req;
+
+	dev->tx_req_bufsize = link->dl_max_pkts_per_xfer *
+		(dev->net->mtu + sizeof(struct ethhdr) + link->header_len)
+		+ 1;	/* room for the byte that avoids a zlp */
+
+	spin_lock(&dev->req_lock);
+	list_for_each_entry(req, &dev->tx_reqs, list)
+		req->buf = NULL;
+	list_for_each_entry(req, &dev->tx_reqs, list) {
+		req->buf = kmalloc(dev->tx_req_bufsize, GFP_ATOMIC);
+		if (!req->buf) {
+			free_tx_buffers(dev);
+			spin_unlock(&dev->req_lock);
+			return -ENOMEM;
+		}
+		req->length = 0;
+		req->complete = tx_complete;
+		req->context = NULL;
+	}
+	dev->tx_skb_hold_count = 0;
+	dev->no_tx_req_used = 0;
+	spin_unlock(&dev->req_lock);
+	return 0;
+}
+
 static void rx_fill(struct eth_dev *dev, gfp_t gfp_flags)
 {
 	struct usb_request	*req;
@@ -452,6 +569,11 @@ static void eth_work(struct work_struct *work)
 {
 	struct eth_dev	*dev = container_of(work, struct eth_dev, work);
 
+	if (test_and_clear_bit(WORK_RX_POOL, &dev->todo)) {
+		if (netif_running(dev->net))
+			rx_pool_fill(dev);
+	}
+
 	if (test_and_clear_bit(WORK_RX_MEMORY, &dev->todo)) {
 		if (netif_running(dev->net))
 			rx_fill(dev, GFP_KERNEL);
@@ -461,10 +583,48 @@ static void eth_work(struct work_struct *work)
 		DBG(dev, "work done, flags = 0x%lx\n", dev->todo);
 }
 
+static int tx_queue(struct eth_dev *dev, struct usb_ep *in,
+		struct usb_request *req, int length, gfp_t gfp_flags)
+{
+	/* NCM requires no zlp if transfer is dwNtbInMaxSize */
+	if (dev->port_usb->is_fixed &&
+	    length == dev->port_usb->fixed_in_len &&
+	    (length % in->maxpacket) == 0)
+		req->zero = 0;
+	else
+		req->zero = 1;
+
+	/* use zlp framing on tx for strict CDC-Ether conformance,
+	 * though any robust network rx path ignores extra padding.
+	 * and some hardware doesn't like to write zlps.
+	 */
+	if (req->zero && !dev->zlp && (length % in->maxpacket) == 0)
+		length++;
+
+	req->length = length;
+
+	/* throttle highspeed IRQ rate back slightly */
+	if (gadget_is_dualspeed(dev->gadget) &&
+			 (dev->gadget->speed == USB_SPEED_HIGH)) {
+		dev->tx_qlen++;
+		if (dev->tx_qlen == qmult) {
+			req->no_interrupt = 0;
+			dev->tx_qlen = 0;
+		} else {
+			req->no_interrupt = 1;
+		}
+	} else {
+		req->no_interrupt = 0;
+	}
+
+	return usb_ep_queue(in, req, gfp_flags);
+}
+
 static void tx_complete(struct usb_ep *ep, struct usb_request *req)
 {
 	struct sk_buff	*skb = req->context;
 	struct eth_dev	*dev = ep->driver_data;
+	struct usb_request *new_req;
 
 	switch (req->status) {
 	default:
@@ -475,14 +635,52 @@ static void tx_complete(struct usb_ep *ep, struct usb_request *req)
 	case -ESHUTDOWN:		/* disconnect etc */
 		break;
 	case 0:
-		dev->net->stats.tx_bytes += skb->len;
+		if (skb)
+			dev->net->stats.tx_bytes += skb->len;
 	}
-	dev->net->stats.tx_packets++;
 
-	spin_lock(&dev->req_lock);
-	list_add(&req->list, &dev->tx_reqs);
-	spin_unlock(&dev->req_lock);
-	dev_kfree_skb_any(skb);
+	if (!dev->tx_req_bufsize) {
+		dev->net->stats.tx_packets++;
+
+		spin_lock(&dev->req_lock);
+		list_add(&req->list, &dev->tx_reqs);
+		spin_unlock(&dev->req_lock);
+		dev_kfree_skb_any(skb);
+	} else {
+		/* packets are counted as they get packed, see eth_start_xmit */
+		req->length = 0;
+
+		spin_lock(&dev->req_lock);
+		dev->no_tx_req_used--;
+
+		/* send what was held back while this one was in flight */
+		new_req = NULL;
+		if (req->status == 0 && dev->port_usb &&
+				!list_empty(&dev->tx_reqs)) {
+			new_req = container_of(dev->tx_reqs.next,
+					struct usb_request, list);
+			if (new_req->length) {
+				list_del(&new_req->list);
+				dev->tx_skb_hold_count = 0;
+				dev->no_tx_req_used++;
+			} else {
+				new_req = NULL;
+			}
+		}
+		/* the held request stays at the head of the list */
+		list_add_tail(&req->list, &dev->tx_reqs);
+		spin_unlock(&dev->req_lock);
+
+		if (new_req && tx_queue(dev, ep, new_req, new_req->length,
+					GFP_ATOMIC)) {
+			dev->net->stats.tx_dropped++;
+			new_req->length = 0;
+			spin_lock(&dev->req_lock);
+			dev->no_tx_req_used--;
+			list_add_tail(&new_req->list, &dev->tx_reqs);
+			spin_unlock(&dev->req_lock);
+		}
+	}
 
 	if (netif_carrier_ok(dev->net))
 		netif_wake_queue(dev->net);
@@ -503,11 +701,16 @@ static netdev_tx_t eth_start_xmit(struct sk_buff *skb,
 	unsigned long		flags;
 	struct usb_ep		*in;
 	u16			cdc_filter;
+	unsigned		max_pkts = 1;
 
 	spin_lock_irqsave(&dev->lock, flags);
 	if (dev->port_usb) {
 		in = dev->port_usb->in_ep;
 		cdc_filter = dev->port_usb->cdc_filter;
+		/* only pack as much as the host said it takes */
+		if (dev->tx_req_bufsize &&
+		    dev->tx_req_bufsize <= dev->port_usb->dl_max_xfer_size)
+			max_pkts = dev->dl_max_pkts_per_xfer;
 	} else {
 		in = NULL;
 		cdc_filter = 0;
@@ -556,7 +759,7 @@ static netdev_tx_t eth_start_xmit(struct sk_buff *skb,
 	list_del(&req->list);
 
 	/* temporarily stop TX queue when the freelist empties */
-	if (list_empty(&dev->tx_reqs))
+	if (list_empty(&dev->tx_reqs) && !dev->tx_req_bufsize)
 		netif_stop_queue(net);
 	spin_unlock_irqrestore(&dev->req_lock, flags);
 
@@ -576,42 +779,46 @@ static netdev_tx_t eth_start_xmit(struct sk_buff *skb,
 
 		length = skb->len;
 	}
-	req->buf = skb->data;
-	req->context = skb;
-	req->complete = tx_complete;
-
-	/* NCM requires no zlp if transfer is dwNtbInMaxSize */
-	if (dev->port_usb->is_fixed &&
-	    length == dev->port_usb->fixed_in_len &&
-	    (length % in->maxpacket) == 0)
-		req->zero = 0;
-	else
-		req->zero = 1;
-
-	/* use zlp framing on tx for strict CDC-Ether conformance,
-	 * though any robust network rx path ignores extra padding.
-	 * and some hardware doesn't like to write zlps.
-	 */
-	if (req->zero && !dev->zlp && (length % in->maxpacket) == 0)
-		length++;
 
-	req->length = length;
+	if (dev->tx_req_bufsize) {
+		/* pack the packet behind whatever this request holds */
+		if (req->length + length >= dev->tx_req_bufsize) {
+			dev_kfree_skb_any(skb);
+			goto drop;
+		}
+		memcpy(req->buf + req->length, skb->data, length);
+		req->length += length;
+		dev->net->stats.tx_packets++;
+		dev->net->stats.tx_bytes += length;
+		dev_kfree_skb_any(skb);
+		skb = NULL;
 
-	/* throttle highspeed IRQ rate back slightly */
-	if (gadget_is_dualspeed(dev->gadget) &&
-			 (dev->gadget->speed == USB_SPEED_HIGH)) {
-		dev->tx_qlen++;
-		if (dev->tx_qlen == qmult) {
-			req->no_interrupt = 0;
-			dev->tx_qlen = 0;
-		} else {
-			req->no_interrupt = 1;
+		spin_lock_irqsave(&dev->req_lock, flags);
+		dev->tx_skb_hold_count++;
+		if (dev->tx_skb_hold_count < max_pkts &&
+		    dev->no_tx_req_used > TX_REQ_THRESHOLD) {
+			/* plenty in flight; tx_complete() sends this one
+			 * if no further packets fill it up first
+			 */
+			list_add(&req->list, &dev->tx_reqs);
+			spin_unlock_irqrestore(&dev->req_lock, flags);
+			return NETDEV_TX_OK;
 		}
+		dev->tx_skb_hold_count = 0;
+		dev->no_tx_req_used++;
+		if (list_empty(&dev->tx_reqs))
+			netif_stop_queue(net);
+		spin_unlock_irqrestore(&dev->req_lock, flags);
+
+		length = req->length;
+		req->context = NULL;
 	} else {
-		req->no_interrupt = 0;
+		req->buf = skb->data;
+		req->context = skb;
 	}
+	req->complete = tx_complete;
 
-	retval = usb_ep_queue(in, req, GFP_ATOMIC);
+	retval = tx_queue(dev, in, req, length, GFP_ATOMIC);
 	switch (retval) {
 	default:
 		DBG(dev, "tx queue err %d\n", retval);
@@ -621,7 +828,14 @@ static netdev_tx_t eth_start_xmit(struct sk_buff *skb,
 	}
 
 	if (retval) {
-		dev_kfree_skb_any(skb);
+		if (skb) {
+			dev_kfree_skb_any(skb);
+		} else {
+			req->length = 0;
+			spin_lock_irqsave(&dev->req_lock, flags);
+			dev->no_tx_req_used--;
+			spin_unlock_irqrestore(&dev->req_lock, flags);
+		}
 drop:
 		dev->net->stats.tx_dropped++;
 		spin_lock_irqsave(&dev->req_lock, flags);
@@ -810,6 +1024,7 @@ int gether_setup_name(struct usb_gadget *g, u8 ethaddr[ETH_ALEN],
 	INIT_LIST_HEAD(&dev->rx_reqs);
 
 	skb_queue_head_init(&dev->rx_frames);
+	skb_queue_head_init(&dev->rx_skb_pool);
 
 	/* network device setup */
 	dev->net = net;
@@ -913,11 +1128,21 @@ struct net_device *gether_connect(struct gether *link)
 	}
 
 	if (result == 0)
-		result = alloc_requests(dev, link, qlen(dev->gadget));
+		result = alloc_requests(dev, link, tx_qlen(dev->gadget),
+				rx_qlen(dev->gadget));
 
 	if (result == 0) {
 		dev->zlp = link->is_zlp_ok;
-		DBG(dev, "qlen %d\n", qlen(dev->gadget));
+		DBG(dev, "qlen %d/%d\n", tx_qlen(dev->gadget),
+				rx_qlen(dev->gadget));
+
+		dev->rx_buf_size = rx_buf_size(dev, link);
+		dev->rx_pool_len = rx_qlen(dev->gadget);
+
+		dev->dl_max_pkts_per_xfer = link->dl_max_pkts_per_xfer;
+		if (dev->dl_max_pkts_per_xfer > 1 &&
+				alloc_tx_buffers(dev, link) < 0)
+			DBG(dev, "no tx buffers, one packet per transfer\n");
 
 		dev->header_len = link->header_len;
 		dev->unwrap = link->unwrap;
@@ -983,6 +1208,8 @@ void gether_disconnect(struct gether *link)
 	 */
 	usb_ep_disable(link->in_ep);
 	spin_lock(&dev->req_lock);
+	if (dev->tx_req_bufsize)
+		free_tx_buffers(dev);
 	while (!list_empty(&dev->tx_reqs)) {
 		req = container_of(dev->tx_reqs.next,
 					struct usb_request, list);
@@ -1011,6 +1238,8 @@ void gether_disconnect(struct gether *link)
 	link->out_ep->driver_data = NULL;
 	link->out = NULL;
 
+	skb_queue_purge(&dev->rx_skb_pool);
+
 	/* finish forgetting about this USB link episode */
 	dev->header_len = 0;
 	dev->unwrap = NULL;
@@ -1844,6 +1844,9 @@ static void mdp_drv_init(void)
 				msm_fb_debugfs_file_create(mdp_dir,
 					"dma2_update_time_in_usec",
 					(u32 *) &mdp_dma2_update_time_in_usec);
+				msm_fb_debugfs_file_create(mdp_dir,
+					"dma2_async",
+					(u32 *) &mdp_dma2_async);
 				msm_fb_debugfs_file_create(mdp_dir,
 					"vs_rdcnt_slow",
 					(u32 *) &mdp_lcd_rd_cnt_offset_slow);
@@ -2315,6 +2318,8 @@ static int mdp_probe(struct platform_device *pdev)
 	case EBI2_PANEL:
 		INIT_WORK(&mfd->dma_update_worker,
 			  mdp_lcd_update_workqueue_handler);
+		INIT_WORK(&mfd->dma_commit_worker,
+			  mdp_dma2_commit_workqueue_handler);
 		INIT_WORK(&mfd->vsync_resync_worker,
 			  mdp_vsync_resync_workqueue_handler);
 		mfd->hw_refresh = FALSE;
@@ -224,6 +224,24 @@ struct mdp_dma_data {
 	struct completion dmap_comp;
 };
 
+/* DMA2 frame timing, reported through debugfs mdp/dma2_stat */
+struct mdp_dma_frame_stat {
+	ulong commits;		/* pan updates handed to DMA2 */
+	ulong async;		/* of which queued to mdp_dma_wq */
+	ulong commit_waits;	/* pan blocked behind a pending commit */
+	ulong frames;		/* DMA2 completions */
+	ulong missed_vsync;	/* refresh periods lost commit -> scanout */
+	ulong latency_last;	/* commit -> DMA2 done, usec */
+	ulong latency_max;
+	u64 latency_total;
+	ulong partial;		/* frames smaller than the panel */
+	u64 bytes;		/* pixel data sent to the panel */
+	ktime_t since;		/* last reset, for bytes/sec */
+};
+
+extern struct mdp_dma_frame_stat mdp_dma2_frame_stat;
+extern int mdp_dma2_async;
+
 extern struct list_head mdp_hist_lut_list;
 extern struct mutex mdp_hist_lut_list_mutex;
 struct mdp_hist_lut_mgmt {
@@ -709,6 +727,7 @@ void mdp_dma_pan_update(struct fb_info *info);
 void mdp_refresh_screen(unsigned long data);
 int mdp_ppp_blit(struct fb_info *info, struct mdp_blit_req *req);
 void mdp_lcd_update_workqueue_handler(struct work_struct *work);
+void mdp_dma2_commit_workqueue_handler(struct work_struct *work);
 void mdp_vsync_resync_workqueue_handler(struct work_struct *work);
 void mdp_dma2_update(struct msm_fb_data_type *mfd);
 void mdp_vsync_cfg_regs(struct msm_fb_data_type *mfd,
@@ -527,6 +527,67 @@ static const struct file_operations mdp_stat_fops = {
 };
 #endif
 
+static ssize_t dma2_stat_write(
+	struct file *file,
+	const char __user *buff,
+	size_t count,
+	loff_t *ppos)
+{
+	memset(&mdp_dma2_frame_stat, 0, sizeof(mdp_dma2_frame_stat));
+	mdp_dma2_frame_stat.since = ktime_get();
+
+	return count;
+}
+
+static ssize_t dma2_stat_read(
+	struct file *file,
+	char __user *buff,
+	size_t count,
+	loff_t *ppos)
+{
+	struct mdp_dma_frame_stat *stat = &mdp_dma2_frame_stat;
+	ulong avg = 0;
+	u64 bps = 0;
+	s64 elapsed;
+	int tot;
+
+	if (*ppos)
+		return 0;	/* the end */
+
+	if (stat->frames)
+		avg = div_u64(stat->latency_total, stat->frames);
+
+	elapsed = ktime_to_us(ktime_sub(ktime_get(), stat->since));
+	if (elapsed > 0)
+		bps = div64_u64(stat->bytes * USEC_PER_SEC, elapsed);
+
+	tot = snprintf(debug_buf, sizeof(debug_buf),
+		"async: %d\n"
+		"commits: %08lu\tqueued: %08lu\twaits: %08lu\n"
+		"frames: %08lu\tmissed_vsync: %08lu\n"
+		"latency(us) last: %lu\tavg: %lu\tmax: %lu\n"
+		"partial: %08lu\tbytes: %llu\tbytes/sec: %llu\n",
+		mdp_dma2_async,
+		stat->commits, stat->async, stat->commit_waits,
+		stat->frames, stat->missed_vsync,
+		stat->latency_last, avg, stat->latency_max,
+		stat->partial, stat->bytes, bps);
+
+	if (copy_to_user(buff, debug_buf, tot))
+		return -EFAULT;
+
+	*ppos += tot;	/* increase offset */
+
+	return tot;
+}
+
+static const struct file_operations dma2_stat_fops = {
+	.open = mdp_offset_open,
+	.release = mdp_offset_release,
+	.read = dma2_stat_read,
+	.write = dma2_stat_write,
+};
+
 /*
  * MDDI
  *
@@ -1415,6 +1476,13 @@ int mdp_debugfs_init(void)
 	}
 #endif
 
+	if (debugfs_create_file("dma2_stat", 0644, dent, 0, &dma2_stat_fops)
+			== NULL) {
+		printk(KERN_ERR "%s(%d): debugfs_create_file: debug fail\n",
+			__FILE__, __LINE__);
+		return -1;
+	}
+
 	if (debugfs_create_file("force_ov0_blt", 0644, dent, 0,
 				&dbg_force_ov0_blt_fops)
 			== NULL) {
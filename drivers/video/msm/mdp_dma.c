@@ -54,6 +54,14 @@ uint32 mdp_total_vdopkts;
 extern u32 msm_fb_debug_enabled;
 extern struct workqueue_struct *mdp_dma_wq;
 
+/*
+ * With three or more fb pages, pan_display queues the DMA2 update to
+ * mdp_dma_wq and returns, so rendering of frame N+1 overlaps scanout
+ * of frame N. At most one frame is queued behind the one in flight.
+ */
+int mdp_dma2_async = 1;
+struct mdp_dma_frame_stat mdp_dma2_frame_stat;
+
 int vsync_start_y_adjust = 4;
 
 /* LGE_CHANGE
@@ -86,6 +94,25 @@ static struct display_table mddi_hitachi_position_table[] = {
 	{REGFLAG_END_OF_TABLE, 0x00, {}}
 };
 extern void display_table_hitachi(struct display_table *table, unsigned int count);
+
+/* point the column/page window at the region being sent */
+static void mdp_hitachi_set_window(MDPIBUF *iBuf)
+{
+	unsigned char *col = mddi_hitachi_position_table[0].val_list;
+	unsigned char *page = mddi_hitachi_position_table[1].val_list;
+	uint32 x1 = iBuf->dma_x + iBuf->dma_w - 1;
+	uint32 y1 = iBuf->dma_y + iBuf->dma_h - 1;
+
+	col[0] = (iBuf->dma_x >> 8) & 0xff;
+	col[1] = iBuf->dma_x & 0xff;
+	col[2] = (x1 >> 8) & 0xff;
+	col[3] = x1 & 0xff;
+
+	page[0] = (iBuf->dma_y >> 8) & 0xff;
+	page[1] = iBuf->dma_y & 0xff;
+	page[2] = (y1 >> 8) & 0xff;
+	page[3] = y1 & 0xff;
+}
 #endif
 
 /* LGE_CHANGE [dojip.kim@lge.com] 2010-05-20,
@@ -235,6 +262,7 @@ static void mdp_dma2_update_lcd(struct msm_fb_data_type *mfd)
   * Add code to prevent LCD shift
   * 2010-05-18, minjong.gong@lge.com
   */
+	mdp_hitachi_set_window(iBuf);
 	display_table_hitachi(mddi_hitachi_position_table, sizeof(mddi_hitachi_2c) / sizeof(struct display_table));
 #endif
 
@@ -559,6 +587,39 @@ static void mdp_dma_schedule(struct msm_fb_data_type *mfd, uint32 term)
 	}
 }
 
+static void mdp_dma2_frame_bytes(struct msm_fb_data_type *mfd)
+{
+	MDPIBUF *iBuf = &mfd->ibuf;
+
+	mdp_dma2_frame_stat.bytes += iBuf->dma_w * iBuf->dma_h * iBuf->bpp;
+	if ((iBuf->dma_w < mfd->panel_info.xres) ||
+	    (iBuf->dma_h < mfd->panel_info.yres))
+		mdp_dma2_frame_stat.partial++;
+}
+
+static void mdp_dma2_frame_done(struct msm_fb_data_type *mfd,
+				ktime_t commit_time)
+{
+	struct mdp_dma_frame_stat *stat = &mdp_dma2_frame_stat;
+	uint32 refx100 = mfd->panel_info.lcd.refx100;
+	ulong usec, periods;
+
+	usec = ktime_to_us(ktime_sub(ktime_get(), commit_time));
+
+	stat->frames++;
+	stat->latency_last = usec;
+	stat->latency_total += usec;
+	if (usec > stat->latency_max)
+		stat->latency_max = usec;
+
+	/* every full refresh period past the first is a missed vsync */
+	if (refx100) {
+		periods = usec / (100000000 / refx100);
+		if (periods > 1)
+			stat->missed_vsync += periods - 1;
+	}
+}
+
 #ifdef MDDI_HOST_WINDOW_WORKAROUND
 static void mdp_dma2_update_sub(struct msm_fb_data_type *mfd);
 void mdp_dma2_update(struct msm_fb_data_type *mfd)
@@ -600,11 +661,21 @@ static void mdp_dma2_update_sub(struct msm_fb_data_type *mfd)
 void mdp_dma2_update(struct msm_fb_data_type *mfd)
 #endif
 {
+	ktime_t commit_time;
+
 	down(&mfd->dma->mutex);
 	if ((mfd) && (!mfd->dma->busy) && (mfd->panel_power_on)) {
 		down(&mfd->sem);
 		mfd->ibuf_flushed = TRUE;
 		mdp_dma2_update_lcd(mfd);
+		commit_time = mfd->dma_commit_time;
+		mdp_dma2_frame_bytes(mfd);
+
+		/* ibuf is latched, the next pan may overwrite it */
+		if (mfd->dma_commit_pending) {
+			mfd->dma_commit_pending = FALSE;
+			wake_up(&mfd->dma_commit_wq);
+		}
 
 		mdp_enable_irq(MDP_DMA2_TERM);
 		mfd->dma->busy = TRUE;
@@ -617,6 +688,7 @@ void mdp_dma2_update(struct msm_fb_data_type *mfd)
 		/* wait until DMA finishes the current job */
 		wait_for_completion_killable(&mfd->dma->comp);
 		mdp_disable_irq(MDP_DMA2_TERM);
+		mdp_dma2_frame_done(mfd, commit_time);
 
 	/* signal if pan function is waiting for the update completion */
 		if (mfd->pan_waiting) {
@@ -636,6 +708,20 @@ void mdp_lcd_update_workqueue_handler(struct work_struct *work)
 		mfd->dma_fnc(mfd);
 }
 
+void mdp_dma2_commit_workqueue_handler(struct work_struct *work)
+{
+	struct msm_fb_data_type *mfd;
+
+	mfd = container_of(work, struct msm_fb_data_type, dma_commit_worker);
+	mfd->dma_fnc(mfd);
+
+	/* panel went off before the frame was latched */
+	if (mfd->dma_commit_pending) {
+		mfd->dma_commit_pending = FALSE;
+		wake_up(&mfd->dma_commit_wq);
+	}
+}
+
 void mdp_set_dma_pan_info(struct fb_info *info, struct mdp_dirty_region *dirty,
 			  boolean sync)
 {
@@ -644,7 +730,15 @@ void mdp_set_dma_pan_info(struct fb_info *info, struct mdp_dirty_region *dirty,
 	MDPIBUF *iBuf;
 	int bpp = info->var.bits_per_pixel / 8;
 
+	/* don't overwrite ibuf until the queued frame has been latched */
+	if (mfd->dma_commit_pending) {
+		mdp_dma2_frame_stat.commit_waits++;
+		wait_event_timeout(mfd->dma_commit_wq,
+				   !mfd->dma_commit_pending, HZ);
+	}
+
 	down(&mfd->sem);
+	mfd->dma_commit_time = ktime_get();
 
 	iBuf = &mfd->ibuf;
 	if (mfd->map_buffer)
@@ -701,8 +795,16 @@ void mdp_dma_pan_update(struct fb_info *info)
 		/* waiting for this update to complete */
 		mfd->pan_waiting = TRUE;
 		wait_for_completion_killable(&mfd->pan_comp);
-	} else
+	} else if (mdp_dma2_async && (mfd->dma_fnc == mdp_dma2_update) &&
+		   (mfd->fb_page >= 3) && (mfd->dma_commit_worker.func)) {
+		mdp_dma2_frame_stat.commits++;
+		mdp_dma2_frame_stat.async++;
+		mfd->dma_commit_pending = TRUE;
+		queue_work(mdp_dma_wq, &mfd->dma_commit_worker);
+	} else {
+		mdp_dma2_frame_stat.commits++;
 		mfd->dma_fnc(mfd);
+	}
 }
 
 void mdp_refresh_screen(unsigned long data)
@@ -825,6 +825,10 @@ static int msm_fb_blank_sub(int blank_mode, struct fb_info *info,
 		if (mfd->panel_power_on) {
 			int curr_pwr_state;
 
+			/* let a queued frame reach the panel first */
+			if (mfd->dma_commit_worker.func)
+				flush_work(&mfd->dma_commit_worker);
+
 			mfd->op_enable = FALSE;
 			curr_pwr_state = mfd->panel_power_on;
 			mfd->panel_power_on = FALSE;
@@ -1283,6 +1287,8 @@ static int msm_fb_register(struct msm_fb_data_type *mfd)
 
 	mfd->pan_waiting = FALSE;
 	init_completion(&mfd->pan_comp);
+	mfd->dma_commit_pending = FALSE;
+	init_waitqueue_head(&mfd->dma_commit_wq);
 	init_completion(&mfd->refresher_comp);
 	sema_init(&mfd->sem, 1);
 
@@ -1646,6 +1652,18 @@ static int msm_fb_pan_display(struct fb_var_screeninfo *var,
 
 		dirtyPtr = &dirty;
 	}
+
+	/* damage collected through MSMFB_DAMAGE since the last pan */
+	down(&mfd->sem);
+	if (mfd->damage_valid) {
+		if (!dirtyPtr) {
+			dirty = mfd->damage;
+			dirtyPtr = &dirty;
+		}
+		mfd->damage_valid = FALSE;
+	}
+	up(&mfd->sem);
+
 	complete(&mfd->msmfb_update_notify);
 	mutex_lock(&msm_fb_notify_update_sem);
 	if (mfd->msmfb_no_update_notify_timer.function)
@@ -3116,6 +3134,52 @@ static int msmfb_notify_update(struct fb_info *info, unsigned long *argp)
 	return (ret > 0) ? 0 : -1;
 }
 
+/*
+ * Grow the pending damage by one rectangle. The next pan_display that
+ * carries no "UPDT" region sends only the bounding box of the damage.
+ */
+static int msmfb_damage(struct fb_info *info, unsigned long *argp)
+{
+	struct msm_fb_data_type *mfd = (struct msm_fb_data_type *)info->par;
+	struct mdp_dirty_region *d = &mfd->damage;
+	struct mdp_rect r;
+	__u32 x1, y1;
+
+	if (copy_from_user(&r, argp, sizeof(r)))
+		return -EFAULT;
+
+	/* only command-mode MDDI panels keep a frame of their own */
+	if ((mfd->panel_info.type != MDDI_PANEL) ||
+	    (mfd->dma_fnc != mdp_dma2_update))
+		return -EOPNOTSUPP;
+
+	/* written so that x + w and y + h can't wrap */
+	if ((r.w == 0) || (r.h == 0) ||
+	    (r.x >= info->var.xres) || (r.w > info->var.xres - r.x) ||
+	    (r.y >= info->var.yres) || (r.h > info->var.yres - r.y))
+		return -EINVAL;
+
+	x1 = r.x + r.w;
+	y1 = r.y + r.h;
+
+	down(&mfd->sem);
+	if (mfd->damage_valid) {
+		x1 = max(x1, d->xoffset + d->width);
+		y1 = max(y1, d->yoffset + d->height);
+		d->xoffset = min(d->xoffset, r.x);
+		d->yoffset = min(d->yoffset, r.y);
+	} else {
+		d->xoffset = r.x;
+		d->yoffset = r.y;
+		mfd->damage_valid = TRUE;
+	}
+	d->width = x1 - d->xoffset;
+	d->height = y1 - d->yoffset;
+	up(&mfd->sem);
+
+	return 0;
+}
+
 static int msmfb_handle_pp_ioctl(struct msmfb_mdp_pp *pp_ptr)
 {
 	int ret = -1;
@@ -3442,6 +3506,10 @@ static int msm_fb_ioctl(struct fb_info *info, unsigned int cmd,
 		ret = msmfb_notify_update(info, argp);
 		break;
 
+	case MSMFB_DAMAGE:
+		ret = msmfb_damage(info, argp);
+		break;
+
 	case MSMFB_SET_PAGE_PROTECTION:
 #if defined CONFIG_ARCH_QSD8X50 || defined CONFIG_ARCH_MSM8X60
 		ret = copy_from_user(&fb_page_protection, argp,
@@ -103,6 +103,16 @@ struct msm_fb_data_type {
 	boolean pan_waiting;
 	struct completion pan_comp;
 
+	/* async DMA2 commit, one frame queued behind the one in flight */
+	struct work_struct dma_commit_worker;
+	wait_queue_head_t dma_commit_wq;
+	boolean dma_commit_pending;
+	ktime_t dma_commit_time;
+
+	/* MSMFB_DAMAGE bounding box, consumed by the next pan */
+	struct mdp_dirty_region damage;
+	boolean damage_valid;
+
 	/* vsync */
 	boolean use_mdp_vsync;
 	__u32 vsync_gpio;
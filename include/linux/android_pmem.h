@@ -60,6 +60,11 @@
 
 #define PMEM_GET_FREE_SPACE	_IOW(PMEM_IOCTL_MAGIC, 14, unsigned int)
 #define PMEM_ALLOCATE_ALIGNED	_IOW(PMEM_IOCTL_MAGIC, 15, unsigned int)
+/* clean and/or invalidate a list of ranges of one buffer in one call, see
+ * struct pmem_cache_ranges */
+#define PMEM_CACHE_MAINT_RANGES	_IOWR(PMEM_IOCTL_MAGIC, 16, struct pmem_cache_ranges)
+
+#define PMEM_MAX_CACHE_RANGES	64
 struct pmem_region {
 	unsigned long offset;
 	unsigned long len;
@@ -81,6 +86,16 @@ struct pmem_allocation {
 	unsigned int align;
 };
 
+struct pmem_cache_ranges {
+	/* PMEM_CLEAN_CACHES, PMEM_INV_CACHES or PMEM_CLEAN_INV_CACHES */
+	unsigned int cmd;
+	/* number of entries in ranges, at most PMEM_MAX_CACHE_RANGES */
+	unsigned int nr;
+	struct pmem_addr *ranges;
+	/* returned: time spent on the cache maintenance itself */
+	unsigned long time_us;
+};
+
 #ifdef __KERNEL__
 int get_pmem_file(unsigned int fd, unsigned long *start, unsigned long *vstart,
 		  unsigned long *end, struct file **filp);
@@ -93,6 +108,9 @@ void flush_pmem_fd(int fd, unsigned long start, unsigned long len);
 void flush_pmem_file(struct file *file, unsigned long start, unsigned long len);
 int pmem_cache_maint(struct file *file, unsigned int cmd,
 		struct pmem_addr *pmem_addr);
+int pmem_cache_maint_ranges(struct file *file, unsigned int cmd,
+		const struct pmem_addr *addrs, unsigned int nr,
+		unsigned long *time_us);
 
 enum pmem_allocator_type {
 	/* Zero is a default in platform PMEM structures in the board files,
@@ -175,6 +193,11 @@ struct android_pmem_platform_data
 	 * indicates this pmem may be reused via fmem
 	 */
 	int reusable;
+	/*
+	 * lend free pages to cleancache while pmem isn't using them
+	 * (bitmap allocator only, needs CONFIG_ANDROID_PMEM_CLEANCACHE)
+	 */
+	int cleancache;
 };
 
 int pmem_setup(struct android_pmem_platform_data *pdata,
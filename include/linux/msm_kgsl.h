@@ -223,6 +223,22 @@ struct kgsl_device_waittimestamp {
 #define IOCTL_KGSL_DEVICE_WAITTIMESTAMP \
 	_IOW(KGSL_IOC_TYPE, 0x6, struct kgsl_device_waittimestamp)
 
+/* block until the GPU has executed past any one of a list of timestamps.
+ * On return bit n of retired is set if timestamps[n] has expired.
+ * timeout is in milliseconds.
+ */
+#define KGSL_WAITTIMESTAMP_ANY_MAX 32
+
+struct kgsl_device_waittimestamp_any {
+	unsigned int *timestamps;
+	unsigned int count;
+	unsigned int timeout;
+	unsigned int retired;
+};
+
+#define IOCTL_KGSL_DEVICE_WAITTIMESTAMP_ANY \
+	_IOWR(KGSL_IOC_TYPE, 0x32, struct kgsl_device_waittimestamp_any)
+
 
 /* issue indirect commands to the GPU.
  * drawctxt_id must have been created with IOCTL_KGSL_DRAWCTXT_CREATE
@@ -27,7 +27,14 @@
 #include <linux/personality.h>
 #include <linux/bitops.h>
 #include <linux/mutex.h>
+#include <linux/rbtree.h>
+#include <linux/spinlock.h>
 #include <linux/shmem_fs.h>
+#include <linux/hash.h>
+#include <linux/slab.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/ktime.h>
 #include <linux/ashmem.h>
 #include <asm/cacheflush.h>
 
@@ -35,48 +42,98 @@
 #define ASHMEM_NAME_PREFIX_LEN (sizeof(ASHMEM_NAME_PREFIX) - 1)
 #define ASHMEM_FULL_NAME_LEN (ASHMEM_NAME_LEN + ASHMEM_NAME_PREFIX_LEN)
 
+#define ASHMEM_STAT_HASH_BITS	6
+#define ASHMEM_STAT_MAX		256	/* names tracked before "<other>" */
+#define ASHMEM_PURGE_LOG	64	/* purge events kept for debugfs */
+
+/*
+ * ashmem_name_stat - usage of all areas sharing one name
+ * Lifecycle: Created on first mmap of a name, never freed
+ * Locking: Counters protected by `ashmem_stat_lock'
+ */
+struct ashmem_name_stat {
+	struct hlist_node node;		/* entry in ashmem_stat_hash */
+	char name[ASHMEM_NAME_LEN];
+	unsigned int areas;		/* live areas with this name */
+	size_t size;			/* bytes mapped by those areas */
+	size_t unpinned;		/* of which currently unpinned */
+	u64 purged;			/* bytes purged, cumulative */
+	unsigned long purges;		/* ranges purged, cumulative */
+};
+
+struct ashmem_purge_event {
+	s64 when_us;			/* ktime_get() at purge */
+	struct ashmem_name_stat *stat;	/* area name */
+	size_t pgstart;			/* first purged page */
+	size_t pages;			/* pages purged */
+	pid_t pid;			/* task doing the reclaim */
+	char comm[TASK_COMM_LEN];
+};
+
 /*
  * ashmem_area - anonymous shared memory area
  * Lifecycle: From our parent file's open() until its release()
- * Locking: Protected by `ashmem_mutex'
+ * Locking: Protected by its own `mutex'
  * Big Note: Mappings do NOT pin this structure; it dies on close()
  */
 struct ashmem_area {
 	char name[ASHMEM_FULL_NAME_LEN]; /* optional name in /proc/pid/maps */
-	struct list_head unpinned_list;	 /* list of all ashmem areas */
+	struct mutex mutex;		 /* protects this area and its ranges */
+	struct rb_root unpinned_root;	 /* unpinned ranges, by pgstart */
 	struct file *file;		 /* the shmem-based backing file */
 	size_t size;			 /* size of the mapping, in bytes */
 	unsigned long vm_start;		 /* Start address of vm_area
 					  * which maps this ashmem */
 	unsigned long prot_mask;	 /* allowed prot bits, as vm_flags */
+	struct ashmem_name_stat *stat;	 /* per-name usage, set with file */
 };
 
 /*
  * ashmem_range - represents an interval of unpinned (evictable) pages
  * Lifecycle: From unpin to pin
- * Locking: Protected by `ashmem_mutex'
+ * Locking: Protected by the owning area's `mutex'; `lru' and `purged'
+ *          additionally by `ashmem_lru_lock'
+ *
+ * The ranges of one area never overlap, so an rbtree ordered by pgstart
+ * is also ordered by pgend and serves as the area's interval tree.
  */
 struct ashmem_range {
 	struct list_head lru;		/* entry in LRU list */
-	struct list_head unpinned;	/* entry in its area's unpinned list */
+	struct rb_node node;		/* entry in its area's unpinned tree */
 	struct ashmem_area *asma;	/* associated area */
 	size_t pgstart;			/* starting page, inclusive */
 	size_t pgend;			/* ending page, inclusive */
 	unsigned int purged;		/* ASHMEM_NOT or ASHMEM_WAS_PURGED */
 };
 
-/* LRU list of unpinned pages, protected by ashmem_mutex */
+/* LRU list of unpinned pages, protected by ashmem_lru_lock */
 static LIST_HEAD(ashmem_lru_list);
 
-/* Count of pages on our LRU list, protected by ashmem_mutex */
+/* Count of pages on our LRU list, protected by ashmem_lru_lock */
 static unsigned long lru_count;
 
 /*
- * ashmem_mutex - protects the list of and each individual ashmem_area
+ * ashmem_lru_lock - protects the global LRU list and lru_count
+ *
+ * Lock Ordering: asma->mutex -> i_mutex -> i_alloc_sem
+ *                asma->mutex -> ashmem_lru_lock
  *
- * Lock Ordering: ashmex_mutex -> i_mutex -> i_alloc_sem
+ * The shrinker runs the other way round, so it only ever trylocks an
+ * area's mutex from under ashmem_lru_lock and skips busy areas.
  */
-static DEFINE_MUTEX(ashmem_mutex);
+static DEFINE_SPINLOCK(ashmem_lru_lock);
+
+/*
+ * ashmem_stat_lock - protects the per-name table, its counters and the
+ * purge log. Innermost lock; never held across anything that sleeps.
+ */
+static DEFINE_SPINLOCK(ashmem_stat_lock);
+static struct hlist_head ashmem_stat_hash[1 << ASHMEM_STAT_HASH_BITS];
+static unsigned int ashmem_stat_count;
+static struct ashmem_name_stat ashmem_stat_other = { .name = "<other>" };
+
+static struct ashmem_purge_event ashmem_purge_log[ASHMEM_PURGE_LOG];
+static unsigned int ashmem_purge_head;
 
 static struct kmem_cache *ashmem_area_cachep __read_mostly;
 static struct kmem_cache *ashmem_range_cachep __read_mostly;
@@ -93,43 +150,174 @@ static struct kmem_cache *ashmem_range_cachep __read_mostly;
 #define page_range_subsumed_by_range(range, start, end) \
 	(((range)->pgstart <= (start)) && ((range)->pgend >= (end)))
 
-#define page_in_range(range, page) \
-	(((range)->pgstart <= (page)) && ((range)->pgend >= (page)))
+#define PROT_MASK		(PROT_EXEC | PROT_READ | PROT_WRITE)
+
+static unsigned int ashmem_stat_hashfn(const char *name)
+{
+	return hash_32(full_name_hash(name, strlen(name)),
+		       ASHMEM_STAT_HASH_BITS);
+}
+
+/*
+ * ashmem_stat_get - find or create the per-name entry for 'asma' and
+ * charge the area's size to it. Called once, when the backing file is
+ * created; the name cannot change after that.
+ *
+ * Caller must hold asma->mutex.
+ */
+static void ashmem_stat_get(struct ashmem_area *asma)
+{
+	const char *name = asma->name + ASHMEM_NAME_PREFIX_LEN;
+	struct hlist_head *head;
+	struct hlist_node *n;
+	struct ashmem_name_stat *stat, *new;
+
+	if (*name == '\0')
+		name = ASHMEM_NAME_DEF;
+	head = &ashmem_stat_hash[ashmem_stat_hashfn(name)];
+
+	/* allocate up front, kzalloc may sleep */
+	new = kzalloc(sizeof(*new), GFP_KERNEL);
+
+	spin_lock(&ashmem_stat_lock);
+	hlist_for_each_entry(stat, n, head, node)
+		if (!strcmp(stat->name, name))
+			goto found;
+
+	if (new && ashmem_stat_count < ASHMEM_STAT_MAX) {
+		stat = new;
+		new = NULL;
+		strlcpy(stat->name, name, sizeof(stat->name));
+		hlist_add_head(&stat->node, head);
+		ashmem_stat_count++;
+	} else {
+		stat = &ashmem_stat_other;
+	}
+found:
+	stat->areas++;
+	stat->size += PAGE_ALIGN(asma->size);
+	asma->stat = stat;
+	spin_unlock(&ashmem_stat_lock);
+
+	kfree(new);
+}
 
-#define page_range_in_range(range, start, end) \
-	(page_in_range(range, start) || page_in_range(range, end) || \
-		page_range_subsumes_range(range, start, end))
+/* Caller must hold asma->mutex; the area has no ranges left. */
+static void ashmem_stat_put(struct ashmem_area *asma)
+{
+	struct ashmem_name_stat *stat = asma->stat;
 
-#define range_before_page(range, page) \
-	((range)->pgend < (page))
+	spin_lock(&ashmem_stat_lock);
+	stat->areas--;
+	stat->size -= PAGE_ALIGN(asma->size);
+	spin_unlock(&ashmem_stat_lock);
+}
 
-#define PROT_MASK		(PROT_EXEC | PROT_READ | PROT_WRITE)
+/* Caller must hold asma->mutex. */
+static inline void ashmem_stat_unpinned(struct ashmem_area *asma, long pages)
+{
+	spin_lock(&ashmem_stat_lock);
+	asma->stat->unpinned += pages * PAGE_SIZE;
+	spin_unlock(&ashmem_stat_lock);
+}
 
+/* Caller must hold asma->mutex. */
+static void ashmem_stat_purged(struct ashmem_area *asma, size_t pgstart,
+			       size_t pages)
+{
+	struct ashmem_purge_event *ev;
+
+	spin_lock(&ashmem_stat_lock);
+	asma->stat->purged += (u64)pages * PAGE_SIZE;
+	asma->stat->purges++;
+
+	ev = &ashmem_purge_log[ashmem_purge_head++ % ASHMEM_PURGE_LOG];
+	ev->when_us = ktime_to_us(ktime_get());
+	ev->stat = asma->stat;
+	ev->pgstart = pgstart;
+	ev->pages = pages;
+	ev->pid = current->pid;
+	get_task_comm(ev->comm, current);
+	spin_unlock(&ashmem_stat_lock);
+}
+
+/* Caller must hold ashmem_lru_lock. */
 static inline void lru_add(struct ashmem_range *range)
 {
 	list_add_tail(&range->lru, &ashmem_lru_list);
 	lru_count += range_size(range);
 }
 
+/* Caller must hold ashmem_lru_lock. */
 static inline void lru_del(struct ashmem_range *range)
 {
 	list_del(&range->lru);
 	lru_count -= range_size(range);
 }
 
+/*
+ * range_lookup - return the lowest range of 'asma' that ends at or after
+ * 'pgstart', or NULL. Walking on with range_next() while range->pgstart
+ * is <= some pgend visits exactly the ranges overlapping [pgstart, pgend].
+ *
+ * Caller must hold asma->mutex.
+ */
+static struct ashmem_range *range_lookup(struct ashmem_area *asma,
+					 size_t pgstart)
+{
+	struct rb_node *n = asma->unpinned_root.rb_node;
+	struct ashmem_range *range, *found = NULL;
+
+	while (n) {
+		range = rb_entry(n, struct ashmem_range, node);
+		if (range->pgend >= pgstart) {
+			found = range;
+			n = n->rb_left;
+		} else {
+			n = n->rb_right;
+		}
+	}
+
+	return found;
+}
+
+static inline struct ashmem_range *range_next(struct ashmem_range *range)
+{
+	struct rb_node *n = rb_next(&range->node);
+
+	return n ? rb_entry(n, struct ashmem_range, node) : NULL;
+}
+
+static void range_insert(struct ashmem_area *asma, struct ashmem_range *range)
+{
+	struct rb_node **p = &asma->unpinned_root.rb_node;
+	struct rb_node *parent = NULL;
+	struct ashmem_range *entry;
+
+	while (*p) {
+		parent = *p;
+		entry = rb_entry(parent, struct ashmem_range, node);
+		if (range->pgstart < entry->pgstart)
+			p = &parent->rb_left;
+		else
+			p = &parent->rb_right;
+	}
+
+	rb_link_node(&range->node, parent, p);
+	rb_insert_color(&range->node, &asma->unpinned_root);
+}
+
 /*
  * range_alloc - allocate and initialize a new ashmem_range structure
  *
  * 'asma' - associated ashmem_area
- * 'prev_range' - the previous ashmem_range in the sorted asma->unpinned list
  * 'purged' - initial purge value (ASMEM_NOT_PURGED or ASHMEM_WAS_PURGED)
  * 'start' - starting page, inclusive
  * 'end' - ending page, inclusive
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
-static int range_alloc(struct ashmem_area *asma,
-		       struct ashmem_range *prev_range, unsigned int purged,
+static int range_alloc(struct ashmem_area *asma, unsigned int purged,
 		       size_t start, size_t end)
 {
 	struct ashmem_range *range;
@@ -143,26 +331,37 @@ static int range_alloc(struct ashmem_area *asma,
 	range->pgend = end;
 	range->purged = purged;
 
-	list_add_tail(&range->unpinned, &prev_range->unpinned);
+	range_insert(asma, range);
+	ashmem_stat_unpinned(asma, range_size(range));
 
-	if (range_on_lru(range))
+	if (range_on_lru(range)) {
+		spin_lock(&ashmem_lru_lock);
 		lru_add(range);
+		spin_unlock(&ashmem_lru_lock);
+	}
 
 	return 0;
 }
 
+/* Caller must hold range->asma->mutex. */
 static void range_del(struct ashmem_range *range)
 {
-	list_del(&range->unpinned);
-	if (range_on_lru(range))
+	rb_erase(&range->node, &range->asma->unpinned_root);
+	ashmem_stat_unpinned(range->asma, -(long)range_size(range));
+	if (range_on_lru(range)) {
+		spin_lock(&ashmem_lru_lock);
 		lru_del(range);
+		spin_unlock(&ashmem_lru_lock);
+	}
 	kmem_cache_free(ashmem_range_cachep, range);
 }
 
 /*
  * range_shrink - shrinks a range
  *
- * Caller must hold ashmem_mutex.
+ * The new bounds stay inside the old ones, so the tree order holds.
+ *
+ * Caller must hold range->asma->mutex.
  */
 static inline void range_shrink(struct ashmem_range *range,
 				size_t start, size_t end)
@@ -171,9 +370,13 @@ static inline void range_shrink(struct ashmem_range *range,
 
 	range->pgstart = start;
 	range->pgend = end;
+	ashmem_stat_unpinned(range->asma, -(long)(pre - range_size(range)));
 
-	if (range_on_lru(range))
+	if (range_on_lru(range)) {
+		spin_lock(&ashmem_lru_lock);
 		lru_count -= pre - range_size(range);
+		spin_unlock(&ashmem_lru_lock);
+	}
 }
 
 static int ashmem_open(struct inode *inode, struct file *file)
@@ -189,7 +392,8 @@ static int ashmem_open(struct inode *inode, struct file *file)
 	if (unlikely(!asma))
 		return -ENOMEM;
 
-	INIT_LIST_HEAD(&asma->unpinned_list);
+	mutex_init(&asma->mutex);
+	asma->unpinned_root = RB_ROOT;
 	memcpy(asma->name, ASHMEM_NAME_PREFIX, ASHMEM_NAME_PREFIX_LEN);
 	asma->prot_mask = PROT_MASK;
 	file->private_data = asma;
@@ -200,12 +404,14 @@ static int ashmem_open(struct inode *inode, struct file *file)
 static int ashmem_release(struct inode *ignored, struct file *file)
 {
 	struct ashmem_area *asma = file->private_data;
-	struct ashmem_range *range, *next;
+	struct rb_node *n;
 
-	mutex_lock(&ashmem_mutex);
-	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned)
-		range_del(range);
-	mutex_unlock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
+	while ((n = rb_first(&asma->unpinned_root)))
+		range_del(rb_entry(n, struct ashmem_range, node));
+	if (asma->stat)
+		ashmem_stat_put(asma);
+	mutex_unlock(&asma->mutex);
 
 	if (asma->file)
 		fput(asma->file);
@@ -220,7 +426,7 @@ static ssize_t ashmem_read(struct file *file, char __user *buf,
 	struct ashmem_area *asma = file->private_data;
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* If size is not set, or set to 0, always return EOF. */
 	if (asma->size == 0)
@@ -231,7 +437,7 @@ static ssize_t ashmem_read(struct file *file, char __user *buf,
 		goto out_unlock;
 	}
 
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	/*
 	 * asma and asma->file are used outside the lock here.  We assume
@@ -247,7 +453,7 @@ static ssize_t ashmem_read(struct file *file, char __user *buf,
 	return ret;
 
 out_unlock:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -256,7 +462,7 @@ static loff_t ashmem_llseek(struct file *file, loff_t offset, int origin)
 	struct ashmem_area *asma = file->private_data;
 	int ret;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	if (asma->size == 0) {
 		ret = -EINVAL;
@@ -276,7 +482,7 @@ static loff_t ashmem_llseek(struct file *file, loff_t offset, int origin)
 	file->f_pos = asma->file->f_pos;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -292,7 +498,7 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 	struct ashmem_area *asma = file->private_data;
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* user needs to SET_SIZE before mapping */
 	if (unlikely(!asma->size)) {
@@ -322,6 +528,7 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 			goto out;
 		}
 		asma->file = vmfile;
+		ashmem_stat_get(asma);
 	}
 	get_file(asma->file);
 
@@ -336,10 +543,35 @@ static int ashmem_mmap(struct file *file, struct vm_area_struct *vma)
 	asma->vm_start = vma->vm_start;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
+/*
+ * lru_take_unlocked_range - detach the least-recently-unpinned range whose
+ * area is not busy, returning it with its area's mutex held, or NULL.
+ *
+ * A range still on the LRU keeps its area alive: ashmem_release() has to
+ * take the area mutex and then ashmem_lru_lock to unlink it.
+ */
+static struct ashmem_range *lru_take_unlocked_range(void)
+{
+	struct ashmem_range *range;
+
+	spin_lock(&ashmem_lru_lock);
+	list_for_each_entry(range, &ashmem_lru_list, lru) {
+		if (!mutex_trylock(&range->asma->mutex))
+			continue;
+		range->purged = ASHMEM_WAS_PURGED;
+		lru_del(range);
+		spin_unlock(&ashmem_lru_lock);
+		return range;
+	}
+	spin_unlock(&ashmem_lru_lock);
+
+	return NULL;
+}
+
 /*
  * ashmem_shrink - our cache shrinker, called from mm/vmscan.c :: shrink_slab
  *
@@ -353,11 +585,12 @@ out:
  *
  * We approximate LRU via least-recently-unpinned, jettisoning unpinned partial
  * chunks of ashmem regions LRU-wise one-at-a-time until we hit 'nr_to_scan'
- * pages freed.
+ * pages freed. Areas that are busy pinning or unpinning are skipped rather
+ * than waited on.
  */
 static int ashmem_shrink(struct shrinker *s, struct shrink_control *sc)
 {
-	struct ashmem_range *range, *next;
+	struct ashmem_range *range;
 
 	/* We might recurse into filesystem code, so bail out if necessary */
 	if (sc->nr_to_scan && !(sc->gfp_mask & __GFP_FS))
@@ -365,21 +598,26 @@ static int ashmem_shrink(struct shrinker *s, struct shrink_control *sc)
 	if (!sc->nr_to_scan)
 		return lru_count;
 
-	mutex_lock(&ashmem_mutex);
-	list_for_each_entry_safe(range, next, &ashmem_lru_list, lru) {
-		struct inode *inode = range->asma->file->f_dentry->d_inode;
-		loff_t start = range->pgstart * PAGE_SIZE;
-		loff_t end = (range->pgend + 1) * PAGE_SIZE - 1;
+	while (sc->nr_to_scan > 0) {
+		struct ashmem_area *asma;
+		struct inode *inode;
+		loff_t start, end;
 
-		vmtruncate_range(inode, start, end);
-		range->purged = ASHMEM_WAS_PURGED;
-		lru_del(range);
+		range = lru_take_unlocked_range();
+		if (!range)
+			break;
+
+		asma = range->asma;
+		inode = asma->file->f_dentry->d_inode;
+		start = range->pgstart * PAGE_SIZE;
+		end = (range->pgend + 1) * PAGE_SIZE - 1;
 
+		vmtruncate_range(inode, start, end);
 		sc->nr_to_scan -= range_size(range);
-		if (sc->nr_to_scan <= 0)
-			break;
+		ashmem_stat_purged(asma, range->pgstart, range_size(range));
+
+		mutex_unlock(&asma->mutex);
 	}
-	mutex_unlock(&ashmem_mutex);
 
 	return lru_count;
 }
@@ -393,7 +631,7 @@ static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 {
 	int ret = 0;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	/* the user can only remove, not add, protection bits */
 	if (unlikely((asma->prot_mask & prot) != prot)) {
@@ -408,7 +646,7 @@ static int set_prot_mask(struct ashmem_area *asma, unsigned long prot)
 	asma->prot_mask = prot;
 
 out:
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -419,10 +657,10 @@ static int set_name(struct ashmem_area *asma, void __user *name)
 	char local_name[ASHMEM_NAME_LEN];
 
 	/*
-	 * Holding the ashmem_mutex while doing a copy_from_user might cause
+	 * Holding the asma->mutex while doing a copy_from_user might cause
 	 * an data abort which would try to access mmap_sem. If another
 	 * thread has invoked ashmem_mmap then it will be holding the
-	 * semaphore and will be waiting for ashmem_mutex, there by leading to
+	 * semaphore and will be waiting for asma->mutex, there by leading to
 	 * deadlock. We'll release the mutex  and take the name to a local
 	 * variable that does not need protection and later copy the local
 	 * variable to the structure member with lock held.
@@ -432,14 +670,14 @@ static int set_name(struct ashmem_area *asma, void __user *name)
 		return len;
 	if (len == ASHMEM_NAME_LEN)
 		local_name[ASHMEM_NAME_LEN - 1] = '\0';
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 	/* cannot change an existing mapping's name */
 	if (unlikely(asma->file))
 		ret = -EINVAL;
 	else
 		strcpy(asma->name + ASHMEM_NAME_PREFIX_LEN, local_name);
 
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 	return ret;
 }
 
@@ -455,7 +693,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
 	 */
 	char local_name[ASHMEM_NAME_LEN];
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 	if (asma->name[ASHMEM_NAME_PREFIX_LEN] != '\0') {
 
 		/*
@@ -468,7 +706,7 @@ static int get_name(struct ashmem_area *asma, void __user *name)
 		len = sizeof(ASHMEM_NAME_DEF);
 		memcpy(local_name, ASHMEM_NAME_DEF, len);
 	}
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	/*
 	 * Now we are just copying from the stack variable to userland
@@ -483,17 +721,17 @@ static int get_name(struct ashmem_area *asma, void __user *name)
  * ashmem_pin - pin the given ashmem region, returning whether it was
  * previously purged (ASHMEM_WAS_PURGED) or not (ASHMEM_NOT_PURGED).
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 {
 	struct ashmem_range *range, *next;
 	int ret = ASHMEM_NOT_PURGED;
+	size_t end;
 
-	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned) {
-		/* moved past last applicable page; we can short circuit */
-		if (range_before_page(range, pgstart))
-			break;
+	for (range = range_lookup(asma, pgstart);
+	     range && range->pgstart <= pgend; range = next) {
+		next = range_next(range);
 
 		/*
 		 * The user can ask us to pin pages that span multiple ranges,
@@ -510,37 +748,36 @@ static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 		 *    so we have to update one side of the range and then
 		 *    create a new range for the other side.
 		 */
-		if (page_range_in_range(range, pgstart, pgend)) {
-			ret |= range->purged;
-
-			/* Case #1: Easy. Just nuke the whole thing. */
-			if (page_range_subsumes_range(range, pgstart, pgend)) {
-				range_del(range);
-				continue;
-			}
+		ret |= range->purged;
 
-			/* Case #2: We overlap from the start, so adjust it */
-			if (range->pgstart >= pgstart) {
-				range_shrink(range, pgend + 1, range->pgend);
-				continue;
-			}
+		/* Case #1: Easy. Just nuke the whole thing. */
+		if (page_range_subsumes_range(range, pgstart, pgend)) {
+			range_del(range);
+			continue;
+		}
 
-			/* Case #3: We overlap from the rear, so adjust it */
-			if (range->pgend <= pgend) {
-				range_shrink(range, range->pgstart, pgstart-1);
-				continue;
-			}
+		/* Case #2: We overlap from the start, so adjust it */
+		if (range->pgstart >= pgstart) {
+			range_shrink(range, pgend + 1, range->pgend);
+			continue;
+		}
 
-			/*
-			 * Case #4: We eat a chunk out of the middle. A bit
-			 * more complicated, we allocate a new range for the
-			 * second half and adjust the first chunk's endpoint.
-			 */
-			range_alloc(asma, range, range->purged,
-				    pgend + 1, range->pgend);
+		/* Case #3: We overlap from the rear, so adjust it */
+		if (range->pgend <= pgend) {
 			range_shrink(range, range->pgstart, pgstart - 1);
-			break;
+			continue;
 		}
+
+		/*
+		 * Case #4: We eat a chunk out of the middle. A bit
+		 * more complicated, we shrink the first chunk to end
+		 * before the hole and allocate a new range for the
+		 * second half.
+		 */
+		end = range->pgend;
+		range_shrink(range, range->pgstart, pgstart - 1);
+		range_alloc(asma, range->purged, pgend + 1, end);
+		break;
 	}
 
 	return ret;
@@ -549,18 +786,16 @@ static int ashmem_pin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 /*
  * ashmem_unpin - unpin the given range of pages. Returns zero on success.
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static int ashmem_unpin(struct ashmem_area *asma, size_t pgstart, size_t pgend)
 {
 	struct ashmem_range *range, *next;
 	unsigned int purged = ASHMEM_NOT_PURGED;
 
-restart:
-	list_for_each_entry_safe(range, next, &asma->unpinned_list, unpinned) {
-		/* short circuit: this is our insertion point */
-		if (range_before_page(range, pgstart))
-			break;
+	for (range = range_lookup(asma, pgstart);
+	     range && range->pgstart <= pgend; range = next) {
+		next = range_next(range);
 
 		/*
 		 * The user can ask us to unpin pages that are already entirely
@@ -568,40 +803,31 @@ restart:
 		 */
 		if (page_range_subsumed_by_range(range, pgstart, pgend))
 			return 0;
-		if (page_range_in_range(range, pgstart, pgend)) {
-			pgstart = min_t(size_t, range->pgstart, pgstart),
-			pgend = max_t(size_t, range->pgend, pgend);
-			purged |= range->purged;
-			range_del(range);
-			goto restart;
-		}
+
+		pgstart = min_t(size_t, range->pgstart, pgstart);
+		pgend = max_t(size_t, range->pgend, pgend);
+		purged |= range->purged;
+		range_del(range);
 	}
 
-	return range_alloc(asma, range, purged, pgstart, pgend);
+	return range_alloc(asma, purged, pgstart, pgend);
 }
 
 /*
  * ashmem_get_pin_status - Returns ASHMEM_IS_UNPINNED if _any_ pages in the
  * given interval are unpinned and ASHMEM_IS_PINNED otherwise.
  *
- * Caller must hold ashmem_mutex.
+ * Caller must hold asma->mutex.
  */
 static int ashmem_get_pin_status(struct ashmem_area *asma, size_t pgstart,
 				 size_t pgend)
 {
-	struct ashmem_range *range;
-	int ret = ASHMEM_IS_PINNED;
+	struct ashmem_range *range = range_lookup(asma, pgstart);
 
-	list_for_each_entry(range, &asma->unpinned_list, unpinned) {
-		if (range_before_page(range, pgstart))
-			break;
-		if (page_range_in_range(range, pgstart, pgend)) {
-			ret = ASHMEM_IS_UNPINNED;
-			break;
-		}
-	}
+	if (range && range->pgstart <= pgend)
+		return ASHMEM_IS_UNPINNED;
 
-	return ret;
+	return ASHMEM_IS_PINNED;
 }
 
 static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
@@ -633,7 +859,7 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 	pgstart = pin.offset / PAGE_SIZE;
 	pgend = pgstart + (pin.len / PAGE_SIZE) - 1;
 
-	mutex_lock(&ashmem_mutex);
+	mutex_lock(&asma->mutex);
 
 	switch (cmd) {
 	case ASHMEM_PIN:
@@ -647,67 +873,81 @@ static int ashmem_pin_unpin(struct ashmem_area *asma, unsigned long cmd,
 		break;
 	}
 
-	mutex_unlock(&ashmem_mutex);
+	mutex_unlock(&asma->mutex);
 
 	return ret;
 }
 
 #ifdef CONFIG_OUTER_CACHE
-static unsigned int virtaddr_to_physaddr(unsigned int virtaddr)
-{
-	unsigned int physaddr = 0;
-	pgd_t *pgd_ptr = NULL;
-	pud_t *pud_ptr = NULL;
-	pmd_t *pmd_ptr = NULL;
-	pte_t *pte_ptr = NULL, pte;
-
-	spin_lock(&current->mm->page_table_lock);
-	pgd_ptr = pgd_offset(current->mm, virtaddr);
-	if (pgd_none(*pgd_ptr) || pgd_bad(*pgd_ptr)) {
-		pr_err("Failed to convert virtaddr %x to pgd_ptr\n",
-			virtaddr);
-		goto done;
-	}
+#define ASHMEM_CACHE_RANGES 16
 
-	pud_ptr = pud_offset(pgd_ptr, virtaddr);
-	if (pud_none(*pud_ptr) || pud_bad(*pud_ptr)) {
-		pr_err("Failed to convert pgd_ptr %p to pud_ptr\n",
-			(void *)pgd_ptr);
-		goto done;
-	}
-
-	pmd_ptr = pmd_offset(pud_ptr, virtaddr);
-	if (pmd_none(*pmd_ptr) || pmd_bad(*pmd_ptr)) {
-		pr_err("Failed to convert pud_ptr %p to pmd_ptr\n",
-			(void *)pud_ptr);
-		goto done;
-	}
-
-	pte_ptr = pte_offset_map(pmd_ptr, virtaddr);
-	if (!pte_ptr) {
-		pr_err("Failed to convert pmd_ptr %p to pte_ptr\n",
-			(void *)pmd_ptr);
-		goto done;
+/*
+ * The outer cache is maintained by physical address, so walk the page
+ * tables one pte table at a time, merge physically contiguous pages and
+ * hand them over in batches. Pages that aren't present have nothing
+ * cached to maintain.
+ */
+static void ashmem_outer_cache_op(unsigned int op, unsigned long start,
+	unsigned long size)
+{
+	struct msm_cache_range ranges[ASHMEM_CACHE_RANGES];
+	struct mm_struct *mm = current->mm;
+	unsigned long addr = start, end = start + size, next;
+	unsigned int nr = 0;
+
+	for (; addr < end; addr = next) {
+		pgd_t *pgd;
+		pud_t *pud;
+		pmd_t *pmd;
+		pte_t *pte, *orig_pte;
+		spinlock_t *ptl;
+
+		next = pmd_addr_end(addr, end);
+		pgd = pgd_offset(mm, addr);
+		if (pgd_none(*pgd) || pgd_bad(*pgd))
+			continue;
+		pud = pud_offset(pgd, addr);
+		if (pud_none(*pud) || pud_bad(*pud))
+			continue;
+		pmd = pmd_offset(pud, addr);
+		if (pmd_none(*pmd) || pmd_bad(*pmd))
+			continue;
+
+		orig_pte = pte = pte_offset_map_lock(mm, pmd, addr, &ptl);
+		for (; addr < next; addr += PAGE_SIZE, pte++) {
+			unsigned long paddr;
+
+			if (!pte_present(*pte))
+				continue;
+			paddr = pte_pfn(*pte) << PAGE_SHIFT;
+			if (nr && ranges[nr - 1].pstart +
+					ranges[nr - 1].length == paddr) {
+				ranges[nr - 1].length += PAGE_SIZE;
+				continue;
+			}
+			if (nr == ASHMEM_CACHE_RANGES) {
+				msm_cache_maint_ranges(op | MSM_CACHE_OUTER,
+					ranges, nr);
+				nr = 0;
+			}
+			ranges[nr].vstart = addr;
+			ranges[nr].pstart = paddr;
+			ranges[nr].length = PAGE_SIZE;
+			nr++;
+		}
+		pte_unmap_unlock(orig_pte, ptl);
 	}
-	pte = *pte_ptr;
-	physaddr = pte_pfn(pte);
-	pte_unmap(pte_ptr);
-done:
-	spin_unlock(&current->mm->page_table_lock);
-	physaddr <<= PAGE_SHIFT;
-	return physaddr;
+	if (nr)
+		msm_cache_maint_ranges(op | MSM_CACHE_OUTER, ranges, nr);
 }
 #endif
 
-static int ashmem_cache_op(struct ashmem_area *asma,
-	void (*cache_func)(unsigned long vstart, unsigned long length,
-				unsigned long pstart))
+static int ashmem_cache_op(struct ashmem_area *asma, unsigned int op)
 {
 	int ret = 0;
 	struct vm_area_struct *vma;
-#ifdef CONFIG_OUTER_CACHE
-	unsigned long vaddr;
-#endif
+	struct msm_cache_range range;
+
 	if (!asma->vm_start)
 		return -EINVAL;
 
@@ -725,17 +965,16 @@ static int ashmem_cache_op(struct ashmem_area *asma,
 		ret = -EINVAL;
 		goto done;
 	}
+
+	/* the L1 is maintained by virtual address, one range covers it */
+	range.vstart = asma->vm_start;
+	range.pstart = 0;
+	range.length = asma->size;
 #ifndef CONFIG_OUTER_CACHE
-	cache_func(asma->vm_start, asma->size, 0);
+	msm_cache_maint_ranges(op, &range, 1);
 #else
-	for (vaddr = asma->vm_start; vaddr < asma->vm_start + asma->size;
-		vaddr += PAGE_SIZE) {
-		unsigned long physaddr;
-		physaddr = virtaddr_to_physaddr(vaddr);
-		if (!physaddr)
-			return -EINVAL;
-		cache_func(vaddr, PAGE_SIZE, physaddr);
-	}
+	msm_cache_maint_ranges(op | MSM_CACHE_INNER, &range, 1);
+	ashmem_outer_cache_op(op, asma->vm_start, asma->size);
 #endif
 done:
 	up_read(&current->mm->mmap_sem);
@@ -790,13 +1029,13 @@ static long ashmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		}
 		break;
 	case ASHMEM_CACHE_FLUSH_RANGE:
-		ret = ashmem_cache_op(asma, &clean_and_invalidate_caches);
+		ret = ashmem_cache_op(asma, MSM_CACHE_OP_FLUSH);
 		break;
 	case ASHMEM_CACHE_CLEAN_RANGE:
-		ret = ashmem_cache_op(asma, &clean_caches);
+		ret = ashmem_cache_op(asma, MSM_CACHE_OP_CLEAN);
 		break;
 	case ASHMEM_CACHE_INV_RANGE:
-		ret = ashmem_cache_op(asma, &invalidate_caches);
+		ret = ashmem_cache_op(asma, MSM_CACHE_OP_INV);
 		break;
 	}
 
@@ -873,6 +1112,103 @@ static struct miscdevice ashmem_misc = {
 	.fops = &ashmem_fops,
 };
 
+#ifdef CONFIG_DEBUG_FS
+static struct dentry *ashmem_debugfs_dir;
+
+static void ashmem_names_show_one(struct seq_file *m,
+				  struct ashmem_name_stat *stat)
+{
+	seq_printf(m, "%-32s %6u %10zu %10zu %10zu %12llu %8lu\n",
+		   stat->name, stat->areas, stat->size - stat->unpinned,
+		   stat->unpinned, stat->size, stat->purged, stat->purges);
+}
+
+static int ashmem_names_show(struct seq_file *m, void *unused)
+{
+	struct ashmem_name_stat *stat;
+	struct hlist_node *n;
+	int i;
+
+	seq_printf(m, "%-32s %6s %10s %10s %10s %12s %8s\n", "name", "areas",
+		   "pinned", "unpinned", "size", "purged", "purges");
+
+	spin_lock(&ashmem_stat_lock);
+	for (i = 0; i < ARRAY_SIZE(ashmem_stat_hash); i++)
+		hlist_for_each_entry(stat, n, &ashmem_stat_hash[i], node)
+			ashmem_names_show_one(m, stat);
+	ashmem_names_show_one(m, &ashmem_stat_other);
+	spin_unlock(&ashmem_stat_lock);
+
+	return 0;
+}
+
+static int ashmem_names_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ashmem_names_show, NULL);
+}
+
+static const struct file_operations ashmem_names_fops = {
+	.open = ashmem_names_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int ashmem_purges_show(struct seq_file *m, void *unused)
+{
+	struct ashmem_purge_event *ev;
+	unsigned int i, start;
+	s32 usec;
+	s64 sec;
+
+	spin_lock(&ashmem_stat_lock);
+	start = ashmem_purge_head > ASHMEM_PURGE_LOG ?
+		ashmem_purge_head - ASHMEM_PURGE_LOG : 0;
+	for (i = start; i < ashmem_purge_head; i++) {
+		ev = &ashmem_purge_log[i % ASHMEM_PURGE_LOG];
+		sec = div_s64_rem(ev->when_us, USEC_PER_SEC, &usec);
+		seq_printf(m, "%lld.%06d %s pg %zu+%zu by %d (%s)\n",
+			   sec, usec, ev->stat->name,
+			   ev->pgstart, ev->pages, ev->pid, ev->comm);
+	}
+	spin_unlock(&ashmem_stat_lock);
+
+	return 0;
+}
+
+static int ashmem_purges_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ashmem_purges_show, NULL);
+}
+
+static const struct file_operations ashmem_purges_fops = {
+	.open = ashmem_purges_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static void ashmem_debugfs_init(void)
+{
+	ashmem_debugfs_dir = debugfs_create_dir("ashmem", NULL);
+	if (IS_ERR_OR_NULL(ashmem_debugfs_dir))
+		return;
+
+	debugfs_create_file("names", S_IRUGO, ashmem_debugfs_dir, NULL,
+			    &ashmem_names_fops);
+	debugfs_create_file("purges", S_IRUGO, ashmem_debugfs_dir, NULL,
+			    &ashmem_purges_fops);
+}
+
+static void ashmem_debugfs_exit(void)
+{
+	debugfs_remove_recursive(ashmem_debugfs_dir);
+}
+#else
+static inline void ashmem_debugfs_init(void) { }
+static inline void ashmem_debugfs_exit(void) { }
+#endif
+
 static int __init ashmem_init(void)
 {
 	int ret;
@@ -900,6 +1236,7 @@ static int __init ashmem_init(void)
 	}
 
 	register_shrinker(&ashmem_shrinker);
+	ashmem_debugfs_init();
 
 	printk(KERN_INFO "ashmem: initialized\n");
 
@@ -910,6 +1247,7 @@ static void __exit ashmem_exit(void)
 {
 	int ret;
 
+	ashmem_debugfs_exit();
 	unregister_shrinker(&ashmem_shrinker);
 
 	ret = misc_deregister(&ashmem_misc);